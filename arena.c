@@ -0,0 +1,114 @@
+/**
+ * @file arena.c
+ * @brief Bump allocator holding everything parsed from a single input line.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/**
+ * @brief Allocates memory from the arena.
+ *
+ * Memory is handed out sequentially from the current block. When a block is exhausted the next
+ * block is reused, or a new one is created if there is none. Allocations are never freed
+ * individually, the whole arena is released by arena_reset().
+ *
+ * @param arena arena to allocate from
+ * @param size number of bytes required
+ *
+ * @return pointer to the memory, aligned for pointers, or NULL if out of memory
+ */
+void* arena_alloc(Arena* arena, size_t size)
+{
+    /* keep every allocation aligned */
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    while (arena->current == NULL || arena->current->used + size > arena->current->size) {
+        ArenaBlock* next = (arena->current != NULL) ? arena->current->next : arena->first;
+
+        /* reuse the following block if it is large enough, else insert a new one */
+        if (next == NULL || next->size < size) {
+            size_t block_size = (size > ARENA_BLOCK) ? size : ARENA_BLOCK;
+            ArenaBlock* block = malloc(sizeof(ArenaBlock) + block_size);
+            if (block == NULL) {
+                perror("error - out of memory");
+                return NULL;
+            }
+            block->size = block_size;
+            block->next = next;
+            if (arena->current != NULL) {
+                arena->current->next = block;
+            } else {
+                arena->first = block;
+            }
+            next = block;
+        }
+
+        next->used = 0;
+        arena->current = next;
+    }
+
+    void* memory = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    arena->last = memory;
+    return memory;
+}
+
+/**
+ * @brief Enlarges an allocation, in place if it was the most recent one and there is room.
+ *
+ * @param arena arena the memory was allocated from
+ * @param memory existing allocation, or NULL
+ * @param old_size size of the existing allocation
+ * @param new_size size required
+ *
+ * @return pointer to the enlarged memory, or NULL if out of memory
+ */
+void* arena_grow(Arena* arena, void* memory, size_t old_size, size_t new_size)
+{
+    if (memory != NULL && memory == arena->last) {
+        size_t offset = (size_t)((char*)memory - arena->current->data);
+        size_t size = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        if (offset + size <= arena->current->size) {
+            arena->current->used = offset + size;
+            return memory;
+        }
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+    if (grown != NULL && memory != NULL) {
+        memcpy(grown, memory, old_size);
+    }
+    return grown;
+}
+
+/**
+ * @brief Releases every allocation at once. The blocks are kept for reuse.
+ *
+ * @param arena arena to reset
+ */
+void arena_reset(Arena* arena)
+{
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+    arena->current = arena->first;
+    arena->last = NULL;
+}
+
+/**
+ * @brief Returns the memory held by the arena to the system.
+ *
+ * @param arena arena to free
+ */
+void arena_free(Arena* arena)
+{
+    while (arena->first != NULL) {
+        ArenaBlock* block = arena->first;
+        arena->first = block->next;
+        free(block);
+    }
+    arena->current = NULL;
+    arena->last = NULL;
+}
@@ -0,0 +1,716 @@
+/**
+ * @file bench.c
+ * @brief Benchmark driver exercising the shell's own code paths, reporting results as JSON.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * usage: bench/bench [-q] [-s seashell]
+ *
+ * The shell is compiled into the driver (its main() is renamed), so the tokenizer, dispatch,
+ * spawn and built-in paths are measured directly. Batch throughput is measured end to end by
+ * running the seashell binary given by -s over generated batch files.
+ */
+int seashell_main(int, char**, char**);
+#define main seashell_main
+#include "../seashell.c"
+#undef main
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+/* representative input lines for the tokenizer */
+static const char* bench_lines[] = {
+    "ls -al /usr/share/doc > listing.txt 2>> errors.log",
+    "cat logfile.txt | grep error | sort | uniq -c | wc -l",
+    "echo the quick brown fox jumps over the lazy dog &",
+    "cc -std=gnu11 -O2 -Wall -Wextra -c module.c -o module.o",
+};
+
+/* whether a result has been printed yet, for the separating commas */
+static int bench_results = 0;
+
+/**
+ * @brief Built-in function which does nothing, used to measure the cost of dispatch alone.
+ */
+static void bench_nop(Command* command UNUSED, char** env UNUSED)
+{
+}
+
+static Builtin bench_nop_builtin = { "bench-nop", bench_nop, BUILTIN_PIPELINE, NULL };
+
+/**
+ * @brief Returns the current time of the monotonic clock in nanoseconds.
+ */
+static long long bench_now(void)
+{
+    struct timespec now;
+    metrics_now(&now);
+    return metrics_nanoseconds(&now);
+}
+
+/**
+ * @brief Orders samples for qsort().
+ */
+static int bench_compare(const void* a, const void* b)
+{
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints the opening of a result object.
+ *
+ * @param name name of the benchmark
+ * @param iterations number of operations measured
+ */
+static void bench_begin(const char* name, long iterations)
+{
+    printf("%s\n    {\"name\":\"%s\",\"iterations\":%ld", bench_results++ ? "," : "", name, iterations);
+}
+
+/**
+ * @brief Prints the throughput of a benchmark and closes its result object.
+ *
+ * @param iterations number of operations measured
+ * @param elapsed total nanoseconds taken
+ */
+static void bench_rate(long iterations, long long elapsed)
+{
+    printf(",\"seconds\":%.6f,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f}",
+           (double)elapsed / 1e9, (double)elapsed / (double)iterations,
+           (double)iterations * 1e9 / (double)elapsed);
+    fflush(stdout);
+}
+
+/**
+ * @brief Parses a line, exiting if it is rejected.
+ *
+ * @param line line to parse, terminated in place
+ *
+ * @return the parsed pipeline, allocated from the arena
+ */
+static Pipeline* bench_parse(char* line)
+{
+    Pipeline* pipeline = process_input(&line_arena, line);
+    if (pipeline == NULL || pipeline->length == 0) {
+        fprintf(stderr, "error - unable to parse benchmark line\n");
+        exit(EXIT_FAILURE);
+    }
+    return pipeline;
+}
+
+/**
+ * @brief Measures process_input() over the representative lines.
+ *
+ * The line is copied before every call as it is terminated in place, the copy is included.
+ *
+ * @param iterations number of lines to tokenize
+ */
+static void bench_tokenize(long iterations)
+{
+    size_t count = sizeof(bench_lines) / sizeof(bench_lines[0]);
+    size_t lengths[sizeof(bench_lines) / sizeof(bench_lines[0])];
+    char buffer[MAX_BUFFER];
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = strlen(bench_lines[i]) + 1;
+    }
+
+    long long start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        size_t line = (size_t)i % count;
+        arena_reset(&line_arena);
+        memcpy(buffer, bench_lines[line], lengths[line]);
+        bench_parse(buffer);
+        bytes += lengths[line] - 1;
+    }
+    long long elapsed = bench_now() - start;
+
+    bench_begin("tokenize", iterations);
+    printf(",\"mb_per_sec\":%.1f", (double)bytes * 1e3 / (double)elapsed);
+    bench_rate(iterations, elapsed);
+}
+
+/**
+ * @brief Classifies a redirection operator as the parser did before scan_redirection().
+ */
+static int bench_reference_redirection(const char* token)
+{
+    static const struct {
+        const char* name;
+        int kind;
+    } operators[] = {
+        { "<", TOKEN_STDIN }, { "0<", TOKEN_STDIN },
+        { ">", TOKEN_STDOUT }, { "1>", TOKEN_STDOUT },
+        { ">>", TOKEN_STDOUT|TOKEN_APPEND }, { "1>>", TOKEN_STDOUT|TOKEN_APPEND },
+        { "2>", TOKEN_STDERR }, { "2>>", TOKEN_STDERR|TOKEN_APPEND },
+        { "&>", TOKEN_STDOUT|TOKEN_STDERR }, { ">&", TOKEN_STDOUT|TOKEN_STDERR },
+        { "&>>", TOKEN_STDOUT|TOKEN_STDERR|TOKEN_APPEND },
+    };
+
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (strcmp(token, operators[i].name) == 0) {
+            return operators[i].kind;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks every scanning engine finds the same tokens as strspn() and strcspn(), exiting if not.
+ *
+ * Random lines, rich in whitespace, | and the bytes of redirection operators, are placed at every
+ * alignment and ending at the very end of a page followed by an inaccessible one, so an engine
+ * reading across into the next page would crash. Every string of up to four bytes drawn from
+ * those of the operators is classified by both scan_redirection() and the reference.
+ *
+ * @param lines number of random lines to check
+ */
+static void bench_scan_check(long lines)
+{
+    static const char alphabet[] = " \t\n|<>&012ab-";
+    long page = sysconf(_SC_PAGESIZE);
+    char* pages = mmap(NULL, (size_t)page * 2, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    unsigned int seed = 1;
+
+    if (pages == MAP_FAILED || mprotect(pages + page, (size_t)page, PROT_NONE) == -1) {
+        perror("error - unable to check tokenizer");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < lines; i++) {
+        size_t length = (size_t)rand_r(&seed) % 300;
+        /* the end of the page, else any alignment */
+        char* line = (i % 2 == 0) ? pages + page - length - 1
+                                  : pages + page - 512 + rand_r(&seed) % 64;
+        for (size_t j = 0; j < length; j++) {
+            line[j] = (rand_r(&seed) % 8 == 0) ? (char)(rand_r(&seed) % 255 + 1)
+                                               : alphabet[(unsigned)rand_r(&seed) % (sizeof(alphabet) - 1)];
+        }
+        line[length] = '\0';
+
+        for (const ScanEngine* engine = scan_engines; engine->name != NULL; engine++) {
+            if (engine->supported != NULL && !engine->supported()) {
+                continue;
+            }
+            for (size_t j = 0; j <= length; j++) {
+                if (engine->skip(line + j) != scan_skip_libc(line + j)
+                        || engine->end(line + j) != scan_end_libc(line + j)) {
+                    fprintf(stderr, "error - %s tokenizer differs at byte %zu of line %ld\n",
+                            engine->name, j, i);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    munmap(pages, (size_t)page * 2);
+
+    /* every string of up to four of these bytes */
+    static const char bytes[] = "<>&012|a";
+    char token[5];
+    long tokens = 0;
+    for (size_t length = 0; length <= 4; length++) {
+        long combinations = 1L << (3 * length);
+        for (long n = 0; n < combinations; n++) {
+            for (size_t j = 0; j < length; j++) {
+                token[j] = bytes[(n >> (3 * j)) & 7];
+            }
+            token[length] = '\0';
+            tokens++;
+            if (scan_redirection(token) != bench_reference_redirection(token)) {
+                fprintf(stderr, "error - redirection %s classified as %d\n", token,
+                        scan_redirection(token));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    bench_begin("scan_check", lines);
+    printf(",\"operators\":%ld,\"engine\":\"%s\"}", tokens, scan_engine->name);
+    fflush(stdout);
+}
+
+/**
+ * @brief Measures the throughput of each scanning engine over a long generated line.
+ *
+ * Only the bounds of the tokens are found, the line is left as it is.
+ *
+ * @param name name of the benchmark, followed by that of the engine
+ * @param megabytes length of the line
+ * @param shortest shortest word in the line
+ * @param longest longest word in the line
+ * @param iterations number of times the line is scanned
+ */
+static void bench_scan(const char* name, long megabytes, size_t shortest, size_t longest,
+                       long iterations)
+{
+    size_t size = (size_t)megabytes << 20;
+    char* line = malloc(size + 1);
+    unsigned int seed = 1;
+    char full[64];
+
+    if (line == NULL) {
+        perror("error - unable to generate line");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < size; ) {
+        size_t word = shortest + (size_t)rand_r(&seed) % (longest - shortest + 1);
+        for (size_t j = 0; j < word && i < size; j++) {
+            line[i++] = (char)('a' + rand_r(&seed) % 26);
+        }
+        if (i < size) {
+            line[i++] = (rand_r(&seed) % 16 == 0) ? '|' : ' ';
+        }
+    }
+    line[size] = '\0';
+
+    const ScanEngine* engines[8];
+    size_t count = 0;
+    for (const ScanEngine* engine = scan_engines; engine->name != NULL && count < 8; engine++) {
+        if (engine->supported == NULL || engine->supported()) {
+            engines[count++] = engine;
+        }
+    }
+
+    for (size_t e = 0; e < count; e++) {
+        long tokens = 0;
+        long long start = bench_now();
+        for (long i = 0; i < iterations; i++) {
+            char* cursor = line;
+            while (*(cursor = engines[e]->skip(cursor)) != '\0') {
+                cursor = engines[e]->end(cursor);
+                tokens++;
+                if (*cursor != '\0') {
+                    cursor++;
+                }
+            }
+        }
+        long long elapsed = bench_now() - start;
+
+        snprintf(full, sizeof(full), "%s_%s", name, engines[e]->name);
+        bench_begin(full, iterations);
+        printf(",\"tokens\":%ld,\"gb_per_sec\":%.2f", tokens / iterations,
+               (double)size * (double)iterations / (double)elapsed);
+        bench_rate(iterations, elapsed);
+    }
+    free(line);
+}
+
+/**
+ * @brief Measures evaluate_args() dispatching to a built-in function which does nothing.
+ *
+ * @param iterations number of commands to dispatch
+ * @param env environment passed to the built-in function
+ */
+static void bench_dispatch(long iterations, char** env)
+{
+    char line[] = "bench-nop first second third";
+
+    arena_reset(&line_arena);
+    Pipeline* pipeline = bench_parse(line);
+
+    long long start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        evaluate_args(pipeline, env);
+    }
+    long long elapsed = bench_now() - start;
+
+    bench_begin("dispatch", iterations);
+    bench_rate(iterations, elapsed);
+}
+
+/**
+ * @brief Measures the latency of do_execute() launching and waiting for /bin/true.
+ *
+ * @param name name of the benchmark
+ * @param iterations number of processes to launch
+ */
+static void bench_spawn(const char* name, long iterations)
+{
+    char line[] = "/bin/true";
+    long long* samples = malloc((size_t)iterations * sizeof(long long));
+    long long total = 0;
+
+    if (samples == NULL) {
+        perror("error - out of memory");
+        exit(EXIT_FAILURE);
+    }
+
+    arena_reset(&line_arena);
+    Pipeline* pipeline = bench_parse(line);
+
+    for (long i = 0; i < iterations; i++) {
+        long long start = bench_now();
+        do_execute(pipeline->first);
+        samples[i] = bench_now() - start;
+        total += samples[i];
+    }
+    qsort(samples, (size_t)iterations, sizeof(long long), bench_compare);
+
+    bench_begin(name, iterations);
+    printf(",\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f",
+           (double)samples[iterations / 2] / 1e3, (double)samples[iterations * 99 / 100] / 1e3,
+           (double)samples[iterations - 1] / 1e3);
+    bench_rate(iterations, total);
+    free(samples);
+}
+
+/**
+ * @brief Measures the latency of evaluating a line which launches and waits for a process, e.g.
+ * through a prefix such as nice, against running the equivalent external program.
+ *
+ * The line is parsed again for every iteration, outside of the measurement, as prefixes consume
+ * their arguments.
+ *
+ * @param name name of the benchmark
+ * @param text line to evaluate
+ * @param iterations number of times to evaluate the line
+ * @param env environment passed to built-in functions
+ */
+static void bench_prefix(const char* name, const char* text, long iterations, char** env)
+{
+    char line[MAX_BUFFER];
+    long long* samples = malloc((size_t)iterations * sizeof(long long));
+    long long total = 0;
+
+    if (samples == NULL) {
+        perror("error - out of memory");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < iterations; i++) {
+        snprintf(line, sizeof(line), "%s", text);
+        arena_reset(&line_arena);
+        Pipeline* pipeline = bench_parse(line);
+
+        long long start = bench_now();
+        evaluate_args(pipeline, env);
+        samples[i] = bench_now() - start;
+        total += samples[i];
+    }
+    qsort(samples, (size_t)iterations, sizeof(long long), bench_compare);
+
+    bench_begin(name, iterations);
+    printf(",\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f",
+           (double)samples[iterations / 2] / 1e3, (double)samples[iterations * 99 / 100] / 1e3,
+           (double)samples[iterations - 1] / 1e3);
+    bench_rate(iterations, total);
+    free(samples);
+}
+
+/**
+ * @brief Measures the echo built-in writing to a redirected file.
+ *
+ * The file is appended to, rather than truncated, as replacing the contents of a file can force
+ * it to be flushed to disk on close (e.g. ext4 auto_da_alloc), which would swamp the result.
+ *
+ * @param iterations number of times to run echo
+ * @param directory directory in which to create the output file
+ * @param env environment passed to the built-in function
+ */
+static void bench_echo(long iterations, const char* directory, char** env)
+{
+    char line[PATH_MAX + 64];
+
+    snprintf(line, sizeof(line), "echo the quick brown fox jumps over the lazy dog >> %s/echo.out",
+             directory);
+    arena_reset(&line_arena);
+    Pipeline* pipeline = bench_parse(line);
+
+    long long start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        evaluate_args(pipeline, env);
+    }
+    long long elapsed = bench_now() - start;
+
+    bench_begin("echo_redirect", iterations);
+    bench_rate(iterations, elapsed);
+}
+
+/**
+ * @brief Measures process_input() expanding patterns against a large directory.
+ *
+ * Each line holds three patterns against the same directory, which is read once per line. Half
+ * of the files match each of the first two patterns, the third matches ten files.
+ *
+ * @param files number of files to create in the directory
+ * @param iterations number of lines to expand
+ * @param directory directory in which to create the globbed directory
+ */
+static void bench_glob(long files, long iterations, const char* directory)
+{
+    char path[PATH_MAX];
+    char line[3 * PATH_MAX];
+    char buffer[sizeof(line)];
+    char name[32];
+    long matched = 0;
+
+    snprintf(path, sizeof(path), "%s/glob", directory);
+    if (mkdir(path, 0700) == -1) {
+        perror("error - unable to create benchmark directory");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/glob/file%ld.%s", directory, i, (i & 1) ? "c" : "h");
+        int fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0600);
+        if (fd == -1) {
+            perror("error - unable to create benchmark file");
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+
+    snprintf(line, sizeof(line), "bench-nop %s/glob/*.c %s/glob/*.h %s/glob/file?.[ch]",
+             directory, directory, directory);
+    size_t length = strlen(line) + 1;
+
+    long long start = bench_now();
+    for (long i = 0; i < iterations; i++) {
+        arena_reset(&line_arena);
+        memcpy(buffer, line, length);
+        matched += bench_parse(buffer)->first->argc - 1;
+    }
+    long long elapsed = bench_now() - start;
+
+    for (long i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/glob/file%ld.%s", directory, i, (i & 1) ? "c" : "h");
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/glob", directory);
+    rmdir(path);
+
+    snprintf(name, sizeof(name), "glob_%ld", files);
+    bench_begin(name, iterations);
+    printf(",\"names_per_sec\":%.0f", (double)matched * 1e9 / (double)elapsed);
+    bench_rate(iterations, elapsed);
+}
+
+/**
+ * @brief Measures cat copying a large file, as the built-in and as the external program.
+ *
+ * Each line is run the given number of times, the copy being removed between runs, outside the
+ * measurement. The lines copy the file to another file, and into a pipe read by wc.
+ *
+ * @param megabytes size of the file to copy
+ * @param iterations number of copies of each kind
+ * @param directory directory in which to create the files
+ * @param env environment passed to the built-in function
+ */
+static void bench_copy(long megabytes, long iterations, const char* directory, char** env)
+{
+    static const struct {
+        const char* name;
+        const char* format;
+    } lines[] = {
+        { "cat_file", "cat %s/copy.in > %s/copy.out" },
+        { "cat_file_external", "/bin/cat %s/copy.in > %s/copy.out" },
+        { "cat_pipe", "cat %s/copy.in | wc -c > /dev/null" },
+        { "cat_pipe_external", "/bin/cat %s/copy.in | wc -c > /dev/null" },
+    };
+    char source[PATH_MAX];
+    char copy[PATH_MAX];
+    char line[3 * PATH_MAX];
+    char name[64];
+
+    snprintf(source, sizeof(source), "%s/copy.in", directory);
+    snprintf(copy, sizeof(copy), "%s/copy.out", directory);
+
+    /* a megabyte of varied data, repeated */
+    char* block = malloc(1 << 20);
+    int fd = open(source, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+    if (block == NULL || fd == -1) {
+        perror("error - unable to create benchmark file");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned int i = 0; i < (1u << 20); i++) {
+        block[i] = (char)(i * 2654435761u >> 24);
+    }
+    for (long i = 0; i < megabytes; i++) {
+        if (copy_write(fd, block, 1 << 20) == -1) {
+            perror("error - unable to create benchmark file");
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+    free(block);
+
+    for (size_t kind = 0; kind < sizeof(lines) / sizeof(lines[0]); kind++) {
+        long long elapsed = 0;
+        for (long i = 0; i < iterations; i++) {
+            unlink(copy);
+            arena_reset(&line_arena);
+            snprintf(line, sizeof(line), lines[kind].format, directory, directory);
+            Pipeline* pipeline = bench_parse(line);
+
+            long long start = bench_now();
+            evaluate_args(pipeline, env);
+            elapsed += bench_now() - start;
+        }
+
+        snprintf(name, sizeof(name), "%s_%ldmb", lines[kind].name, megabytes);
+        bench_begin(name, iterations);
+        printf(",\"mb_per_sec\":%.1f", (double)(megabytes * iterations) * 1e9 / (double)elapsed);
+        bench_rate(iterations, elapsed);
+    }
+
+    unlink(copy);
+    unlink(source);
+}
+
+/**
+ * @brief Measures the seashell binary executing a generated batch file end to end.
+ *
+ * Every line runs the echo built-in with its output redirected, so the result reflects the
+ * shell's own overhead per command rather than the cost of launching processes. When compiled,
+ * the batch file is compiled (with --compile) before the measurement, which covers running the
+ * compiled copy only.
+ *
+ * @param lines number of lines in the batch file
+ * @param directory directory in which to create the batch file
+ * @param seashell path of the seashell binary
+ * @param compiled whether to run a compiled copy of the batch file
+ */
+static void bench_batch(long lines, const char* directory, const char* seashell, int compiled)
+{
+    char path[PATH_MAX];
+    char copy[PATH_MAX + sizeof(COMPILED_EXTENSION)];
+    char name[32];
+    posix_spawn_file_actions_t actions;
+    int status = 0;
+    pid_t pid;
+
+    snprintf(path, sizeof(path), "%s/batch-%ld", directory, lines);
+    FILE* batch = fopen(path, "w");
+    if (batch == NULL) {
+        perror("error - unable to create batch file");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < lines; i++) {
+        fprintf(batch, "echo batch line %ld > /dev/null\n", i);
+    }
+    fclose(batch);
+
+    snprintf(copy, sizeof(copy), "%s%s", path, COMPILED_EXTENSION);
+    if (compiled) {
+        char* compile[] = { (char*)seashell, "--compile", path, NULL };
+        if (posix_spawn(&pid, seashell, NULL, NULL, compile, environ) != 0) {
+            perror("error - unable to execute seashell");
+            exit(EXIT_FAILURE);
+        }
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "error - seashell failed to compile %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char* args[] = { (char*)seashell, compiled ? copy : path, NULL };
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    long long start = bench_now();
+    if (posix_spawn(&pid, seashell, &actions, NULL, args, environ) != 0) {
+        perror("error - unable to execute seashell");
+        exit(EXIT_FAILURE);
+    }
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    long long elapsed = bench_now() - start;
+
+    posix_spawn_file_actions_destroy(&actions);
+    unlink(path);
+    unlink(copy);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "error - seashell failed on %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(name, sizeof(name), compiled ? "batch_compiled_%ld" : "batch_%ld", lines);
+    bench_begin(name, lines);
+    printf(",\"commands_per_sec\":%.0f", (double)lines * 1e9 / (double)elapsed);
+    bench_rate(lines, elapsed);
+}
+
+/**
+ * @brief Runs every benchmark, printing a JSON document to stdout.
+ *
+ * @param argc number of arguments provided to program
+ * @param argv list of arguments provided to program
+ * @param env list environment variables provided to program
+ *
+ * @return exit code
+ */
+int main(int argc, char* argv[], char** env)
+{
+    const char* seashell = "./seashell";
+    long scale = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qs:")) != -1) {
+        switch (opt) {
+        case 'q':
+            /* quick run, e.g. to check the driver works */
+            scale = 100;
+            break;
+        case 's':
+            seashell = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-q] [-s seashell]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char directory[] = "/tmp/seashell-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        perror("error - unable to create benchmark directory");
+        return EXIT_FAILURE;
+    }
+
+    setup_signal_handlers();
+    setup_builtins();
+    builtin_register(&bench_nop_builtin);
+    scan_setup();
+    jobs_setup();
+    var_setup(env);
+
+    /* forked while the driver is small, as the shell does for -z */
+    zygote_start();
+
+    printf("{\"version\":\"%s\",\"benchmarks\":[", BENCH_VERSION);
+
+    bench_scan_check(20000 / scale);
+    bench_tokenize(2000000 / scale);
+    bench_scan("scan_words", 64 / scale + 1, 1, 12, 5);
+    bench_scan("scan_long", 64 / scale + 1, 64, 256, 5);
+    bench_dispatch(2000000 / scale, env);
+    bench_spawn("spawn_zygote", 2000 / scale);
+    bench_prefix("nice_prefix_zygote", "nice 5 /bin/true", 2000 / scale, env);
+    zygote_stop(1);
+    bench_spawn("spawn", 2000 / scale);
+    bench_prefix("nice_prefix", "nice 5 /bin/true", 2000 / scale, env);
+    bench_prefix("nice_external", "/usr/bin/nice -n 5 /bin/true", 2000 / scale, env);
+    bench_echo(200000 / scale, directory, env);
+    bench_glob(100, 20000 / scale, directory);
+    bench_copy(2048 / scale, 3, directory, env);
+    bench_glob(100000 / scale, 50 / scale + 1, directory);
+    bench_batch(1000 / scale, directory, seashell, 0);
+    bench_batch(100000 / scale, directory, seashell, 0);
+    bench_batch(1000000 / scale, directory, seashell, 0);
+    bench_batch(100000 / scale, directory, seashell, 1);
+    bench_batch(1000000 / scale, directory, seashell, 1);
+
+    printf("\n]}\n");
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/echo.out", directory);
+    unlink(path);
+    rmdir(directory);
+    cleanup();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+###
+# @file spawn.sh
+# @brief Compares commands per second of the fork and posix_spawn launch paths.
+# @author Harrison Rodgers
+# @version 1.0
+# @date 2015-04-23
+#
+# usage: bench/spawn.sh [commands] [make variables ...]
+##
+
+COMMANDS=${1:-10000}
+[ $# -gt 0 ] && shift
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BATCH=$(mktemp)
+trap 'rm -f "$BATCH"' EXIT
+
+make -s -C "$ROOT" "$@" seashell seashell-fork || exit 1
+
+i=0
+while [ $i -lt "$COMMANDS" ]; do
+    echo "/bin/true"
+    i=$((i + 1))
+done > "$BATCH"
+
+run() {
+    start=$(date +%s.%N)
+    "$ROOT/$1" "$BATCH" || exit 1
+    end=$(date +%s.%N)
+    echo "$start $end" | awk -v name="$1" -v n="$COMMANDS" \
+        '{ t = $2 - $1; printf "%-14s %8d commands %8.3f s %10.0f commands/s\n", name, n, t, n / t }'
+}
+
+run seashell-fork
+run seashell
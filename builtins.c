@@ -7,66 +7,422 @@
  */
 #include "seashell.h"
 
+/* indices of the built-in functions provided by the shell within builtin_table */
+enum {
+    BUILTIN_CAT, BUILTIN_CD, BUILTIN_CLR, BUILTIN_DIR, BUILTIN_ECHO, BUILTIN_ENV, BUILTIN_ENVIRON,
+    BUILTIN_EXPORT, BUILTIN_HASH, BUILTIN_HELP, BUILTIN_JOBS, BUILTIN_LIMIT, BUILTIN_MEMO,
+    BUILTIN_NICE, BUILTIN_PARALLEL, BUILTIN_PAUSE, BUILTIN_PIN, BUILTIN_QUIT, BUILTIN_TEE,
+    BUILTIN_TIME, BUILTIN_UNSET, BUILTIN_WAIT, BUILTIN_COUNT
+};
+
+/* built-in functions provided by the shell, found by builtin_find() */
+static const Builtin builtin_table[BUILTIN_COUNT] = {
+    [BUILTIN_CAT] = { "cat", do_cat, BUILTIN_REDIRECT, NULL },
+    [BUILTIN_CD] = { "cd", do_cd, BUILTIN_PARENT, NULL },
+    [BUILTIN_CLR] = { "clr", do_clear, BUILTIN_REDIRECT, NULL },
+    [BUILTIN_DIR] = { "dir", do_dir, BUILTIN_REDIRECT|BUILTIN_PIPELINE, NULL },
+    [BUILTIN_ECHO] = { "echo", do_echo, BUILTIN_REDIRECT|BUILTIN_PIPELINE, NULL },
+    [BUILTIN_ENV] = { "env", do_environ, BUILTIN_REDIRECT|BUILTIN_PIPELINE, NULL },
+    [BUILTIN_ENVIRON] = { "environ", do_environ, BUILTIN_REDIRECT|BUILTIN_PIPELINE, NULL },
+    [BUILTIN_EXPORT] = { "export", do_export, BUILTIN_PARENT|BUILTIN_REDIRECT, NULL },
+    [BUILTIN_HASH] = { "hash", do_hash, BUILTIN_REDIRECT, NULL },
+    [BUILTIN_HELP] = { "help", do_help, BUILTIN_REDIRECT, NULL },
+    [BUILTIN_JOBS] = { "jobs", do_jobs, BUILTIN_REDIRECT|BUILTIN_PIPELINE, NULL },
+    [BUILTIN_LIMIT] = { "limit", do_limit, BUILTIN_PARENT|BUILTIN_PREFIX, NULL },
+    [BUILTIN_MEMO] = { "memo", do_memo, BUILTIN_PARENT|BUILTIN_PREFIX, NULL },
+    [BUILTIN_NICE] = { "nice", do_nice, BUILTIN_PARENT|BUILTIN_PREFIX, NULL },
+    [BUILTIN_PARALLEL] = { "parallel", do_parallel, BUILTIN_REDIRECT, NULL },
+    [BUILTIN_PAUSE] = { "pause", do_pause, BUILTIN_PARENT, NULL },
+    [BUILTIN_PIN] = { "pin", do_pin, BUILTIN_PARENT|BUILTIN_PREFIX, NULL },
+    [BUILTIN_QUIT] = { "quit", quit, BUILTIN_PARENT, NULL },
+    [BUILTIN_TEE] = { "tee", do_tee, BUILTIN_REDIRECT, NULL },
+    [BUILTIN_TIME] = { "time", do_time, BUILTIN_PARENT|BUILTIN_PREFIX, NULL },
+    [BUILTIN_UNSET] = { "unset", do_unset, BUILTIN_PARENT, NULL },
+    [BUILTIN_WAIT] = { "wait", do_wait, BUILTIN_PARENT, NULL },
+};
+
+/* built-in functions registered at run time (e.g. by the benchmarks), chained by name length */
+static Builtin* builtin_registry[BUILTIN_NAME_MAX + 1];
+
+/**
+ * @brief Checks every built-in function provided by the shell can be found by its name.
+ */
+void setup_builtins(void)
+{
+    #ifdef DEBUG
+    for (size_t i = 0; i < BUILTIN_COUNT; i++) {
+        if (builtin_lookup(builtin_table[i].name) != &builtin_table[i]) {
+            printf("debug: built-in function %s is not found by builtin_find()\n",
+                   builtin_table[i].name);
+        }
+    }
+    #endif
+}
+
+/**
+ * @brief Adds a built-in function to the registry.
+ *
+ * A built-in function registered with the name of an existing one replaces it.
+ *
+ * @param builtin entry to add, must remain valid for the lifetime of the shell
+ *
+ * @return 0 on success, -1 if the name is too long
+ */
+int builtin_register(Builtin* builtin)
+{
+    size_t length = strlen(builtin->name);
+
+    if (length == 0 || length > BUILTIN_NAME_MAX) {
+        fprintf(stderr, "error - invalid built-in function name %s\n", builtin->name);
+        return -1;
+    }
+
+    for (Builtin** link = &builtin_registry[length]; *link != NULL; link = &(*link)->next) {
+        if (strcmp((*link)->name, builtin->name) == 0) {
+            builtin->next = (*link)->next;
+            *link = builtin;
+            return 0;
+        }
+    }
+
+    builtin->next = builtin_registry[length];
+    builtin_registry[length] = builtin;
+    return 0;
+}
+
+/**
+ * @brief Finds the built-in function with the given name.
+ *
+ * Those registered at run time come first, so they may replace those provided by the shell,
+ * there are usually none.
+ *
+ * @param name command name
+ *
+ * @return the built-in function, or NULL if the command is not provided by the shell
+ */
+const Builtin* builtin_lookup(const char* name)
+{
+    size_t length = strnlen(name, BUILTIN_NAME_MAX + 1);
+
+    if (length > BUILTIN_NAME_MAX) {
+        return NULL;
+    }
+
+    for (const Builtin* builtin = builtin_registry[length]; builtin != NULL; builtin = builtin->next) {
+        if (builtin->name[0] == name[0] && memcmp(builtin->name, name, length) == 0) {
+            return builtin;
+        }
+    }
+    return builtin_find(name, length);
+}
+
+/**
+ * @brief Finds the built-in function provided by the shell with the given name.
+ *
+ * Switching on the length of the name, then on one of its bytes, leaves a single entry of
+ * builtin_table, so a single comparison is made whatever the number of built-in functions.
+ * A built-in function added to the table must be added here too.
+ *
+ * @param name command name
+ * @param length length of the name
+ *
+ * @return the built-in function, or NULL if the shell provides none of that name
+ */
+const Builtin* builtin_find(const char* name, size_t length)
+{
+    int index;
+
+    switch (length) {
+    case 2:
+        index = BUILTIN_CD;
+        break;
+    case 3:
+        switch (name[0]) {
+        case 'c':
+            index = (name[1] == 'a') ? BUILTIN_CAT : BUILTIN_CLR;
+            break;
+        case 'd':
+            index = BUILTIN_DIR;
+            break;
+        case 'e':
+            index = BUILTIN_ENV;
+            break;
+        case 'p':
+            index = BUILTIN_PIN;
+            break;
+        case 't':
+            index = BUILTIN_TEE;
+            break;
+        default:
+            return NULL;
+        }
+        break;
+    case 4:
+        switch (name[0]) {
+        case 'e':
+            index = BUILTIN_ECHO;
+            break;
+        case 'h':
+            index = (name[1] == 'a') ? BUILTIN_HASH : BUILTIN_HELP;
+            break;
+        case 'j':
+            index = BUILTIN_JOBS;
+            break;
+        case 'm':
+            index = BUILTIN_MEMO;
+            break;
+        case 'n':
+            index = BUILTIN_NICE;
+            break;
+        case 'q':
+            index = BUILTIN_QUIT;
+            break;
+        case 't':
+            index = BUILTIN_TIME;
+            break;
+        case 'w':
+            index = BUILTIN_WAIT;
+            break;
+        default:
+            return NULL;
+        }
+        break;
+    case 5:
+        switch (name[0]) {
+        case 'l':
+            index = BUILTIN_LIMIT;
+            break;
+        case 'p':
+            index = BUILTIN_PAUSE;
+            break;
+        case 'u':
+            index = BUILTIN_UNSET;
+            break;
+        default:
+            return NULL;
+        }
+        break;
+    case 6:
+        index = BUILTIN_EXPORT;
+        break;
+    case 7:
+        index = BUILTIN_ENVIRON;
+        break;
+    case 8:
+        index = BUILTIN_PARALLEL;
+        break;
+    default:
+        return NULL;
+    }
+
+    const Builtin* builtin = &builtin_table[index];
+    return (memcmp(builtin->name, name, length) == 0) ? builtin : NULL;
+}
+
+/**
+ * @brief Finds the built-in function a command runs.
+ *
+ * @param command command to examine
+ *
+ * @return the built-in function, or NULL for an external command
+ */
+const Builtin* command_builtin(Command* command)
+{
+    /* commands from a compiled batch file are known to be external */
+    if (command->is_external || command->args[0] == NULL) {
+        return NULL;
+    }
+    return builtin_lookup(command->args[0]);
+}
+
+/**
+ * @brief Computes a fingerprint of the names of the registered built-in functions.
+ *
+ * Recorded in compiled batch files, which note which of their commands are built-in functions.
+ *
+ * @return FNV-1a of the names
+ */
+uint32_t builtin_fingerprint(void)
+{
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < BUILTIN_COUNT; i++) {
+        hash = builtin_hash(hash, builtin_table[i].name);
+    }
+    for (size_t length = 1; length <= BUILTIN_NAME_MAX; length++) {
+        for (const Builtin* builtin = builtin_registry[length]; builtin != NULL; builtin = builtin->next) {
+            hash = builtin_hash(hash, builtin->name);
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Adds a name, and its terminating NULL, to an FNV-1a hash.
+ *
+ * @param hash hash so far
+ * @param name name to add
+ *
+ * @return the new hash
+ */
+uint32_t builtin_hash(uint32_t hash, const char* name)
+{
+    for (const char* c = name; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619U;
+    }
+    return (hash ^ '\0') * 16777619U;
+}
+
+/**
+ * @brief Determines the file descriptor a built-in function should write its output to.
+ *
+ * @param command built-in function being executed
+ * @param fds descriptors opened by open_redirections()
+ *
+ * @return the redirected output file, else the pipeline's pipe, else stdout
+ */
+int builtin_stdout(Command* command, int fds[3])
+{
+    if (fds[1] != -1) {
+        return fds[1];
+    }
+    if (command->fd_stdout != -1) {
+        return command->fd_stdout;
+    }
+    return STDOUT_FILENO;
+}
+
+/**
+ * @brief Determines the file descriptor a built-in function should read its input from.
+ *
+ * @param command built-in function being executed
+ * @param fds descriptors opened by open_redirections()
+ *
+ * @return the redirected input, else the pipeline's pipe, else stdin
+ */
+int builtin_stdin(Command* command, int fds[3])
+{
+    if (fds[0] != -1) {
+        return fds[0];
+    }
+    if (command->fd_stdin != -1) {
+        return command->fd_stdin;
+    }
+    return STDIN_FILENO;
+}
+
+/**
+ * @brief Executes the external program of the same name as a built-in function, e.g. when given
+ * options the built-in function does not support.
+ *
+ * @param command built-in function being executed
+ */
+void builtin_external(Command* command)
+{
+    Command external = *command;
+
+    do_execute(&external);
+}
+
 /**
  * @brief Prints the full list of environment variables to stdout.
  *
- * Supports i/o redirection.
+ * This is the environment external programs receive, every exported variable as it is now,
+ * rather than the environment the shell was started with. Supports i/o redirection and
+ * pipelines.
  *
+ * @param command built-in function being executed
  * @param env list environment variables provided to program
  */
-void do_environ(char **env)
+void do_environ(Command* command, char** env UNUSED)
 {
+    int fds[3] = { -1, -1, -1 };
+    Output out;
 
-    redirect_filedescriptors();
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+    output_init(&out, builtin_stdout(command, fds));
 
-    int i = 0;
-    while (env[i] != NULL) {
-        printf("%s\n", env[i]);
-        i++;
+    for (char** temp = var_environment(); *temp != NULL; temp++) {
+        output_string(&out, *temp);
+        output_write(&out, "\n", 1);
     }
 
-    restore_filedescriptors();
+    output_flush(&out);
+    close_redirections(fds);
 
 }
 
 /**
- * @brief Alias to the ls process, applies the -a and -l flags automatically.
+ * @brief Lists the contents of directories in the format of ls -al.
  *
- * Supports i/o redirection.
+ * The listing is produced by the shell itself. Should options be given the ls process is
+ * executed instead, with the -a and -l flags applied automatically.
+ *
+ * Supports i/o redirection and pipelines.
+ *
+ * @param command built-in function being executed
  */
-void do_dir()
+void do_dir(Command* command, char** env UNUSED)
 {
-    int argcount = 1;
-    for (char** temp = cmd.args; *temp != NULL; temp++) {
-        argcount++;
+    for (char** temp = command->args+1; *temp != NULL; temp++) {
+        if ((*temp)[0] == '-' && (*temp)[1] != '\0') {
+            dir_ls(command);
+            return;
+        }
     }
 
-    /* check args array out of bounds */
-    if (argcount + 1 > MAX_ARGS) {
-        fprintf(stderr, "too many arguments\n");
+    int fds[3] = { -1, -1, -1 };
+    Output out;
+
+    if (open_redirections(command, fds) == -1) {
         return;
     }
+    output_init(&out, builtin_stdout(command, fds));
+
+    dir_list(&out, command->args+1);
+
+    output_flush(&out);
+    close_redirections(fds);
+}
+
+/**
+ * @brief Alias to the ls process, applies the -a and -l flags automatically.
+ *
+ * @param command built-in function being executed
+ */
+void dir_ls(Command* command)
+{
+    Command ls = *command;
 
-    /* shift args elements over */
-    for (int i = argcount; i > 0; i--) {
-        cmd.args[i]=cmd.args[i-1];
+    /* room for "ls", "-al", the arguments and the terminator */
+    ls.args = arena_alloc(&line_arena, (size_t)(command->argc + 2) * sizeof(char*));
+    if (ls.args == NULL) {
+        return;
     }
 
     /* add "ls" to front, replace "dir" with "-al" */
-    cmd.args[0] ="ls";
-    cmd.args[1] ="-al";
+    ls.args[0] = "ls";
+    ls.args[1] = "-al";
+    memcpy(ls.args + 2, command->args + 1, (size_t)command->argc * sizeof(char*));
+    ls.argc = command->argc + 1;
 
-    do_execute();
+    do_execute(&ls);
 }
 
 /**
  * @brief Clears the terminal output by executing the clear process.
+ *
+ * @param command built-in function being executed
  */
-void do_clear() {
-    cmd.args[0] = "clear";
-    cmd.args[1] = "clear";
-    cmd.args[2] = NULL;
-    do_execute();
+void do_clear(Command* command, char** env UNUSED) {
+    char* args[] = { "clear", NULL };
+    Command clear = *command;
+
+    clear.args = args;
+    clear.argc = 1;
+    do_execute(&clear);
 }
 
 
@@ -74,35 +430,158 @@ void do_clear() {
  * @brief Repeats the arguments back to the user, excluding redirection and background process
  * symbols.
  *
+ * Supports i/o redirection and pipelines.
+ *
+ * @param command built-in function being executed
+ */
+void do_echo(Command* command, char** env UNUSED) {
+    int fds[3] = { -1, -1, -1 };
+    Output out;
+
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+    output_init(&out, builtin_stdout(command, fds));
+
+    for (char** temp = command->args+1; *temp != NULL; temp++) {
+        output_string(&out, *temp);
+        output_write(&out, " ", 1);
+    }
+    output_write(&out, "\n", 1);
+
+    output_flush(&out);
+    close_redirections(fds);
+
+}
+
+/**
+ * @brief Concatenates files, or stdin, to stdout.
+ *
+ * The data is copied within the kernel (see copy_fd()), so e.g. cat a > b never passes through
+ * the shell, and may share the blocks of the file. Should options be given the cat process is
+ * executed instead.
+ *
+ * Supports i/o redirection.
+ *
+ * @param command built-in function being executed
+ */
+void do_cat(Command* command, char** env UNUSED)
+{
+    static char* standard_input[] = { "-", NULL };
+    int fds[3] = { -1, -1, -1 };
+    struct stat output;
+
+    for (char** temp = command->args+1; *temp != NULL; temp++) {
+        if ((*temp)[0] == '-' && (*temp)[1] != '\0') {
+            builtin_external(command);
+            return;
+        }
+    }
+
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+    int out = builtin_stdout(command, fds);
+    fflush(stdout);
+    if (fstat(out, &output) == -1) {
+        output.st_mode = 0;
+    }
+
+    char** files = (command->args[1] != NULL) ? command->args+1 : standard_input;
+    for (char** temp = files; *temp != NULL; temp++) {
+        struct stat info;
+        int in = builtin_stdin(command, fds);
+
+        if (strcmp(*temp, "-") != 0 && (in = open(*temp, O_RDONLY|O_CLOEXEC)) == -1) {
+            fprintf(stderr, "error - cat: %s: %s\n", *temp, strerror(errno));
+            continue;
+        }
+
+        /* copying a file onto itself would never end */
+        if (S_ISREG(output.st_mode) && fstat(in, &info) == 0 && info.st_dev == output.st_dev
+                && info.st_ino == output.st_ino && info.st_size > 0) {
+            fprintf(stderr, "error - cat: %s: input file is output file\n", *temp);
+        } else if (copy_fd(in, out) == -1) {
+            fprintf(stderr, "error - cat: %s: %s\n", *temp, strerror(errno));
+        }
+
+        if (in != builtin_stdin(command, fds)) {
+            close(in);
+        }
+    }
+
+    close_redirections(fds);
+}
+
+/**
+ * @brief Copies stdin to stdout and to every file given.
+ *
+ * With -a the files are appended to rather than replaced. Should other options be given the tee
+ * process is executed instead.
+ *
  * Supports i/o redirection.
+ *
+ * @param command built-in function being executed
  */
-void do_echo() {
+void do_tee(Command* command, char** env UNUSED)
+{
+    char** names = command->args+1;
+    int flags = O_TRUNC;
+    int fds[3] = { -1, -1, -1 };
 
-    redirect_filedescriptors();
+    if (*names != NULL && strcmp(*names, "-a") == 0) {
+        flags = O_APPEND;
+        names++;
+    }
+    for (char** temp = names; *temp != NULL; temp++) {
+        if ((*temp)[0] == '-' && (*temp)[1] != '\0') {
+            builtin_external(command);
+            return;
+        }
+    }
 
-    for (char** temp = cmd.args+1; *temp != NULL; temp++) {
-        printf("%s ", *temp);
+    int* files = arena_alloc(&line_arena, (size_t)command->argc * sizeof(int));
+    if (files == NULL || open_redirections(command, fds) == -1) {
+        return;
+    }
+    int count = 0;
+    for (char** temp = names; *temp != NULL; temp++) {
+        files[count] = open(*temp, O_WRONLY|O_CREAT|O_CLOEXEC|flags, 0666);
+        if (files[count] == -1) {
+            fprintf(stderr, "error - tee: %s: %s\n", *temp, strerror(errno));
+        } else {
+            count++;
+        }
     }
-    printf("\n");
 
-    restore_filedescriptors();
+    fflush(stdout);
+    if (copy_tee(builtin_stdin(command, fds), builtin_stdout(command, fds), files, count) == -1) {
+        fprintf(stderr, "error - tee: %s\n", strerror(errno));
+    }
 
+    for (int i = 0; i < count; i++) {
+        close(files[i]);
+    }
+    close_redirections(fds);
 }
 
 /**
  * @brief Terminates the execution of the shell after cleaning up.
  */
-__attribute__ ((noreturn)) void quit() {
+__attribute__ ((noreturn)) void quit(Command* command UNUSED, char** env UNUSED) {
+    int status = parallel_finish();
     cleanup();
-    exit(EXIT_SUCCESS);
+    exit(status);
 }
 
 /**
  * @brief Changes the current working directory if a target directory was provided, else
  * prints the full path of the current working directory.
+ *
+ * @param command built-in function being executed
  */
-void do_cd() {
-    char *path;
+void do_cd(Command* command, char** env UNUSED) {
+    const char *path;
 
     char cwd[MAX_BUFFER];
 
@@ -110,7 +589,7 @@ void do_cd() {
     memset(cwd, 0, sizeof(cwd));
 
     // display the current directory
-    if (cmd.args[1] == NULL) {
+    if (command->args[1] == NULL) {
         // get current working directory
         if(getcwd(cwd, sizeof(cwd)) == NULL) {
             perror("directory name too long\n");
@@ -120,22 +599,22 @@ void do_cd() {
     }
 
     // establish the exact path to change to based on input given
-    if (strncmp(cmd.args[1], "~", 1) == 0) {
+    if (strncmp(command->args[1], "~", 1) == 0) {
         // special case: home directory
         char temp_path[MAX_BUFFER];
         // replace ~ with user's home
-        sprintf(temp_path, "%s", getenv("HOME"));
+        sprintf(temp_path, "%s", var_get("HOME") ? var_get("HOME") : "");
         // add on the rest of the provided path - if any
-        if (strlen(cmd.args[1]) > 1) {
-            sprintf(temp_path, "%s%s", temp_path, cmd.args[1]+1);
+        if (strlen(command->args[1]) > 1) {
+            sprintf(temp_path, "%s%s", temp_path, command->args[1]+1);
         }
         path = temp_path;
-    } else if (strcmp(cmd.args[1], "-") == 0) {
+    } else if (strcmp(command->args[1], "-") == 0) {
         // special case: previous directory
-        path = getenv("OLDPWD");
+        path = var_get("OLDPWD") ? var_get("OLDPWD") : "";
     } else {
         // normal case: use given directory
-        path = cmd.args[1];
+        path = command->args[1];
     }
 
     // change to desired directory
@@ -152,11 +631,11 @@ void do_cd() {
 
     // update environment variables: PWD, OLDPWD
     #ifdef DEBUG
-    printf("debug: setting OLDPWD=%s\n", getenv("PWD"));
+    printf("debug: setting OLDPWD=%s\n", var_get("PWD"));
     printf("debug: setting PWD=%s\n", cwd);
     #endif
-    setenv("OLDPWD", getenv("PWD"), 1);
-    setenv("PWD", cwd, 1); // cwd is used to process .. and . properly
+    var_set("OLDPWD", var_get("PWD") ? var_get("PWD") : "", VAR_EXPORT);
+    var_set("PWD", cwd, VAR_EXPORT); // cwd is used to process .. and . properly
 }
 
 /**
@@ -164,7 +643,7 @@ void do_cd() {
  *
  * reference: http://man7.org/tlpi/code/online/dist/tty/no_echo.c.html
  */
-void do_pause(void) {
+void do_pause(Command* command UNUSED, char** env UNUSED) {
     /* display information message */
     printf("The shell has been paused. Press 'Enter' to continue.\n");
 
@@ -204,13 +683,14 @@ void do_pause(void) {
  * @brief Displays the man file to the user, via man, with less.
  *
  * Supports i/o redirection.
+ *
+ * @param command built-in function being executed
  */
-void do_help(void) {
+void do_help(Command* command, char** env UNUSED) {
     /* display the man page using man with the more filter */
     char temp[MAX_BUFFER];
-    cmd.args[0] = "man";
-    cmd.args[1] = "-P";
-    cmd.args[2] = "less";
+    char* args[] = { "man", "-P", "less", temp, NULL };
+    Command man = *command;
     strncpy(temp, getenv("SHELL"), MAX_BUFFER);
     /* remove "seashell" from end */
     temp[strlen(getenv("SHELL"))-strlen("seashell")] = '\0';
@@ -220,8 +700,174 @@ void do_help(void) {
         perror("error - unable to find man file");
         return;
     }
-    //TODO: improve this
-    cmd.args[3] = temp;
-    cmd.args[4] = NULL;
-    do_execute();
+    man.args = args;
+    man.argc = 4;
+    do_execute(&man);
+}
+
+/**
+ * @brief Exports shell variables to the environment of programs launched by the shell.
+ *
+ * Each argument is either NAME, exporting an existing variable, or NAME=value, setting and
+ * exporting it. With no arguments every exported variable is listed.
+ *
+ * Supports i/o redirection.
+ *
+ * @param command built-in function being executed
+ */
+void do_export(Command* command, char** env UNUSED) {
+    if (command->args[1] == NULL) {
+        int fds[3] = { -1, -1, -1 };
+        Output out;
+
+        if (open_redirections(command, fds) == -1) {
+            return;
+        }
+        output_init(&out, builtin_stdout(command, fds));
+        for (char** temp = var_environment(); *temp != NULL; temp++) {
+            output_string(&out, "export ");
+            output_string(&out, *temp);
+            output_write(&out, "\n", 1);
+        }
+        output_flush(&out);
+        close_redirections(fds);
+        return;
+    }
+
+    for (char** temp = command->args+1; *temp != NULL; temp++) {
+        char* equals = strchr(*temp, '=');
+        if (equals != NULL) {
+            *equals = '\0';
+            var_set(*temp, equals + 1, VAR_EXPORT);
+            *equals = '=';
+        } else if (var_get(*temp) != NULL) {
+            var_set(*temp, var_get(*temp), VAR_EXPORT);
+        } else if (var_name_length(*temp) != strlen(*temp)) {
+            fprintf(stderr, "error - invalid variable name %s\n", *temp);
+        }
+    }
+}
+
+/**
+ * @brief Removes shell variables, and with them their place in the environment.
+ *
+ * @param command built-in function being executed
+ */
+void do_unset(Command* command, char** env UNUSED) {
+    for (char** temp = command->args+1; *temp != NULL; temp++) {
+        var_unset(*temp);
+    }
+}
+
+/**
+ * @brief Manages the table of remembered command locations.
+ *
+ * With no arguments the table is listed, -r empties it, and any other arguments are looked up
+ * in PATH and added to the table ahead of their first use.
+ *
+ * Supports i/o redirection.
+ *
+ * @param command built-in function being executed
+ */
+void do_hash(Command* command, char** env UNUSED) {
+    int saved[3];
+
+    if (redirect_filedescriptors(command, saved) == -1) {
+        return;
+    }
+
+    if (command->args[1] == NULL) {
+        path_print();
+    } else if (strcmp(command->args[1], "-r") == 0) {
+        path_clear();
+    } else {
+        for (char** temp = command->args+1; *temp != NULL; temp++) {
+            if (strchr(*temp, '/') != NULL) {
+                continue;
+            }
+            if (path_lookup(*temp) == NULL) {
+                fprintf(stderr, "hash: %s: not found\n", *temp);
+            }
+        }
+    }
+
+    restore_filedescriptors(saved);
+
+}
+
+/**
+ * @brief Waits for background jobs to finish.
+ *
+ * With no arguments waits for every job; in parallel mode this acts as a barrier, commands after
+ * it only start once every command before it has completed. Otherwise waits for each job given,
+ * either as %n for job number n or as a process id.
+ *
+ * @param command built-in function being executed
+ */
+void do_wait(Command* command, char** env UNUSED) {
+    if (command->args[1] == NULL) {
+        if (parallel_jobs > 0) {
+            parallel_wait();
+        }
+        jobs_wait_all();
+        return;
+    }
+
+    for (char** temp = command->args+1; *temp != NULL; temp++) {
+        Job* job = jobs_find(*temp);
+        if (job == NULL) {
+            fprintf(stderr, "error - wait: no such job %s\n", *temp);
+            continue;
+        }
+        jobs_wait(job);
+    }
+}
+
+/**
+ * @brief Lists the background jobs with their state. Jobs which have finished are removed once
+ * listed.
+ *
+ * Supports i/o redirection and pipelines.
+ *
+ * @param command built-in function being executed
+ */
+void do_jobs(Command* command, char** env UNUSED) {
+    int fds[3] = { -1, -1, -1 };
+    Output out;
+
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+    output_init(&out, builtin_stdout(command, fds));
+
+    jobs_print(&out, 0);
+
+    output_flush(&out);
+    close_redirections(fds);
+}
+
+/**
+ * @brief Evaluates the rest of the line, then prints the time it took to stderr.
+ *
+ * Reports the elapsed (real) time, the user and system CPU time of the shell and every child
+ * process reaped, and the largest resident set size of those children. In parallel mode the
+ * command is waited for, rather than left running.
+ *
+ * @param command first command of the pipeline, beginning with time
+ * @param env list environment variables provided to program
+ */
+void do_time(Command* command, char** env) {
+    Pipeline rest;
+    Timing timing;
+    int jobs = parallel_jobs;
+
+    metrics_time_begin(&timing);
+
+    if (prefix_pipeline(command, 1, &rest) == 0) {
+        parallel_jobs = 0;
+        evaluate_args(&rest, env);
+        parallel_jobs = jobs;
+    }
+
+    metrics_time_end(&timing);
 }
@@ -0,0 +1,550 @@
+/**
+ * @file compile.c
+ * @brief Compiled batch files, holding every line already parsed.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * A compiled batch file starts with a CompiledHeader, followed by a record for every line which
+ * is not blank, followed by the strings the records refer to. A record is a sequence of 32 bit
+ * words: the number of commands in the pipeline, then for every command its flags (COMPILED_*),
+ * number of arguments, the files its stdin, stdout and stderr are redirected to, and its
+ * arguments, each file and argument as the offset of a string. A line which could not be parsed
+ * is recorded as zero commands followed by the offset of its text, so the error is reported when
+ * the line is reached, just as when running the original file. A line referring to variables, or
+ * holding patterns matching file names, is recorded the same way, as its text, since it can only
+ * be expanded once it is reached. A line with here-documents is recorded as its text followed by
+ * the lines of their bodies.
+ *
+ * The compiled file is mapped and each pipeline built directly from its record, nothing is
+ * tokenized.
+ */
+#include "seashell.h"
+
+/**
+ * @brief Compiles a batch file.
+ *
+ * @param source batch file to compile
+ * @param destination file to create, the batch file with .ssc appended if NULL
+ *
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the batch file could not be compiled
+ */
+int compile_file(const char* source, const char* destination)
+{
+    char path[PATH_MAX];
+    CompiledHeader header;
+    CompiledWriter writer;
+    Input reader;
+    struct stat info;
+    char* line;
+
+    if (destination == NULL) {
+        snprintf(path, sizeof(path), "%s%s", source, COMPILED_EXTENSION);
+        destination = path;
+    }
+
+    int fd = open(source, O_RDONLY|O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &info) == -1 || input_open(&reader, fd) == -1) {
+        perror("error - cannot open batch file");
+        if (fd != -1) {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+
+    int output = open(destination, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+    if (output == -1) {
+        perror("error - cannot create compiled batch file");
+        input_close(&reader);
+        return EXIT_FAILURE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+    header.builtins = builtin_fingerprint();
+    header.source_mtime = (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    header.source_size = (uint64_t)info.st_size;
+    header.source_hash = 14695981039346656037ULL;
+
+    /* records are written as they are produced, the header is rewritten once they are complete */
+    memset(&writer, 0, sizeof(writer));
+    output_init(&writer.out, output);
+    output_write(&writer.out, (const char*)&header, sizeof(header));
+
+    while ((line = input_line(&reader)) != NULL && !writer.failed) {
+        compile_hash(&header.source_hash, line, reader.length);
+
+        /* the parser terminates tokens in place, keep the text for a line it rejects */
+        arena_reset(&line_arena);
+        size_t size = reader.length + 1;
+        char* text = arena_alloc(&line_arena, size);
+        if (text == NULL) {
+            writer.failed = 1;
+            break;
+        }
+        memcpy(text, line, size);
+
+        Pipeline* pipeline = NULL;
+        if (strstr(line, "<<") != NULL) {
+            /* the bodies of here-documents follow the line, and are kept with it as its text */
+            if ((text = compile_here(&reader, &header, text, &size)) == NULL) {
+                writer.failed = 1;
+                break;
+            }
+        } else if (strpbrk(line, "$*?[") == NULL) {
+            /* variables and patterns are expanded when the line is run, not now */
+            pipeline = process_input(&line_arena, line);
+        }
+        if (pipeline == NULL || pipeline->length > 0) {
+            compile_line(&writer, pipeline, text);
+            header.lines++;
+        }
+    }
+    arena_reset(&line_arena);
+
+    int error = reader.error;
+    input_close(&reader);
+
+    header.strings = sizeof(header) + writer.words * sizeof(uint32_t);
+    header.length = header.strings + writer.length;
+    output_write(&writer.out, writer.strings, writer.length);
+    output_flush(&writer.out);
+    free(writer.strings);
+
+    if (error != 0 || writer.failed || writer.out.failed
+            || pwrite(output, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        errno = (error != 0) ? error : errno;
+        perror("error - cannot write compiled batch file");
+        close(output);
+        unlink(destination);
+        return EXIT_FAILURE;
+    }
+
+    close(output);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Appends the bodies of a line's here-documents, up to and including their delimiters,
+ * to the text of the line.
+ *
+ * @param reader batch file being compiled, positioned after the line
+ * @param header header of the compiled file, whose hash covers every line read
+ * @param text text of the line, allocated from the arena
+ * @param size size of the text, including its terminator; updated
+ *
+ * @return the text, the lines joined by newlines, or NULL if out of memory
+ */
+char* compile_here(Input* reader, CompiledHeader* header, char* text, size_t* size)
+{
+    /* parse a copy, only to learn the delimiters */
+    char* copy = arena_alloc(&line_arena, *size);
+    if (copy == NULL) {
+        return NULL;
+    }
+    Pipeline* pipeline = process_input(&line_arena, memcpy(copy, text, *size));
+    if (pipeline == NULL) {
+        return text;
+    }
+
+    for (Command* command = pipeline->first; command != NULL; command = command->next) {
+        if (command->here_delimiter == NULL) {
+            continue;
+        }
+        char* line;
+        while ((line = input_line(reader)) != NULL) {
+            compile_hash(&header->source_hash, line, reader->length);
+
+            text = arena_grow(&line_arena, text, *size, *size + reader->length + 1);
+            if (text == NULL) {
+                return NULL;
+            }
+            text[*size - 1] = '\n';
+            memcpy(text + *size, line, reader->length + 1);
+            *size += reader->length + 1;
+
+            if (strcmp(line, command->here_delimiter) == 0) {
+                break;
+            }
+        }
+    }
+    return text;
+}
+
+/**
+ * @brief Adds a line, and its newline, to the hash of a batch file (FNV-1a).
+ *
+ * @param hash hash to update
+ * @param line the line, without its newline
+ * @param length length of the line
+ */
+void compile_hash(uint64_t* hash, const char* line, size_t length)
+{
+    for (size_t i = 0; i <= length; i++) {
+        *hash ^= (i < length) ? (unsigned char)line[i] : '\n';
+        *hash *= 1099511628211ULL;
+    }
+}
+
+/**
+ * @brief Writes the record of a line.
+ *
+ * @param writer compiled file being written
+ * @param pipeline the parsed line, or NULL if it was rejected
+ * @param text text of the line
+ */
+void compile_line(CompiledWriter* writer, Pipeline* pipeline, const char* text)
+{
+    if (pipeline == NULL) {
+        compile_word(writer, 0);
+        compile_word(writer, compile_string(writer, text));
+        return;
+    }
+
+    compile_word(writer, (uint32_t)pipeline->length);
+    for (Command* command = pipeline->first; command != NULL; command = command->next) {
+        uint32_t flags = 0;
+        if (command->args[0] != NULL && builtin_lookup(command->args[0]) != NULL) {
+            flags |= COMPILED_BUILTIN;
+        }
+        if (command->is_background) {
+            flags |= COMPILED_BACKGROUND;
+        }
+        if (command->is_stdout_append) {
+            flags |= COMPILED_STDOUT_APPEND;
+        }
+        if (command->is_stderr_append) {
+            flags |= COMPILED_STDERR_APPEND;
+        }
+        compile_word(writer, flags);
+        compile_word(writer, (uint32_t)command->argc);
+
+        uint32_t out = compile_string(writer, command->file_stdout);
+        compile_word(writer, compile_string(writer, command->file_stdin));
+        compile_word(writer, out);
+        /* a single file for both streams (&>) must remain a single string */
+        if (command->file_stderr != NULL && command->file_stderr == command->file_stdout) {
+            compile_word(writer, out);
+        } else {
+            compile_word(writer, compile_string(writer, command->file_stderr));
+        }
+
+        for (int i = 0; i < command->argc; i++) {
+            compile_word(writer, compile_string(writer, command->args[i]));
+        }
+    }
+}
+
+/**
+ * @brief Appends a word to the records.
+ *
+ * @param writer compiled file being written
+ * @param word word to append
+ */
+void compile_word(CompiledWriter* writer, uint32_t word)
+{
+    output_write(&writer->out, (const char*)&word, sizeof(word));
+    writer->words++;
+}
+
+/**
+ * @brief Adds a string to the strings of a compiled file.
+ *
+ * @param writer compiled file being written
+ * @param string string to add, may be NULL
+ *
+ * @return offset of the string, COMPILED_NONE for NULL
+ */
+uint32_t compile_string(CompiledWriter* writer, const char* string)
+{
+    if (string == NULL) {
+        return COMPILED_NONE;
+    }
+
+    size_t length = strlen(string) + 1;
+    if (writer->length + length >= COMPILED_NONE) {
+        fprintf(stderr, "error - batch file is too large to compile\n");
+        writer->failed = 1;
+        return COMPILED_NONE;
+    }
+    if (writer->length + length > writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : INPUT_BUFFER;
+        while (capacity < writer->length + length) {
+            capacity *= 2;
+        }
+        char* grown = realloc(writer->strings, capacity);
+        if (grown == NULL) {
+            writer->failed = 1;
+            return COMPILED_NONE;
+        }
+        writer->strings = grown;
+        writer->capacity = capacity;
+    }
+
+    uint32_t offset = (uint32_t)writer->length;
+    memcpy(writer->strings + writer->length, string, length);
+    writer->length += length;
+    return offset;
+}
+
+/**
+ * @brief Uses a compiled batch file in place of a batch file, if possible.
+ *
+ * The file is used if it is itself compiled, or if a compiled copy of it (with .ssc appended) was
+ * made from its current contents, as determined by the size and modification time recorded.
+ *
+ * @param program compiled file to load
+ * @param fd descriptor of the batch file, closed if a compiled file is loaded
+ * @param path location of the batch file
+ *
+ * @return 1 if a compiled file was loaded, 0 if the batch file should be read, -1 on error
+ */
+int compile_open(Compiled* program, int fd, const char* path)
+{
+    char cached[PATH_MAX];
+    CompiledHeader header;
+    struct stat info;
+
+    memset(program, 0, sizeof(Compiled));
+
+    /* a compiled file given directly */
+    if (pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+            && memcmp(header.magic, COMPILED_MAGIC, sizeof(header.magic)) == 0) {
+        if (compile_map(program, fd, &header) == -1) {
+            return -1;
+        }
+        close(fd);
+        return 1;
+    }
+
+    /* an up to date compiled copy */
+    snprintf(cached, sizeof(cached), "%s%s", path, COMPILED_EXTENSION);
+    int copy = open(cached, O_RDONLY|O_CLOEXEC);
+    if (copy == -1) {
+        return 0;
+    }
+    int fresh = fstat(fd, &info) == 0
+        && pread(copy, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+        && memcmp(header.magic, COMPILED_MAGIC, sizeof(header.magic)) == 0
+        && header.builtins == builtin_fingerprint()
+        && header.source_size == (uint64_t)info.st_size
+        && header.source_mtime == (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    if (!fresh || compile_map(program, copy, &header) == -1) {
+        #ifdef DEBUG
+        printf("debug: %s is out of date\n", cached);
+        #endif
+        close(copy);
+        return 0;
+    }
+
+    #ifdef DEBUG
+    printf("debug: running %s\n", cached);
+    #endif
+    close(copy);
+    close(fd);
+    return 1;
+}
+
+/**
+ * @brief Maps a compiled batch file, after checking its header.
+ *
+ * @param program compiled file to load
+ * @param fd descriptor of the compiled file
+ * @param header header read from the compiled file
+ *
+ * @return 0 on success, -1 if the file is not usable
+ */
+int compile_map(Compiled* program, int fd, const CompiledHeader* header)
+{
+    struct stat info;
+
+    if (header->builtins != builtin_fingerprint()) {
+        fprintf(stderr, "error - batch file was compiled by a different version of seashell\n");
+        return -1;
+    }
+    if (fstat(fd, &info) == -1 || (uint64_t)info.st_size != header->length
+            || header->strings < sizeof(CompiledHeader) || header->strings > header->length
+            || (header->strings - sizeof(CompiledHeader)) % sizeof(uint32_t) != 0) {
+        fprintf(stderr, "error - compiled batch file is damaged\n");
+        return -1;
+    }
+
+    /* private and writable, as commands may alter their arguments */
+    char* map = mmap(NULL, header->length, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("error - cannot read compiled batch file");
+        return -1;
+    }
+    madvise(map, header->length, MADV_SEQUENTIAL);
+
+    program->map = map;
+    program->size = header->length;
+    program->records = (uint32_t*)(map + sizeof(CompiledHeader));
+    program->words = (header->strings - sizeof(CompiledHeader)) / sizeof(uint32_t);
+    program->strings = map + header->strings;
+    program->strings_size = header->length - header->strings;
+
+    /* every string must be terminated within the file */
+    if (program->strings_size > 0 && program->strings[program->strings_size - 1] != '\0') {
+        fprintf(stderr, "error - compiled batch file is damaged\n");
+        compile_close(program);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds the pipeline of the next line of a compiled batch file.
+ *
+ * @param program compiled file
+ * @param arena arena to allocate the pipeline from, reset before each line
+ * @param pipeline destination for the pipeline, NULL if the line was rejected
+ *
+ * @return 0 on success, -1 at the end of the file
+ */
+int compile_next(Compiled* program, Arena* arena, Pipeline** pipeline)
+{
+    uint32_t word;
+
+    *pipeline = NULL;
+    if (compile_read(program, &word) == -1) {
+        return -1;
+    }
+
+    /* a line which could not be parsed, parse it again to report the error */
+    if (word == 0) {
+        if (compile_read(program, &word) == -1) {
+            return compile_damaged(program);
+        }
+        const char* text = compile_text(program, word);
+        if (text != NULL) {
+            size_t length = strlen(text) + 1;
+            char* line = arena_alloc(arena, length);
+            if (line != NULL) {
+                memcpy(line, text, length);
+                /* the bodies of here-documents follow the line itself */
+                char* rest = strchr(line, '\n');
+                if (rest != NULL) {
+                    *rest++ = '\0';
+                }
+                *pipeline = process_input(arena, line);
+                if (*pipeline != NULL && here_read(arena, *pipeline, NULL, rest) == -1) {
+                    *pipeline = NULL;
+                }
+            }
+        }
+        return 0;
+    }
+
+    Pipeline* built = arena_alloc(arena, sizeof(Pipeline));
+    if (built == NULL) {
+        return compile_damaged(program);
+    }
+    built->first = NULL;
+    built->length = (int)word;
+
+    Command** link = &built->first;
+    for (uint32_t i = 0; i < word; i++) {
+        uint32_t fields[5];
+        for (int j = 0; j < 5; j++) {
+            if (compile_read(program, &fields[j]) == -1) {
+                return compile_damaged(program);
+            }
+        }
+
+        Command* command = new_command(arena);
+        if (command == NULL || fields[1] > program->words) {
+            return compile_damaged(program);
+        }
+        command->is_external = !(fields[0] & COMPILED_BUILTIN);
+        command->is_background = (fields[0] & COMPILED_BACKGROUND) != 0;
+        command->is_stdout_append = (fields[0] & COMPILED_STDOUT_APPEND) != 0;
+        command->is_stderr_append = (fields[0] & COMPILED_STDERR_APPEND) != 0;
+        command->file_stdin = compile_text(program, fields[2]);
+        command->file_stdout = compile_text(program, fields[3]);
+        command->file_stderr = compile_text(program, fields[4]);
+
+        command->argc = (int)fields[1];
+        command->capacity = command->argc + 1;
+        command->args = arena_alloc(arena, (size_t)command->capacity * sizeof(char*));
+        if (command->args == NULL) {
+            return compile_damaged(program);
+        }
+        for (int j = 0; j < command->argc; j++) {
+            uint32_t offset;
+            if (compile_read(program, &offset) == -1) {
+                return compile_damaged(program);
+            }
+            if ((command->args[j] = compile_text(program, offset)) == NULL) {
+                return compile_damaged(program);
+            }
+        }
+        command->args[command->argc] = NULL;
+
+        *link = command;
+        link = &command->next;
+    }
+
+    *pipeline = built;
+    return 0;
+}
+
+/**
+ * @brief Reads the next word of the records.
+ *
+ * @param program compiled file
+ * @param word destination for the word
+ *
+ * @return 0 on success, -1 at the end of the records
+ */
+int compile_read(Compiled* program, uint32_t* word)
+{
+    if (program->position >= program->words) {
+        return -1;
+    }
+    *word = program->records[program->position++];
+    return 0;
+}
+
+/**
+ * @brief Reports a compiled file whose records are incomplete, and ends it.
+ *
+ * @param program compiled file
+ *
+ * @return -1
+ */
+int compile_damaged(Compiled* program)
+{
+    fprintf(stderr, "error - compiled batch file is damaged\n");
+    program->position = program->words;
+    return -1;
+}
+
+/**
+ * @brief Locates a string of a compiled file.
+ *
+ * @param program compiled file
+ * @param offset offset of the string
+ *
+ * @return the string, or NULL for COMPILED_NONE or an offset outside the file
+ */
+char* compile_text(Compiled* program, uint32_t offset)
+{
+    if (offset == COMPILED_NONE || offset >= program->strings_size) {
+        return NULL;
+    }
+    return program->strings + offset;
+}
+
+/**
+ * @brief Unmaps a compiled batch file.
+ *
+ * @param program compiled file
+ */
+void compile_close(Compiled* program)
+{
+    if (program->map != NULL) {
+        munmap(program->map, program->size);
+    }
+    memset(program, 0, sizeof(Compiled));
+}
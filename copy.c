@@ -0,0 +1,287 @@
+/**
+ * @file copy.c
+ * @brief Moving data between descriptors within the kernel, for the cat and tee built-ins.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * A copy is attempted with the cheapest method the two descriptors allow, falling back to the
+ * next one should the kernel or file system refuse it before anything has been copied:
+ * copy_file_range between regular files (which may share the blocks, e.g. a reflink), splice
+ * out of a pipe, sendfile from a regular file to anything but a pipe, and finally read and write.
+ *
+ * A regular file is read into a pipe through a buffer: splicing the page cache into a pipe was
+ * measured to be slower than a plain copy, as the reader then pays for every page reference.
+ */
+#include "seashell.h"
+
+/**
+ * @brief Copies everything remaining of one descriptor to another.
+ *
+ * Both descriptors are used from, and advanced past, their current offsets.
+ *
+ * @param in descriptor to read from
+ * @param out descriptor to write to
+ *
+ * @return 0 on success, -1 on failure (with errno set)
+ */
+int copy_fd(int in, int out)
+{
+    struct stat from;
+    struct stat to;
+    int status = COPY_UNSUPPORTED;
+
+    if (fstat(in, &from) == -1 || fstat(out, &to) == -1) {
+        return -1;
+    }
+
+    if (S_ISREG(from.st_mode) && S_ISREG(to.st_mode)) {
+        status = copy_range(in, out);
+    }
+    if (status == COPY_UNSUPPORTED && S_ISFIFO(from.st_mode)) {
+        status = copy_splice(in, out);
+    }
+    if (status == COPY_UNSUPPORTED && S_ISREG(from.st_mode) && !S_ISFIFO(to.st_mode)) {
+        status = copy_sendfile(in, out);
+    }
+    if (status == COPY_UNSUPPORTED) {
+        status = copy_buffered(in, out);
+    }
+    return status;
+}
+
+/**
+ * @brief Copies between regular files with copy_file_range.
+ *
+ * @param in descriptor to read from
+ * @param out descriptor to write to
+ *
+ * @return 0 on success, -1 on failure, COPY_UNSUPPORTED if nothing could be copied this way
+ */
+int copy_range(int in, int out)
+{
+    int copied = 0;
+
+    while (1) {
+        ssize_t count = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+        if (count == 0) {
+            return 0;
+        }
+        if (count > 0) {
+            copied = 1;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        /* e.g. across file systems on older kernels, or out opened for appending */
+        if (!copied && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EBADF
+                    || errno == EOPNOTSUPP)) {
+            return COPY_UNSUPPORTED;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Copies out of a pipe with splice.
+ *
+ * @param in descriptor to read from
+ * @param out descriptor to write to
+ *
+ * @return 0 on success, -1 on failure, COPY_UNSUPPORTED if nothing could be copied this way
+ */
+int copy_splice(int in, int out)
+{
+    int copied = 0;
+
+    while (1) {
+        ssize_t count = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE|SPLICE_F_MORE);
+        if (count == 0) {
+            return 0;
+        }
+        if (count > 0) {
+            copied = 1;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        /* e.g. a file opened for appending, or a terminal */
+        if (!copied && (errno == EINVAL || errno == ENOSYS || errno == EBADF)) {
+            return COPY_UNSUPPORTED;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Copies from a regular file with sendfile.
+ *
+ * @param in descriptor to read from, a regular file
+ * @param out descriptor to write to
+ *
+ * @return 0 on success, -1 on failure, COPY_UNSUPPORTED if nothing could be copied this way
+ */
+int copy_sendfile(int in, int out)
+{
+    int copied = 0;
+
+    while (1) {
+        ssize_t count = sendfile(out, in, NULL, COPY_CHUNK);
+        if (count == 0) {
+            return 0;
+        }
+        if (count > 0) {
+            copied = 1;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!copied && (errno == EINVAL || errno == ENOSYS)) {
+            return COPY_UNSUPPORTED;
+        }
+        return -1;
+    }
+}
+
+/**
+ * @brief Copies through a buffer with read and write, which any descriptors allow.
+ *
+ * @param in descriptor to read from
+ * @param out descriptor to write to
+ *
+ * @return 0 on success, -1 on failure
+ */
+int copy_buffered(int in, int out)
+{
+    char* buffer = malloc(COPY_BUFFER);
+    int status = 0;
+
+    if (buffer == NULL) {
+        return -1;
+    }
+    while (1) {
+        ssize_t count = read(in, buffer, COPY_BUFFER);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            status = (int)count;
+            break;
+        }
+        if (copy_write(out, buffer, (size_t)count) == -1) {
+            status = -1;
+            break;
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+/**
+ * @brief Writes the whole of a buffer.
+ *
+ * @param fd descriptor to write to
+ * @param buffer data to write
+ * @param length length of the data
+ *
+ * @return 0 on success, -1 on failure
+ */
+int copy_write(int fd, const char* buffer, size_t length)
+{
+    while (length > 0) {
+        ssize_t count = write(fd, buffer, length);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += count;
+        length -= (size_t)count;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies one descriptor to another and to every file given, as tee does.
+ *
+ * When reading from a pipe into a pipe with a single file, the data is duplicated into the output
+ * pipe with tee and then moved to the file with splice, never passing through the shell.
+ * Otherwise it is read into a buffer and written to each in turn.
+ *
+ * @param in descriptor to read from
+ * @param out descriptor to write to
+ * @param files further descriptors to write to
+ * @param count number of further descriptors
+ *
+ * @return 0 on success, -1 on failure (with errno set)
+ */
+int copy_tee(int in, int out, const int* files, int count)
+{
+    struct stat from;
+    struct stat to;
+
+    if (count == 0) {
+        return copy_fd(in, out);
+    }
+
+    /* splice refuses files opened for appending, tested up front as tee has no way back */
+    if (count == 1 && fstat(in, &from) == 0 && fstat(out, &to) == 0
+            && S_ISFIFO(from.st_mode) && S_ISFIFO(to.st_mode)
+            && !(fcntl(files[0], F_GETFL) & O_APPEND)) {
+        int copied = 0;
+        while (1) {
+            ssize_t length = tee(in, out, COPY_CHUNK, 0);
+            if (length == 0) {
+                return 0;
+            }
+            if (length == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (copied || errno != EINVAL) {
+                    return -1;
+                }
+                break;
+            }
+            /* consume from the input exactly what was duplicated */
+            while (length > 0) {
+                ssize_t moved = splice(in, NULL, files[0], NULL, (size_t)length, SPLICE_F_MOVE);
+                if (moved == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (moved <= 0) {
+                    return -1;
+                }
+                length -= moved;
+            }
+            copied = 1;
+        }
+    }
+
+    char* buffer = malloc(COPY_BUFFER);
+    int status = 0;
+
+    if (buffer == NULL) {
+        return -1;
+    }
+    while (status == 0) {
+        ssize_t length = read(in, buffer, COPY_BUFFER);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            status = (int)length;
+            break;
+        }
+        status = copy_write(out, buffer, (size_t)length);
+        for (int i = 0; i < count && status == 0; i++) {
+            status = copy_write(files[i], buffer, (size_t)length);
+        }
+    }
+    free(buffer);
+    return status;
+}
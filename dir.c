@@ -0,0 +1,482 @@
+/**
+ * @file dir.c
+ * @brief Directory listings in the format of ls -al, produced without launching ls.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/* names of recently seen owners and groups */
+static DirName dir_users[DIR_NAME_CACHE];
+static DirName dir_groups[DIR_NAME_CACHE];
+
+/**
+ * @brief Lists each path given in the format of ls -al.
+ *
+ * Files are listed first, then the contents of each directory, as ls does. Symbolic links given
+ * as arguments are not followed.
+ *
+ * @param out writer to produce the listing with
+ * @param paths NULL terminated list of paths, or an empty list for the current directory
+ */
+void dir_list(Output* out, char** paths)
+{
+    static char* current[] = { ".", NULL };
+    DirWidths widths;
+    int count = 0;
+    int files = 0;
+    int listed = 0;
+
+    if (paths[0] == NULL) {
+        paths = current;
+    }
+    while (paths[count] != NULL) {
+        count++;
+    }
+
+    DirEntry* entries = arena_alloc(&line_arena, (size_t)count * sizeof(DirEntry));
+    DirEntry* others = arena_alloc(&line_arena, (size_t)count * sizeof(DirEntry));
+    if (entries == NULL || others == NULL) {
+        return;
+    }
+
+    /* examine every argument, the names are kept as given */
+    for (int i = 0; i < count; i++) {
+        entries[i].name = paths[i];
+        dir_stat(AT_FDCWD, &entries[i]);
+        if (entries[i].error != 0) {
+            fprintf(stderr, "error - dir: cannot access %s: %s\n", paths[i], strerror(entries[i].error));
+        } else if (!S_ISDIR(entries[i].mode)) {
+            others[files++] = entries[i];
+        }
+    }
+
+    /* the columns are aligned with those of the directories as well, as ls does */
+    dir_widths(entries, count, &widths);
+    qsort(others, (size_t)files, sizeof(DirEntry), dir_compare);
+    dir_print(out, AT_FDCWD, others, files, &widths);
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].error != 0 || !S_ISDIR(entries[i].mode)) {
+            continue;
+        }
+        if (files > 0 || listed > 0) {
+            output_write(out, "\n", 1);
+        }
+        if (count > 1) {
+            output_string(out, paths[i]);
+            output_write(out, ":\n", 2);
+        }
+        dir_directory(out, paths[i]);
+        listed++;
+    }
+}
+
+/**
+ * @brief Lists the contents of a single directory.
+ *
+ * @param out writer to produce the listing with
+ * @param path directory to list
+ */
+void dir_directory(Output* out, const char* path)
+{
+    DirWidths widths;
+    size_t count = 0;
+
+    int fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "error - dir: cannot open directory %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    DirEntry* entries = dir_read(fd, path, &count);
+    if (entries == NULL && count > 0) {
+        close(fd);
+        return;
+    }
+
+    dir_stat_all(fd, entries, count);
+    qsort(entries, count, sizeof(DirEntry), dir_compare);
+
+    long long blocks = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].error == 0) {
+            blocks += (long long)entries[i].blocks;
+        }
+    }
+
+    /* total of the space used in 1K blocks, as ls reports it */
+    char total[32];
+    snprintf(total, sizeof(total), "total %lld\n", (blocks + 1) / 2);
+    output_string(out, total);
+    dir_widths(entries, (int)count, &widths);
+    dir_print(out, fd, entries, (int)count, &widths);
+
+    free(entries);
+    close(fd);
+}
+
+/**
+ * @brief Reads the names of every entry of a directory.
+ *
+ * Entries are read with getdents64 into a large buffer, so even huge directories take few
+ * system calls. The names are allocated from the arena, the list itself is released by the
+ * caller with free() as it grows too often to be kept in the arena.
+ *
+ * @param fd open directory
+ * @param path name of the directory, for error messages
+ * @param count destination for the number of entries
+ *
+ * @return the entries, or NULL if out of memory (with count non-zero) or the directory is empty
+ */
+DirEntry* dir_read(int fd, const char* path, size_t* count)
+{
+    DirEntry* entries = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+
+    *count = 0;
+
+    char* buffer = malloc(DIR_BUFFER);
+    if (buffer == NULL) {
+        perror("error - out of memory");
+        *count = 1;
+        return NULL;
+    }
+
+    while ((length = getdents64(fd, buffer, DIR_BUFFER)) > 0) {
+        for (ssize_t offset = 0; offset < length; ) {
+            struct dirent64* record = (struct dirent64*)(buffer + offset);
+            offset += record->d_reclen;
+
+            if (*count == capacity) {
+                size_t grown = capacity ? capacity * 2 : DIR_ENTRIES_INITIAL;
+                DirEntry* temp = realloc(entries, grown * sizeof(DirEntry));
+                if (temp == NULL) {
+                    perror("error - out of memory");
+                    free(entries);
+                    free(buffer);
+                    return NULL;
+                }
+                entries = temp;
+                capacity = grown;
+            }
+
+            size_t size = strlen(record->d_name) + 1;
+            char* name = arena_alloc(&line_arena, size);
+            if (name == NULL) {
+                free(entries);
+                free(buffer);
+                return NULL;
+            }
+            memcpy(name, record->d_name, size);
+            entries[(*count)++].name = name;
+        }
+    }
+    if (length == -1) {
+        fprintf(stderr, "error - dir: reading directory %s: %s\n", path, strerror(errno));
+    }
+
+    free(buffer);
+    return entries;
+}
+
+/**
+ * @brief Retrieves the details of a directory entry, without following symbolic links.
+ *
+ * @param dirfd directory the entry's name is relative to
+ * @param entry entry to complete; error is set if it cannot be examined
+ */
+void dir_stat(int dirfd, DirEntry* entry)
+{
+    struct statx info;
+
+    if (statx(dirfd, entry->name, AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT, STATX_BASIC_STATS, &info) == -1) {
+        struct stat fallback;
+
+        /* statx is unavailable before Linux 4.11 */
+        if (errno != ENOSYS || fstatat(dirfd, entry->name, &fallback, AT_SYMLINK_NOFOLLOW) == -1) {
+            entry->error = errno;
+            return;
+        }
+        entry->error = 0;
+        entry->mode = fallback.st_mode;
+        entry->nlink = fallback.st_nlink;
+        entry->uid = fallback.st_uid;
+        entry->gid = fallback.st_gid;
+        entry->size = fallback.st_size;
+        entry->blocks = fallback.st_blocks;
+        entry->mtime = fallback.st_mtime;
+        entry->rdev_major = major(fallback.st_rdev);
+        entry->rdev_minor = minor(fallback.st_rdev);
+        return;
+    }
+
+    entry->error = 0;
+    entry->mode = info.stx_mode;
+    entry->nlink = info.stx_nlink;
+    entry->uid = info.stx_uid;
+    entry->gid = info.stx_gid;
+    entry->size = (off_t)info.stx_size;
+    entry->blocks = (blkcnt_t)info.stx_blocks;
+    entry->mtime = (time_t)info.stx_mtime.tv_sec;
+    entry->rdev_major = info.stx_rdev_major;
+    entry->rdev_minor = info.stx_rdev_minor;
+}
+
+/**
+ * @brief Retrieves the details of every entry of a directory with statx.
+ *
+ * Large directories are shared between a few threads, each claiming DIR_STAT_CHUNK entries at
+ * a time, so the stat calls of slow (e.g. network) file systems overlap.
+ *
+ * @param dirfd directory the entries belong to
+ * @param entries entries to complete
+ * @param count number of entries
+ */
+void dir_stat_all(int dirfd, DirEntry* entries, size_t count)
+{
+    DirWork work = { dirfd, entries, count, 0 };
+    pthread_t threads[DIR_THREADS];
+    int started = 0;
+
+    if (count >= DIR_PARALLEL) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int wanted = (cpus > DIR_THREADS) ? DIR_THREADS : (int)cpus;
+
+        /* the calling thread works too */
+        for (; started < wanted - 1; started++) {
+            if (pthread_create(&threads[started], NULL, dir_worker, &work) != 0) {
+                break;
+            }
+        }
+    }
+
+    dir_worker(&work);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/**
+ * @brief Completes entries claimed from shared work until there are none left.
+ *
+ * @param argument work shared between the threads (DirWork)
+ *
+ * @return NULL
+ */
+void* dir_worker(void* argument)
+{
+    DirWork* work = argument;
+
+    while (1) {
+        size_t first = __atomic_fetch_add(&work->next, DIR_STAT_CHUNK, __ATOMIC_RELAXED);
+        if (first >= work->count) {
+            return NULL;
+        }
+        size_t last = (first + DIR_STAT_CHUNK < work->count) ? first + DIR_STAT_CHUNK : work->count;
+        for (size_t i = first; i < last; i++) {
+            dir_stat(work->dirfd, &work->entries[i]);
+        }
+    }
+}
+
+/**
+ * @brief Orders entries by name for qsort().
+ */
+int dir_compare(const void* a, const void* b)
+{
+    return strcmp(((const DirEntry*)a)->name, ((const DirEntry*)b)->name);
+}
+
+/**
+ * @brief Measures the columns of a listing, so that they can be aligned as ls -l does.
+ *
+ * @param entries entries to measure
+ * @param count number of entries
+ * @param widths destination for the width of each column
+ */
+void dir_widths(DirEntry* entries, int count, DirWidths* widths)
+{
+    char number[32];
+
+    memset(widths, 0, sizeof(DirWidths));
+    for (int i = 0; i < count; i++) {
+        DirEntry* entry = &entries[i];
+        int width;
+        if (entry->error != 0) {
+            continue;
+        }
+        width = snprintf(number, sizeof(number), "%lu", (unsigned long)entry->nlink);
+        widths->links = (width > widths->links) ? width : widths->links;
+        width = (int)strlen(dir_user(entry->uid));
+        widths->user = (width > widths->user) ? width : widths->user;
+        width = (int)strlen(dir_group(entry->gid));
+        widths->group = (width > widths->group) ? width : widths->group;
+        if (S_ISCHR(entry->mode) || S_ISBLK(entry->mode)) {
+            width = snprintf(number, sizeof(number), "%u", entry->rdev_major);
+            widths->major = (width > widths->major) ? width : widths->major;
+            width = snprintf(number, sizeof(number), "%u", entry->rdev_minor);
+            widths->minor = (width > widths->minor) ? width : widths->minor;
+        } else {
+            width = snprintf(number, sizeof(number), "%lld", (long long)entry->size);
+            widths->size = (width > widths->size) ? width : widths->size;
+        }
+    }
+    if (widths->major > 0 && widths->major + 2 + widths->minor > widths->size) {
+        widths->size = widths->major + 2 + widths->minor;
+    }
+}
+
+/**
+ * @brief Writes one line per entry.
+ *
+ * @param out writer to produce the listing with
+ * @param dirfd directory the entries belong to, used to read symbolic links
+ * @param entries entries to list
+ * @param count number of entries
+ * @param widths width of each column, see dir_widths()
+ */
+void dir_print(Output* out, int dirfd, DirEntry* entries, int count, const DirWidths* widths)
+{
+    char number[32];
+    char line[64];
+    time_t now = time(NULL);
+
+    for (int i = 0; i < count; i++) {
+        DirEntry* entry = &entries[i];
+        char mode[11];
+        char date[32];
+        struct tm local;
+
+        if (entry->error != 0) {
+            fprintf(stderr, "error - dir: cannot access %s: %s\n", entry->name, strerror(entry->error));
+            continue;
+        }
+
+        dir_mode(entry->mode, mode);
+        snprintf(line, sizeof(line), "%s %*lu ", mode, widths->links, (unsigned long)entry->nlink);
+        output_string(out, line);
+        dir_column(out, dir_user(entry->uid), widths->user);
+        dir_column(out, dir_group(entry->gid), widths->group);
+
+        if (S_ISCHR(entry->mode) || S_ISBLK(entry->mode)) {
+            snprintf(number, sizeof(number), "%*u, %*u", widths->major, entry->rdev_major,
+                     widths->minor, entry->rdev_minor);
+        } else {
+            snprintf(number, sizeof(number), "%lld", (long long)entry->size);
+        }
+        snprintf(line, sizeof(line), "%*s ", widths->size, number);
+        output_string(out, line);
+
+        /* recent files show the time, others (including those in the future) the year */
+        localtime_r(&entry->mtime, &local);
+        if (entry->mtime > now - DIR_RECENT && entry->mtime <= now) {
+            strftime(date, sizeof(date), "%b %e %H:%M ", &local);
+        } else {
+            strftime(date, sizeof(date), "%b %e  %Y ", &local);
+        }
+        output_string(out, date);
+        output_string(out, entry->name);
+
+        if (S_ISLNK(entry->mode)) {
+            char target[PATH_MAX];
+            ssize_t length = readlinkat(dirfd, entry->name, target, sizeof(target));
+            if (length > 0) {
+                output_write(out, " -> ", 4);
+                output_write(out, target, (size_t)length);
+            }
+        }
+        output_write(out, "\n", 1);
+    }
+}
+
+/**
+ * @brief Writes a left aligned column followed by a space.
+ *
+ * @param out writer
+ * @param text column contents
+ * @param width width of the column
+ */
+void dir_column(Output* out, const char* text, int width)
+{
+    static const char spaces[] = "                                ";
+    size_t length = strlen(text);
+
+    output_write(out, text, length);
+    for (int pad = width - (int)length + 1; pad > 0; pad -= (int)sizeof(spaces) - 1) {
+        output_write(out, spaces, (pad < (int)sizeof(spaces) - 1) ? (size_t)pad : sizeof(spaces) - 1);
+    }
+}
+
+/**
+ * @brief Describes the type and permissions of a file as ls does, e.g. "drwxr-xr-x".
+ *
+ * @param mode mode of the file
+ * @param buffer destination, at least 11 characters
+ */
+void dir_mode(mode_t mode, char* buffer)
+{
+    buffer[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISCHR(mode) ? 'c' : S_ISBLK(mode) ? 'b'
+              : S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+    buffer[1] = (mode & S_IRUSR) ? 'r' : '-';
+    buffer[2] = (mode & S_IWUSR) ? 'w' : '-';
+    buffer[3] = (mode & S_ISUID) ? ((mode & S_IXUSR) ? 's' : 'S') : ((mode & S_IXUSR) ? 'x' : '-');
+    buffer[4] = (mode & S_IRGRP) ? 'r' : '-';
+    buffer[5] = (mode & S_IWGRP) ? 'w' : '-';
+    buffer[6] = (mode & S_ISGID) ? ((mode & S_IXGRP) ? 's' : 'S') : ((mode & S_IXGRP) ? 'x' : '-');
+    buffer[7] = (mode & S_IROTH) ? 'r' : '-';
+    buffer[8] = (mode & S_IWOTH) ? 'w' : '-';
+    buffer[9] = (mode & S_ISVTX) ? ((mode & S_IXOTH) ? 't' : 'T') : ((mode & S_IXOTH) ? 'x' : '-');
+    buffer[10] = '\0';
+}
+
+/**
+ * @brief Finds the name of a user, remembering recent answers as a listing has few owners.
+ *
+ * @param uid user id
+ *
+ * @return the user name, or the id if the user is unknown
+ */
+const char* dir_user(uid_t uid)
+{
+    DirName* slot = &dir_users[uid % DIR_NAME_CACHE];
+
+    if (!slot->valid || slot->id != uid) {
+        struct passwd* user = getpwuid(uid);
+        slot->id = uid;
+        slot->valid = 1;
+        if (user != NULL) {
+            snprintf(slot->name, sizeof(slot->name), "%s", user->pw_name);
+        } else {
+            snprintf(slot->name, sizeof(slot->name), "%u", (unsigned int)uid);
+        }
+    }
+    return slot->name;
+}
+
+/**
+ * @brief Finds the name of a group, remembering recent answers as a listing has few groups.
+ *
+ * @param gid group id
+ *
+ * @return the group name, or the id if the group is unknown
+ */
+const char* dir_group(gid_t gid)
+{
+    DirName* slot = &dir_groups[gid % DIR_NAME_CACHE];
+
+    if (!slot->valid || slot->id != gid) {
+        struct group* group = getgrgid(gid);
+        slot->id = gid;
+        slot->valid = 1;
+        if (group != NULL) {
+            snprintf(slot->name, sizeof(slot->name), "%s", group->gr_name);
+        } else {
+            snprintf(slot->name, sizeof(slot->name), "%u", (unsigned int)gid);
+        }
+    }
+    return slot->name;
+}
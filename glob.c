@@ -0,0 +1,531 @@
+/**
+ * @file glob.c
+ * @brief Expansion of arguments holding patterns (*, ?, [...] and **) into matching file names.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * A pattern is split at each / and every component holding a wildcard is compiled into a list of
+ * GlobTokens. Directories are read with getdents64 into a large buffer, and every directory read
+ * while processing a line is kept in that line's GlobCache, so several patterns against the same
+ * directory share a single read. Everything, including the matching names, is allocated from the
+ * line's arena.
+ */
+#include "seashell.h"
+
+/* buffer directory entries are read into, kept for the life of the shell */
+static char* glob_buffer = NULL;
+
+/**
+ * @brief Determines whether an argument holds a pattern.
+ *
+ * @param word argument to examine
+ *
+ * @return 1 if the argument holds a *, a ? or a [ closed by a later ], else 0
+ */
+int glob_pattern(const char* word)
+{
+    for (const char* c = strpbrk(word, "*?["); c != NULL; c = strpbrk(c + 1, "*?[")) {
+        if (*c != '[' || strchr(c + 1, ']') != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends an argument, or the names of the files it matches if it holds a pattern.
+ *
+ * The names are sorted by byte value. An argument which matches nothing is appended as it is. A
+ * trailing / matches only directories. ** as a whole component matches any number of directories,
+ * not following symbolic links. Names starting with . are only matched by a pattern which itself
+ * starts with ., and . and .. are never matched.
+ *
+ * @param arena arena the command was allocated from
+ * @param cache directories already read for the line
+ * @param command command to extend
+ * @param word argument to expand
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int glob_expand(Arena* arena, GlobCache* cache, Command* command, char* word)
+{
+    GlobState state;
+    int count = 1;
+
+    memset(&state, 0, sizeof(state));
+    state.arena = arena;
+    state.cache = cache;
+
+    for (const char* c = word; *c != '\0'; c++) {
+        count += (*c == '/');
+    }
+    state.patterns = arena_alloc(arena, (size_t)count * sizeof(GlobPattern));
+    if (state.patterns == NULL) {
+        return -1;
+    }
+
+    /* split into components, an absolute pattern is searched for from / */
+    const char* base = (word[0] == '/') ? "/" : "";
+    for (const char* start = word; *start != '\0'; ) {
+        size_t length = strcspn(start, "/");
+        if (length > 0) {
+            if (glob_compile(arena, &state.patterns[state.count++], start, length) == -1) {
+                return -1;
+            }
+        }
+        start += length;
+        if (*start == '/') {
+            start++;
+            state.directories = (*start == '\0');
+        }
+    }
+
+    /* e.g. a[ or a/[/b, which hold no wildcards once compiled */
+    int wild = 0;
+    for (int i = 0; i < state.count; i++) {
+        wild |= state.patterns[i].wild;
+    }
+    if (!wild) {
+        return add_argument(arena, command, word);
+    }
+
+    glob_walk(&state, base, 0);
+
+    int status = 0;
+    if (state.failed) {
+        status = -1;
+    } else if (state.length == 0) {
+        /* nothing matched, the argument is kept as it is */
+        status = add_argument(arena, command, word);
+    } else {
+        qsort(state.results, state.length, sizeof(char*), glob_compare);
+        for (size_t i = 0; i < state.length && status == 0; i++) {
+            status = add_argument(arena, command, state.results[i]);
+        }
+    }
+
+    #ifdef DEBUG
+    printf("debug: %s matched %zu names\n", word, state.length);
+    #endif
+
+    free(state.results);
+    return status;
+}
+
+/**
+ * @brief Compiles a component of a pattern.
+ *
+ * A [ without a closing ] is an ordinary character. Within brackets, a leading ! or ^ negates the
+ * set, a ] first in the set is an ordinary character, and a-z is a range.
+ *
+ * @param arena arena to allocate the tokens from
+ * @param pattern destination for the compiled component
+ * @param text component, not terminated
+ * @param length length of the component
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int glob_compile(Arena* arena, GlobPattern* pattern, const char* text, size_t length)
+{
+    memset(pattern, 0, sizeof(GlobPattern));
+
+    pattern->text = arena_alloc(arena, length + 1);
+    pattern->tokens = arena_alloc(arena, length * sizeof(GlobToken));
+    if (pattern->text == NULL || pattern->tokens == NULL) {
+        return -1;
+    }
+    memcpy(pattern->text, text, length);
+    pattern->text[length] = '\0';
+
+    pattern->recursive = (length == 2 && text[0] == '*' && text[1] == '*');
+    pattern->dot = (text[0] == '.');
+
+    for (size_t i = 0; i < length; i++) {
+        GlobToken* token = &pattern->tokens[pattern->count++];
+        const char* close = NULL;
+        size_t first = i + 1;
+        size_t negate = 0;
+
+        if (text[i] == '[') {
+            negate = (first < length && (text[first] == '!' || text[first] == '^'));
+            first += negate;
+            /* the set holds at least one character, so a ] straight after the [ is part of it */
+            if (first + 1 < length) {
+                close = memchr(text + first + 1, ']', length - first - 1);
+            }
+        }
+
+        if (text[i] == '*') {
+            /* consecutive stars are a single star */
+            pattern->wild = 1;
+            token->type = GLOB_STAR;
+            while (i + 1 < length && text[i + 1] == '*') {
+                i++;
+            }
+        } else if (text[i] == '?') {
+            pattern->wild = 1;
+            token->type = GLOB_ANY;
+        } else if (close != NULL) {
+            pattern->wild = 1;
+            token->type = GLOB_SET;
+            token->set = arena_alloc(arena, 32);
+            if (token->set == NULL) {
+                return -1;
+            }
+            memset(token->set, 0, 32);
+
+            for (const char* c = text + first; c < close; c++) {
+                unsigned int low = (unsigned char)*c;
+                unsigned int high = low;
+                if (c + 2 < close && c[1] == '-') {
+                    high = (unsigned char)c[2];
+                    c += 2;
+                }
+                for (unsigned int k = low; k <= high; k++) {
+                    token->set[k >> 3] |= (unsigned char)(1 << (k & 7));
+                }
+            }
+            if (negate) {
+                for (int k = 0; k < 32; k++) {
+                    token->set[k] = (unsigned char)~token->set[k];
+                }
+            }
+            i = (size_t)(close - text);
+        } else {
+            /* including a [ which is never closed */
+            token->type = GLOB_CHAR;
+            token->c = (unsigned char)text[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Matches a name against a compiled component.
+ *
+ * @param pattern compiled component
+ * @param name name to match
+ *
+ * @return 1 if the name matches, else 0
+ */
+int glob_match(const GlobPattern* pattern, const char* name)
+{
+    const GlobToken* tokens = pattern->tokens;
+    int count = pattern->count;
+    int token = 0;
+    int star = -1;
+    const char* mark = NULL;
+
+    if (name[0] == '.' && !pattern->dot) {
+        return 0;
+    }
+
+    /* on a mismatch, the most recent star takes one more character and matching resumes */
+    while (*name != '\0') {
+        if (token < count) {
+            const GlobToken* t = &tokens[token];
+            unsigned char c = (unsigned char)*name;
+            if (t->type == GLOB_STAR) {
+                star = ++token;
+                mark = name;
+                continue;
+            }
+            if (t->type == GLOB_ANY || (t->type == GLOB_CHAR && t->c == c)
+                    || (t->type == GLOB_SET && (t->set[c >> 3] & (1 << (c & 7))))) {
+                token++;
+                name++;
+                continue;
+            }
+        }
+        if (star == -1) {
+            return 0;
+        }
+        token = star;
+        name = ++mark;
+    }
+
+    while (token < count && tokens[token].type == GLOB_STAR) {
+        token++;
+    }
+    return token == count;
+}
+
+/**
+ * @brief Finds the names matching the components of the pattern from the given one onwards.
+ *
+ * @param state expansion in progress
+ * @param base path matched by the earlier components, "" for the current directory
+ * @param index component to match next
+ */
+void glob_walk(GlobState* state, const char* base, int index)
+{
+    GlobPattern* pattern = &state->patterns[index];
+    int last = (index == state->count - 1);
+
+    if (state->failed) {
+        return;
+    }
+
+    /* a component without wildcards is a name, there is nothing to search for */
+    if (!pattern->wild) {
+        char* path = glob_join(state, base, pattern->text, "");
+        if (path == NULL) {
+            return;
+        }
+        if (!last) {
+            glob_walk(state, path, index + 1);
+        } else if (glob_exists(path, state->directories)) {
+            glob_add(state, base, pattern->text);
+        }
+        return;
+    }
+
+    GlobDirectory* directory = glob_scan(state, base);
+    if (directory == NULL) {
+        return;
+    }
+
+    if (pattern->recursive && !last) {
+        /* ** matching no directories at all */
+        glob_walk(state, base, index + 1);
+    }
+
+    for (size_t i = 0; i < directory->count && !state->failed; i++) {
+        GlobEntry* entry = &directory->entries[i];
+
+        if (pattern->recursive) {
+            /* ** never descends into hidden directories, nor follows symbolic links */
+            if (entry->name[0] == '.') {
+                continue;
+            }
+            char* path = glob_join(state, base, entry->name, "");
+            if (path == NULL) {
+                return;
+            }
+            int is_directory = (entry->type == DT_DIR);
+            if (entry->type == DT_UNKNOWN) {
+                struct stat info;
+                is_directory = (lstat(path, &info) == 0 && S_ISDIR(info.st_mode));
+            }
+            if (last && (!state->directories || is_directory)) {
+                glob_add(state, base, entry->name);
+            }
+            if (is_directory) {
+                glob_walk(state, path, index);
+            }
+            continue;
+        }
+
+        if (!glob_match(pattern, entry->name)) {
+            continue;
+        }
+        if (last) {
+            if (!state->directories || entry->type == DT_DIR
+                    || ((entry->type == DT_LNK || entry->type == DT_UNKNOWN)
+                        && glob_exists(glob_join(state, base, entry->name, ""), 1))) {
+                glob_add(state, base, entry->name);
+            }
+        } else if (entry->type == DT_DIR || entry->type == DT_LNK || entry->type == DT_UNKNOWN) {
+            char* path = glob_join(state, base, entry->name, "");
+            if (path != NULL) {
+                glob_walk(state, path, index + 1);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reads the entries of a directory, or finds them in the line's cache.
+ *
+ * @param state expansion in progress
+ * @param path directory to read, "" for the current directory
+ *
+ * @return the directory, or NULL if it could not be read
+ */
+GlobDirectory* glob_scan(GlobState* state, const char* path)
+{
+    GlobCache* cache = state->cache;
+    unsigned int bucket = 2166136261u;
+
+    for (const char* c = path; *c != '\0'; c++) {
+        bucket = (bucket ^ (unsigned char)*c) * 16777619u;
+    }
+    bucket &= GLOB_CACHE_SIZE - 1;
+
+    if (cache->buckets == NULL) {
+        cache->buckets = arena_alloc(state->arena, GLOB_CACHE_SIZE * sizeof(GlobDirectory*));
+        if (cache->buckets == NULL) {
+            state->failed = 1;
+            return NULL;
+        }
+        memset(cache->buckets, 0, GLOB_CACHE_SIZE * sizeof(GlobDirectory*));
+    }
+    for (GlobDirectory* temp = cache->buckets[bucket]; temp != NULL; temp = temp->next) {
+        if (strcmp(temp->path, path) == 0) {
+            return temp->readable ? temp : NULL;
+        }
+    }
+
+    GlobDirectory* directory = arena_alloc(state->arena, sizeof(GlobDirectory));
+    if (directory == NULL) {
+        state->failed = 1;
+        return NULL;
+    }
+    memset(directory, 0, sizeof(GlobDirectory));
+    directory->path = (char*)path;
+    directory->next = cache->buckets[bucket];
+    cache->buckets[bucket] = directory;
+
+    /* a directory which cannot be read simply matches nothing, as is remembered */
+    int fd = open((path[0] != '\0') ? path : ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (glob_buffer == NULL && (glob_buffer = malloc(DIR_BUFFER)) == NULL) {
+        perror("error - out of memory");
+        close(fd);
+        state->failed = 1;
+        return NULL;
+    }
+
+    /* the list grows in the arena, every name is allocated from it once the list is complete */
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getdents64(fd, glob_buffer, DIR_BUFFER)) > 0) {
+        for (ssize_t offset = 0; offset < length; ) {
+            struct dirent64* record = (struct dirent64*)(glob_buffer + offset);
+            offset += record->d_reclen;
+
+            const char* name = record->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t size = strlen(name) + 1;
+            char* copy = arena_alloc(state->arena, size);
+            if (copy == NULL) {
+                state->failed = 1;
+                close(fd);
+                return NULL;
+            }
+            memcpy(copy, name, size);
+
+            if (directory->count == capacity) {
+                size_t grown = capacity ? capacity * 2 : DIR_ENTRIES_INITIAL;
+                GlobEntry* entries = arena_alloc(state->arena, grown * sizeof(GlobEntry));
+                if (entries == NULL) {
+                    state->failed = 1;
+                    close(fd);
+                    return NULL;
+                }
+                if (directory->count > 0) {
+                    memcpy(entries, directory->entries, directory->count * sizeof(GlobEntry));
+                }
+                directory->entries = entries;
+                capacity = grown;
+            }
+            directory->entries[directory->count].name = copy;
+            directory->entries[directory->count].type = record->d_type;
+            directory->count++;
+        }
+    }
+    close(fd);
+
+    directory->readable = 1;
+    return directory;
+}
+
+/**
+ * @brief Joins a directory and a name, allocated from the arena.
+ *
+ * @param state expansion in progress
+ * @param base directory, "" for the current directory
+ * @param name name within the directory
+ * @param suffix text appended, e.g. "/"
+ *
+ * @return the path, or NULL if out of memory
+ */
+char* glob_join(GlobState* state, const char* base, const char* name, const char* suffix)
+{
+    size_t length = strlen(base);
+    size_t separator = (length > 0 && base[length - 1] != '/');
+    char* path = arena_alloc(state->arena, length + separator + strlen(name) + strlen(suffix) + 1);
+
+    if (path == NULL) {
+        state->failed = 1;
+        return NULL;
+    }
+    memcpy(path, base, length);
+    if (separator) {
+        path[length++] = '/';
+    }
+    strcpy(stpcpy(path + length, name), suffix);
+    return path;
+}
+
+/**
+ * @brief Determines whether a path exists.
+ *
+ * @param path path to examine, or NULL
+ * @param directory whether it must be a directory (following symbolic links)
+ *
+ * @return 1 if it exists, else 0
+ */
+int glob_exists(const char* path, int directory)
+{
+    struct stat info;
+
+    if (path == NULL) {
+        return 0;
+    }
+    if (directory) {
+        return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+    }
+    return lstat(path, &info) == 0;
+}
+
+/**
+ * @brief Records a matching name.
+ *
+ * @param state expansion in progress
+ * @param base directory holding the name
+ * @param name matching name
+ */
+void glob_add(GlobState* state, const char* base, const char* name)
+{
+    char* path = glob_join(state, base, name, state->directories ? "/" : "");
+    if (path == NULL) {
+        return;
+    }
+
+    if (state->length == state->capacity) {
+        size_t grown = state->capacity ? state->capacity * 2 : ARGS_INITIAL;
+        char** results = realloc(state->results, grown * sizeof(char*));
+        if (results == NULL) {
+            perror("error - out of memory");
+            state->failed = 1;
+            return;
+        }
+        state->results = results;
+        state->capacity = grown;
+    }
+    state->results[state->length++] = path;
+}
+
+/**
+ * @brief Orders matching names by byte value, for qsort().
+ */
+int glob_compare(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * @brief Releases the buffer directories are read into.
+ */
+void glob_free(void)
+{
+    free(glob_buffer);
+    glob_buffer = NULL;
+}
@@ -0,0 +1,311 @@
+/**
+ * @file hash.c
+ * @brief Cache of resolved PATH locations for external commands.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/* buckets of the command name -> absolute path table */
+static PathEntry* path_table[PATH_TABLE_SIZE];
+
+/* copy of the PATH variable the table was built against */
+static char* path_variable = NULL;
+
+/**
+ * @brief Hashes a command name (FNV-1a).
+ *
+ * @param name command name
+ *
+ * @return bucket index within path_table
+ */
+unsigned int path_hash(const char* name)
+{
+    unsigned int hash = 2166136261u;
+    for (const char* c = name; *c != '\0'; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+    return hash & (PATH_TABLE_SIZE - 1);
+}
+
+/**
+ * @brief Empties the table if PATH has changed since it was populated.
+ */
+void path_check_variable(void)
+{
+    const char* current = getenv("PATH");
+
+    if (current == NULL && path_variable == NULL) {
+        return;
+    }
+    if (current != NULL && path_variable != NULL && strcmp(current, path_variable) == 0) {
+        return;
+    }
+
+    #ifdef DEBUG
+    printf("debug: PATH changed, clearing command hash table\n");
+    #endif
+    path_clear();
+    path_variable = current ? strdup(current) : NULL;
+}
+
+/**
+ * @brief Searches the directories listed in PATH for an executable.
+ *
+ * @param name command name, without any '/'
+ * @param buffer destination for the resolved location
+ * @param size size of buffer
+ *
+ * @return buffer if an executable was found, else NULL
+ */
+char* path_resolve(const char* name, char* buffer, size_t size)
+{
+    const char* dirs = getenv("PATH");
+    struct stat info;
+
+    /* same default as execvp */
+    if (dirs == NULL) {
+        dirs = "/bin:/usr/bin";
+    }
+
+    while (1) {
+        const char* end = strchr(dirs, ':');
+        if (end == NULL) {
+            end = dirs + strlen(dirs);
+        }
+        int length = (int)(end - dirs);
+
+        /* an empty entry refers to the current directory */
+        if (length == 0) {
+            snprintf(buffer, size, "./%s", name);
+        } else {
+            snprintf(buffer, size, "%.*s/%s", length, dirs, name);
+        }
+
+        if (stat(buffer, &info) == 0 && S_ISREG(info.st_mode) && access(buffer, X_OK) == 0) {
+            return buffer;
+        }
+
+        if (*end == '\0') {
+            break;
+        }
+        dirs = end + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Finds the location of a command, consulting the table before searching PATH.
+ *
+ * Locations found relative to the current directory are not remembered, as they become
+ * invalid as soon as the directory changes.
+ *
+ * @param name command name, without any '/'
+ *
+ * @return absolute location of the command, or NULL if it cannot be found
+ */
+const char* path_lookup(const char* name)
+{
+    static char buffer[PATH_MAX];
+
+    path_check_variable();
+
+    for (PathEntry* entry = path_table[path_hash(name)]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+
+    if (path_resolve(name, buffer, sizeof(buffer)) == NULL) {
+        return NULL;
+    }
+    if (buffer[0] != '/') {
+        return buffer;
+    }
+
+    PathEntry* entry = path_remember(name, buffer);
+    if (entry == NULL) {
+        return buffer;
+    }
+    entry->hits = 1;
+    return entry->path;
+}
+
+/**
+ * @brief Adds a command to the table.
+ *
+ * @param name command name
+ * @param path absolute location of the command
+ *
+ * @return the new entry, or NULL if out of memory
+ */
+PathEntry* path_remember(const char* name, const char* path)
+{
+    PathEntry* entry = malloc(sizeof(PathEntry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->name = strdup(name);
+    entry->path = strdup(path);
+    if (entry->name == NULL || entry->path == NULL) {
+        free(entry->name);
+        free(entry->path);
+        free(entry);
+        return NULL;
+    }
+    entry->hits = 0;
+    entry->next = path_table[path_hash(name)];
+    path_table[path_hash(name)] = entry;
+
+    #ifdef DEBUG
+    printf("debug: hashed %s=%s\n", entry->name, entry->path);
+    #endif
+
+    return entry;
+}
+
+/**
+ * @brief Removes a single command from the table, e.g. once its location no longer exists.
+ *
+ * @param name command name
+ */
+void path_forget(const char* name)
+{
+    for (PathEntry** link = &path_table[path_hash(name)]; *link != NULL; link = &(*link)->next) {
+        if (strcmp((*link)->name, name) == 0) {
+            PathEntry* entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Removes every command from the table.
+ */
+void path_clear(void)
+{
+    for (int i = 0; i < PATH_TABLE_SIZE; i++) {
+        while (path_table[i] != NULL) {
+            PathEntry* entry = path_table[i];
+            path_table[i] = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+    }
+    free(path_variable);
+    path_variable = NULL;
+}
+
+/**
+ * @brief Prints the contents of the table, one command per line, with the number of hits.
+ */
+void path_print(void)
+{
+    path_check_variable();
+
+    int empty = 1;
+    for (int i = 0; i < PATH_TABLE_SIZE; i++) {
+        for (PathEntry* entry = path_table[i]; entry != NULL; entry = entry->next) {
+            if (empty) {
+                printf("hits\tcommand\n");
+                empty = 0;
+            }
+            printf("%4u\t%s\n", entry->hits, entry->path);
+        }
+    }
+
+    if (empty) {
+        printf("hash: hash table empty\n");
+    }
+}
+
+/**
+ * @brief Writes the commands within the table, as pairs of NULL terminated name and location.
+ *
+ * Nothing is written unless the table was populated against the given PATH. As many whole
+ * pairs as the descriptor takes without blocking are written, the rest are left out.
+ *
+ * @param fd descriptor to write to, non-blocking
+ * @param variable PATH the locations must have been found with
+ *
+ * @return 0 on success, -1 if some of the pairs were not written
+ */
+int path_share(int fd, const char* variable)
+{
+    char buffer[PIPE_BUF];
+    size_t used = 0;
+
+    if (path_variable == NULL || variable == NULL || strcmp(path_variable, variable) != 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < PATH_TABLE_SIZE; i++) {
+        for (PathEntry* entry = path_table[i]; entry != NULL; entry = entry->next) {
+            size_t name = strlen(entry->name) + 1;
+            size_t path = strlen(entry->path) + 1;
+            if (name + path > sizeof(buffer)) {
+                continue;
+            }
+            if (used + name + path > sizeof(buffer)) {
+                /* writes of at most PIPE_BUF bytes are whole or not at all */
+                if (write(fd, buffer, used) != (ssize_t)used) {
+                    return -1;
+                }
+                used = 0;
+            }
+            memcpy(buffer + used, entry->name, name);
+            memcpy(buffer + used + name, entry->path, path);
+            used += name + path;
+        }
+    }
+    if (used > 0 && write(fd, buffer, used) != (ssize_t)used) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the commands written by path_share() to the table, unless already there.
+ *
+ * @param pairs NULL terminated names and locations
+ * @param size bytes of pairs
+ */
+void path_learn(const char* pairs, size_t size)
+{
+    const char* end = pairs + size;
+
+    path_check_variable();
+
+    while (pairs < end) {
+        const char* name = pairs;
+        const char* path = memchr(name, '\0', (size_t)(end - name));
+        if (path == NULL || ++path >= end) {
+            return;
+        }
+        const char* next = memchr(path, '\0', (size_t)(end - path));
+        if (next == NULL) {
+            return;
+        }
+        pairs = next + 1;
+
+        int known = 0;
+        for (PathEntry* entry = path_table[path_hash(name)]; entry != NULL; entry = entry->next) {
+            if (strcmp(entry->name, name) == 0) {
+                known = 1;
+                break;
+            }
+        }
+        if (!known && path[0] == '/' && strchr(name, '/') == NULL) {
+            path_remember(name, path);
+        }
+    }
+}
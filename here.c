@@ -0,0 +1,193 @@
+/**
+ * @file here.c
+ * @brief Here-documents (<<EOF) and here-strings (<<< word), inline data given as stdin.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * The text is collected into the line's arena while the line is parsed, and only handed to the
+ * command when it is executed: small texts are written into a pipe, larger ones into a sealed
+ * memfd, so nothing is ever written to disk.
+ */
+#include "seashell.h"
+
+/**
+ * @brief Reads the body of every here-document of a line, which follows the line itself.
+ *
+ * Each body ends at a line holding just its delimiter. Variables are expanded within the body.
+ *
+ * @param arena arena the pipeline was allocated from
+ * @param pipeline pipeline parsed from the line
+ * @param in reader to take the body from, or NULL to take it from text
+ * @param text the lines following the line, separated by newlines, when in is NULL
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int here_read(Arena* arena, Pipeline* pipeline, Input* in, char* text)
+{
+    for (Command* command = pipeline->first; command != NULL; command = command->next) {
+        if (command->here_delimiter == NULL) {
+            continue;
+        }
+
+        size_t capacity = 0;
+        char* line;
+        command->here_text = NULL;
+        command->here_length = 0;
+
+        while ((line = here_line(in, &text)) != NULL && strcmp(line, command->here_delimiter) != 0) {
+            char* expanded = var_expand(arena, line);
+            if (expanded == NULL) {
+                return -1;
+            }
+            size_t length = strlen(expanded);
+
+            /* room for the line and its newline */
+            if (command->here_length + length + 1 > capacity) {
+                size_t grown = capacity ? capacity * 2 : INPUT_BUFFER;
+                while (grown < command->here_length + length + 1) {
+                    grown *= 2;
+                }
+                char* body = arena_grow(arena, command->here_text, capacity, grown);
+                if (body == NULL) {
+                    return -1;
+                }
+                command->here_text = body;
+                capacity = grown;
+            }
+            memcpy(command->here_text + command->here_length, expanded, length);
+            command->here_length += length;
+            command->here_text[command->here_length++] = '\n';
+        }
+
+        if (line == NULL) {
+            fprintf(stderr, "error - here-document ended by end of input (wanted %s)\n",
+                    command->here_delimiter);
+        }
+        if (command->here_text == NULL) {
+            /* an empty document is still a redirection */
+            command->here_text = "";
+        }
+
+        #ifdef DEBUG
+        printf("debug: here-document of %zu bytes ended by %s\n", command->here_length,
+               command->here_delimiter);
+        #endif
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the next line of a here-document.
+ *
+ * @param in reader to read from, or NULL to take the line from text
+ * @param text remaining lines, advanced past the line returned, when in is NULL
+ *
+ * @return the line, or NULL at the end of input
+ */
+char* here_line(Input* in, char** text)
+{
+    if (in != NULL) {
+        if (isatty(in->fd)) {
+            printf("> ");
+            fflush(stdout);
+        }
+        return input_line(in);
+    }
+
+    char* line = *text;
+    if (line == NULL) {
+        return NULL;
+    }
+    char* newline = strchr(line, '\n');
+    if (newline != NULL) {
+        *newline = '\0';
+        *text = newline + 1;
+    } else {
+        *text = NULL;
+    }
+    return line;
+}
+
+/**
+ * @brief Records a here-string on a command, the word followed by a newline.
+ *
+ * @param arena arena the command was allocated from
+ * @param command command to give the text to
+ * @param word the word, with variables already expanded
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int here_string(Arena* arena, Command* command, const char* word)
+{
+    size_t length = strlen(word);
+    char* text = arena_alloc(arena, length + 1);
+
+    if (text == NULL) {
+        return -1;
+    }
+    memcpy(text, word, length);
+    text[length] = '\n';
+
+    command->here_text = text;
+    command->here_length = length + 1;
+    command->here_delimiter = NULL;
+    return 0;
+}
+
+/**
+ * @brief Creates a descriptor from which the text of a here-document or here-string is read.
+ *
+ * Text which fits within a pipe in a single write (PIPE_BUF) is written into a pipe, anything
+ * larger into a memfd which is then sealed and rewound.
+ *
+ * @param text text to read
+ * @param length length of the text
+ *
+ * @return the descriptor, close-on-exec, or -1 on failure
+ */
+int here_open(const char* text, size_t length)
+{
+    if (length <= PIPE_BUF) {
+        int pipes[2];
+        if (pipe2(pipes, O_CLOEXEC) == -1) {
+            perror("error - failed to redirect stdin");
+            return -1;
+        }
+        if (length > 0 && write(pipes[1], text, length) != (ssize_t)length) {
+            perror("error - failed to redirect stdin");
+            close(pipes[0]);
+            close(pipes[1]);
+            return -1;
+        }
+        close(pipes[1]);
+        return pipes[0];
+    }
+
+    int fd = memfd_create("seashell-here", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        perror("error - failed to redirect stdin");
+        return -1;
+    }
+    for (size_t done = 0; done < length; ) {
+        ssize_t count = write(fd, text + done, length - done);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            perror("error - failed to redirect stdin");
+            close(fd);
+            return -1;
+        }
+        done += (size_t)count;
+    }
+
+    /* the command only ever reads it, sealing guarantees it */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        perror("error - failed to redirect stdin");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,239 @@
+/**
+ * @file input.c
+ * @brief Line reader for batch files and interactive input.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/**
+ * @brief Prepares the reader for a file descriptor.
+ *
+ * Regular files are mapped into memory and tokenized in place, nothing is read up front so
+ * execution starts immediately however large the file is, from the descriptor's current offset.
+ * Pipes and terminals are read into a buffer which grows to fit the longest line.
+ *
+ * @param in reader to initialise
+ * @param fd file descriptor to read from
+ *
+ * @return 0 on success, -1 on failure
+ */
+int input_open(Input* in, int fd)
+{
+    struct stat info;
+
+    memset(in, 0, sizeof(Input));
+    in->fd = fd;
+    in->limit = (size_t)sysconf(_SC_ARG_MAX);
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        /* private mapping, the line terminators written while tokenizing are never saved */
+        void* map = mmap(NULL, (size_t)info.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)info.st_size, MADV_SEQUENTIAL);
+            in->map = map;
+            in->map_size = (size_t)info.st_size;
+            off_t offset = lseek(fd, 0, SEEK_CUR);
+            if (offset > 0) {
+                in->position = ((size_t)offset < in->map_size) ? (size_t)offset : in->map_size;
+            }
+            #ifdef DEBUG
+            printf("debug: mapped %zu bytes of input\n", in->map_size);
+            #endif
+            return 0;
+        }
+    }
+
+    in->capacity = INPUT_BUFFER;
+    in->buffer = malloc(in->capacity);
+    if (in->buffer == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the next line of input, with the trailing newline replaced by a terminator.
+ *
+ * Lines longer than ARG_MAX are reported and skipped. The line remains valid until the next call.
+ *
+ * @param in reader
+ *
+ * @return the line, or NULL at the end of input or on error (in which case error is set)
+ */
+char* input_line(Input* in)
+{
+    while (1) {
+        char* line = (in->map != NULL) ? input_map_line(in) : input_stream_line(in);
+
+        if (line == NULL || in->length <= in->limit) {
+            return line;
+        }
+        fprintf(stderr, "error - line exceeds %zu bytes, skipped\n", in->limit);
+    }
+}
+
+/**
+ * @brief Returns the next line of a mapped file.
+ *
+ * Pages behind the current position are discarded as the file is processed, so memory use stays
+ * constant regardless of the size of the file. When the descriptor is shared with commands (e.g.
+ * the shell's stdin), its offset is kept just past the line returned, and lines a command has
+ * read meanwhile are not returned again.
+ *
+ * @param in reader
+ *
+ * @return the line, or NULL at the end of the file
+ */
+char* input_map_line(Input* in)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (in->shared) {
+        off_t offset = lseek(in->fd, 0, SEEK_CUR);
+        if (offset > 0 && (size_t)offset > in->position) {
+            in->position = ((size_t)offset < in->map_size) ? (size_t)offset : in->map_size;
+        }
+    }
+
+    /* drop private copies of pages which have been fully processed */
+    size_t done = in->position & ~(page - 1);
+    if (done - in->released >= INPUT_RELEASE) {
+        madvise(in->map + in->released, done - in->released, MADV_DONTNEED);
+        in->released = done;
+    }
+
+    if (in->position >= in->map_size) {
+        return NULL;
+    }
+
+    char* line = in->map + in->position;
+    size_t remaining = in->map_size - in->position;
+    char* newline = memchr(line, '\n', remaining);
+
+    if (newline != NULL) {
+        *newline = '\0';
+        in->length = (size_t)(newline - line);
+        in->position += in->length + 1;
+        if (in->shared) {
+            lseek(in->fd, (off_t)in->position, SEEK_SET);
+        }
+        return line;
+    }
+
+    /* the final line has no newline, copy it somewhere it can be terminated */
+    in->position = in->map_size;
+    if (in->shared) {
+        lseek(in->fd, (off_t)in->position, SEEK_SET);
+    }
+    in->length = remaining;
+    free(in->buffer);
+    in->buffer = malloc(remaining + 1);
+    if (in->buffer == NULL) {
+        in->error = errno;
+        return NULL;
+    }
+    memcpy(in->buffer, line, remaining);
+    in->buffer[remaining] = '\0';
+    return in->buffer;
+}
+
+/**
+ * @brief Returns the next line read from a pipe or terminal.
+ *
+ * @param in reader
+ *
+ * @return the line, or NULL at the end of input or on error
+ */
+char* input_stream_line(Input* in)
+{
+    while (1) {
+        char* line = in->buffer + in->start;
+        char* newline = memchr(line, '\n', in->end - in->start);
+
+        if (newline != NULL) {
+            *newline = '\0';
+            in->length = (size_t)(newline - line);
+            in->start += in->length + 1;
+            if (in->skipping) {
+                /* end of a line which was too long */
+                in->skipping = 0;
+                continue;
+            }
+            return line;
+        }
+
+        if (in->eof) {
+            if (in->start == in->end || in->skipping) {
+                return NULL;
+            }
+            /* final line without a newline, there is always room for the terminator */
+            in->buffer[in->end] = '\0';
+            in->length = in->end - in->start;
+            in->start = in->end;
+            return line;
+        }
+
+        /* move the partial line to the front of the buffer */
+        if (in->start > 0) {
+            memmove(in->buffer, line, in->end - in->start);
+            in->end -= in->start;
+            in->start = 0;
+        }
+
+        /* grow the buffer to fit the line, or discard it once it is too long */
+        if (in->end + 1 >= in->capacity) {
+            if (in->capacity > in->limit) {
+                if (!in->skipping) {
+                    fprintf(stderr, "error - line exceeds %zu bytes, skipped\n", in->limit);
+                }
+                in->skipping = 1;
+                in->end = 0;
+            } else {
+                char* grown = realloc(in->buffer, in->capacity * 2);
+                if (grown == NULL) {
+                    in->error = errno;
+                    return NULL;
+                }
+                in->buffer = grown;
+                in->capacity *= 2;
+            }
+        }
+
+        ssize_t count = read(in->fd, in->buffer + in->end, in->capacity - in->end - 1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            in->error = errno;
+            return NULL;
+        } else if (count == 0) {
+            in->eof = 1;
+        }
+        in->end += (size_t)count;
+    }
+}
+
+/**
+ * @brief Releases the memory used by the reader and closes its file descriptor.
+ *
+ * Standard input is left open.
+ *
+ * @param in reader
+ */
+void input_close(Input* in)
+{
+    if (in->map != NULL) {
+        munmap(in->map, in->map_size);
+        in->map = NULL;
+    }
+    free(in->buffer);
+    in->buffer = NULL;
+    if (in->fd > STDIN_FILENO) {
+        if (close(in->fd) != 0) {
+            perror("failed to close file\n");
+        }
+    }
+    in->fd = -1;
+}
@@ -0,0 +1,468 @@
+/**
+ * @file jobs.c
+ * @brief Table of background jobs, reaped through an event loop instead of a signal handler.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/* background jobs, in the order they were launched */
+static Job* job_list = NULL;
+static Job* job_last = NULL;
+
+/* number of jobs with processes still running */
+static int job_running = 0;
+
+/* processes which could not be given a pidfd, found by scanning when SIGCHLD arrives */
+static int job_unwatched = 0;
+
+/* event loop, watching the pidfd of every running process and a signalfd for SIGCHLD */
+static int job_epoll = -1;
+static int job_signal = -1;
+
+/**
+ * @brief Creates the event loop used to learn when background processes finish.
+ *
+ * SIGCHLD must already be blocked (see setup_signal_handlers()), it is only ever received
+ * through the signalfd. Should the event loop be unavailable every running process is checked
+ * instead.
+ */
+void jobs_setup(void)
+{
+    sigset_t mask;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+
+    job_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (job_epoll == -1) {
+        perror("error - unable to create job event loop");
+        return;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    job_signal = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (job_signal == -1 || epoll_ctl(job_epoll, EPOLL_CTL_ADD, job_signal, &event) == -1) {
+        perror("error - unable to watch SIGCHLD");
+    }
+}
+
+/**
+ * @brief Records a job launched in the background.
+ *
+ * @param first first command of the job
+ * @param pids process ids of the commands, -1 for any which were not launched
+ * @param count number of commands
+ * @param start time the commands were launched
+ *
+ * @return the new job, or NULL if no process was launched or out of memory
+ */
+Job* jobs_add(Command* first, const pid_t* pids, int count, const struct timespec* start)
+{
+    Command* command = first;
+    size_t length = 0;
+    int launched = 0;
+
+    /* describe the job as it was typed, less any redirection */
+    for (int i = 0; i < count && command != NULL; i++, command = command->next) {
+        for (char** temp = command->args; *temp != NULL; temp++) {
+            length += strlen(*temp) + 1;
+        }
+        length += 2;
+        launched += (pids[i] > 0);
+    }
+    if (launched == 0) {
+        return NULL;
+    }
+
+    Job* job = malloc(sizeof(Job) + (size_t)count * sizeof(JobProcess));
+    if (job == NULL || (job->command = malloc(length + 1)) == NULL) {
+        perror("error - unable to record job");
+        free(job);
+        return NULL;
+    }
+
+    char* end = job->command;
+    command = first;
+    for (int i = 0; i < count && command != NULL; i++, command = command->next) {
+        if (i > 0) {
+            end = stpcpy(end, "| ");
+        }
+        for (char** temp = command->args; *temp != NULL; temp++) {
+            end = stpcpy(end, *temp);
+            *end++ = ' ';
+        }
+    }
+    if (end > job->command) {
+        end--;
+    }
+    *end = '\0';
+
+    job->next = NULL;
+    job->id = (job_last != NULL) ? job_last->id + 1 : 1;
+    job->count = count;
+    job->running = 0;
+    job->status = 0;
+    command = first;
+    for (int i = 0; i < count; i++, command = command->next) {
+        JobProcess* process = &job->processes[i];
+        process->pid = pids[i];
+        process->start = *start;
+        snprintf(process->name, sizeof(process->name), "%s", command->args[0]);
+        process->pidfd = -1;
+        process->status = 0;
+        process->running = (pids[i] > 0);
+        if (!process->running) {
+            continue;
+        }
+        job->running++;
+
+        /* a process which has exited but not been reaped can still be opened */
+        #ifdef SYS_pidfd_open
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = job };
+        if (job_epoll != -1) {
+            process->pidfd = (int)syscall(SYS_pidfd_open, process->pid, 0);
+            if (process->pidfd != -1 && epoll_ctl(job_epoll, EPOLL_CTL_ADD, process->pidfd, &event) == -1) {
+                close(process->pidfd);
+                process->pidfd = -1;
+            }
+        }
+        #endif
+        if (process->pidfd == -1) {
+            job_unwatched++;
+        }
+    }
+    job_running++;
+
+    if (job_last != NULL) {
+        job_last->next = job;
+    } else {
+        job_list = job;
+    }
+    job_last = job;
+
+    if (isatty(input.fd)) {
+        printf("[%d] %d\n", job->id, job->processes[count - 1].pid);
+    }
+    #ifdef DEBUG
+    printf("debug: job %d is %s\n", job->id, job->command);
+    #endif
+
+    return job;
+}
+
+/**
+ * @brief Records the exit status of a process belonging to a job.
+ *
+ * @param job job the process belongs to
+ * @param process process which has been reaped
+ * @param status status reported by wait4
+ * @param usage resources used by the process, as reported by wait4, or NULL if unknown
+ */
+void jobs_record(Job* job, JobProcess* process, int status, const struct rusage* usage)
+{
+    if (!process->running) {
+        return;
+    }
+    if (usage != NULL) {
+        metrics_reaped(process->name, process->pid, &process->start, status, usage);
+    }
+
+    process->running = 0;
+    process->status = status;
+    if (process->pidfd != -1) {
+        close(process->pidfd);
+        process->pidfd = -1;
+    } else {
+        job_unwatched--;
+    }
+
+    /* the status of a pipeline is that of its last command */
+    if (process == &job->processes[job->count - 1]) {
+        job->status = status;
+    }
+    if (--job->running == 0) {
+        job_running--;
+    }
+
+    #ifdef DEBUG
+    printf("debug: %d exited with %d\n", process->pid, status);
+    #endif
+}
+
+/**
+ * @brief Reaps any processes of a job which have finished.
+ *
+ * @param job job to check
+ * @param options WNOHANG to return immediately, 0 to wait for every process
+ */
+void jobs_check(Job* job, int options)
+{
+    for (int i = 0; i < job->count; i++) {
+        JobProcess* process = &job->processes[i];
+        struct rusage usage;
+        int status = 0;
+        pid_t pid;
+
+        if (!process->running) {
+            continue;
+        }
+        do {
+            pid = wait4(process->pid, &status, options, &usage);
+        } while (pid == -1 && errno == EINTR);
+
+        if (pid == process->pid) {
+            jobs_record(job, process, status, &usage);
+        } else if (pid == -1) {
+            /* reaped by someone else, the status is lost */
+            jobs_record(job, process, 0, NULL);
+        }
+    }
+}
+
+/**
+ * @brief Records the status of a background process reaped elsewhere, e.g. by waitpid(-1).
+ *
+ * @param pid process id of the reaped child
+ * @param status status reported by wait4
+ * @param usage resources used by the process, as reported by wait4
+ *
+ * @return 1 if the process belonged to a job, else 0
+ */
+int jobs_reaped(pid_t pid, int status, const struct rusage* usage)
+{
+    for (Job* job = job_list; job != NULL; job = job->next) {
+        for (int i = 0; i < job->count; i++) {
+            if (job->processes[i].pid == pid && job->processes[i].running) {
+                jobs_record(job, &job->processes[i], status, usage);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reaps every background process which has finished, without blocking.
+ *
+ * Only the jobs reported ready by the event loop are examined, so the cost does not grow with
+ * the number of jobs still running.
+ */
+void jobs_update(void)
+{
+    struct epoll_event events[JOB_EVENTS];
+    int ready;
+
+    if (job_running == 0) {
+        return;
+    }
+
+    if (job_epoll == -1) {
+        for (Job* job = job_list; job != NULL; job = job->next) {
+            jobs_check(job, WNOHANG);
+        }
+        return;
+    }
+
+    do {
+        ready = epoll_wait(job_epoll, events, JOB_EVENTS, 0);
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr != NULL) {
+                jobs_check(events[i].data.ptr, WNOHANG);
+                continue;
+            }
+
+            /* SIGCHLD, only of interest for processes without a pidfd */
+            struct signalfd_siginfo info;
+            while (read(job_signal, &info, sizeof(info)) == sizeof(info));
+            for (Job* job = job_list; job != NULL && job_unwatched > 0; job = job->next) {
+                jobs_check(job, WNOHANG);
+            }
+        }
+    } while (ready == JOB_EVENTS || (ready == -1 && errno == EINTR));
+}
+
+/**
+ * @brief Finds a job from the argument of a built-in function.
+ *
+ * @param spec "%n" for job number n, otherwise the process id of any of its commands
+ *
+ * @return the job, or NULL if there is no such job
+ */
+Job* jobs_find(const char* spec)
+{
+    int id = (spec[0] == '%') ? atoi(spec + 1) : 0;
+    pid_t pid = (spec[0] == '%') ? 0 : (pid_t)atoi(spec);
+
+    for (Job* job = job_list; job != NULL; job = job->next) {
+        if (id > 0 && job->id == id) {
+            return job;
+        }
+        for (int i = 0; pid > 0 && i < job->count; i++) {
+            if (job->processes[i].pid == pid) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Waits for every process of a job to finish, then removes it from the table.
+ *
+ * With --job-output, also waits for the output of the job to be written (see mux_drain()).
+ *
+ * @param job job to wait for
+ *
+ * @return status of the job, as reported by waitpid
+ */
+int jobs_wait(Job* job)
+{
+    jobs_check(job, 0);
+    mux_drain(job->id);
+
+    int status = job->status;
+    jobs_remove(job);
+    return status;
+}
+
+/**
+ * @brief Waits for every job to finish.
+ */
+void jobs_wait_all(void)
+{
+    while (job_list != NULL) {
+        jobs_wait(job_list);
+    }
+}
+
+/**
+ * @brief Removes a job from the table. Processes still running are no longer tracked.
+ *
+ * @param job job to remove
+ */
+void jobs_remove(Job* job)
+{
+    Job* previous = NULL;
+
+    for (Job* temp = job_list; temp != NULL && temp != job; temp = temp->next) {
+        previous = temp;
+    }
+    if (previous != NULL) {
+        previous->next = job->next;
+    } else {
+        job_list = job->next;
+    }
+    if (job_last == job) {
+        job_last = previous;
+    }
+
+    for (int i = 0; i < job->count; i++) {
+        if (!job->processes[i].running) {
+            continue;
+        }
+        if (job->processes[i].pidfd != -1) {
+            close(job->processes[i].pidfd);
+        } else {
+            job_unwatched--;
+        }
+    }
+    if (job->running > 0) {
+        job_running--;
+    }
+
+    free(job->command);
+    free(job);
+}
+
+/**
+ * @brief Describes the state of a job, e.g. "Running", "Done" or "Exit 1".
+ *
+ * @param job job to describe
+ * @param buffer destination for the description
+ * @param size size of buffer
+ *
+ * @return buffer
+ */
+char* jobs_state(Job* job, char* buffer, size_t size)
+{
+    if (job->running > 0) {
+        snprintf(buffer, size, "Running");
+    } else if (WIFSIGNALED(job->status)) {
+        snprintf(buffer, size, "%s", strsignal(WTERMSIG(job->status)));
+    } else if (WEXITSTATUS(job->status) != 0) {
+        snprintf(buffer, size, "Exit %d", WEXITSTATUS(job->status));
+    } else {
+        snprintf(buffer, size, "Done");
+    }
+    return buffer;
+}
+
+/**
+ * @brief Writes one line per job to a buffered writer. Finished jobs are removed once listed.
+ *
+ * @param out writer
+ * @param finished_only only list the jobs which have finished
+ */
+void jobs_print(Output* out, int finished_only)
+{
+    char line[64];
+    char state[32];
+    Job* job = job_list;
+
+    jobs_update();
+
+    while (job != NULL) {
+        Job* next = job->next;
+
+        if (!finished_only || job->running == 0) {
+            if (job->running == 0) {
+                /* the output of the job comes before the report of its end */
+                mux_drain(job->id);
+            }
+            snprintf(line, sizeof(line), "[%d] %-24s ", job->id, jobs_state(job, state, sizeof(state)));
+            output_string(out, line);
+            output_string(out, job->command);
+            output_write(out, "\n", 1);
+            if (job->running == 0) {
+                jobs_remove(job);
+            }
+        }
+        job = next;
+    }
+}
+
+/**
+ * @brief Reports the jobs which have finished since the last prompt.
+ */
+void jobs_notify(void)
+{
+    Output out;
+
+    if (job_list == NULL) {
+        return;
+    }
+    output_init(&out, STDOUT_FILENO);
+    jobs_print(&out, 1);
+    output_flush(&out);
+}
+
+/**
+ * @brief Forgets every job and closes the event loop. Running processes are left running.
+ */
+void jobs_free(void)
+{
+    while (job_list != NULL) {
+        jobs_remove(job_list);
+    }
+
+    if (job_signal != -1) {
+        close(job_signal);
+        job_signal = -1;
+    }
+    if (job_epoll != -1) {
+        close(job_epoll);
+        job_epoll = -1;
+    }
+}
@@ -0,0 +1,692 @@
+/**
+ * @file memo.c
+ * @brief Memoization of deterministic commands, replaying their output from an on-disk store.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * Every entry is a file in the store named by the hash of its key. The key describes everything
+ * the output of the command is expected to depend on: the current directory, the arguments, the
+ * identity of the executable and of the input file, and a selection of environment variables.
+ * The key is stored within the entry and compared in full, so a hash collision is only a miss.
+ * The modification time of an entry is the time it was last used, the entries used least
+ * recently are removed once the store grows beyond its size limit.
+ */
+#include "seashell.h"
+
+/* totals for this session, reported by memo --stats */
+static long memo_hits = 0;
+static long memo_misses = 0;
+static long memo_stored = 0;
+static long memo_evicted = 0;
+
+/* bytes held by the store, -1 until it has been examined */
+static long long memo_total = -1;
+
+/**
+ * @brief Runs a command through the memo store, or reports on the store (memo --stats).
+ *
+ * Only a single external command can be memoized. Its input must come from a file or be given
+ * inline (a here-document or here-string), else it reads from /dev/null, so the key identifies
+ * all of it. The command is waited for, also in parallel mode.
+ *
+ * @param command first command of the pipeline, beginning with memo
+ * @param env list environment variables provided to program
+ */
+void do_memo(Command* command, char** env UNUSED)
+{
+    Pipeline rest;
+
+    if (command->args[1] != NULL && strcmp(command->args[1], "--stats") == 0) {
+        memo_stats(command);
+        return;
+    }
+
+    if (prefix_pipeline(command, 1, &rest) == -1) {
+        fprintf(stderr, "error - memo requires a command\n");
+        return;
+    }
+    if (rest.length != 1 || command->is_background || builtin_lookup(command->args[0]) != NULL) {
+        fprintf(stderr, "error - memo only applies to a single external command\n");
+        return;
+    }
+
+    memo_run(command);
+}
+
+/**
+ * @brief Replays the output of a command from the store, else runs it and stores its output.
+ *
+ * @param command command to run
+ */
+void memo_run(Command* command)
+{
+    int fds[3] = { -1, -1, -1 };
+    MemoBuffer key = { NULL, 0, 0, 0 };
+    char path[PATH_MAX];
+
+    /* open the redirections first, so errors are reported as for any other command */
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+
+    if (memo_key(&key, command, fds[0]) == -1 || memo_path(path, sizeof(path), &key) == -1) {
+        /* the command can still be run, just not memoized */
+        free(key.data);
+        close_redirections(fds);
+        do_execute(command);
+        return;
+    }
+
+    fflush(stdout);
+    int status = 0;
+    if (memo_replay(path, &key, fds, &status) == 0) {
+        memo_hits++;
+        #ifdef DEBUG
+        printf("debug: replayed %s\n", path);
+        #endif
+    } else {
+        memo_misses++;
+        memo_capture(command, path, &key, fds, &status);
+    }
+    parallel_record(status);
+
+    free(key.data);
+    close_redirections(fds);
+}
+
+/**
+ * @brief Builds the key describing a command.
+ *
+ * @param key buffer to build the key in
+ * @param command command being run
+ * @param stdin_fd descriptor of the redirected input, or -1 if there is none
+ *
+ * @return 0 on success, -1 if the command can not be described
+ */
+int memo_key(MemoBuffer* key, Command* command, int stdin_fd)
+{
+    static const char* variables[] = MEMO_ENVIRONMENT;
+    char cwd[PATH_MAX];
+    struct stat info;
+    char number[32];
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+    memo_append(key, "seashell memo 1", strlen("seashell memo 1") + 1);
+    memo_append(key, cwd, strlen(cwd) + 1);
+
+    snprintf(number, sizeof(number), "%d", command->argc);
+    memo_append(key, number, strlen(number) + 1);
+    for (char** temp = command->args; *temp != NULL; temp++) {
+        memo_append(key, *temp, strlen(*temp) + 1);
+    }
+
+    /* a rebuilt executable may produce different output */
+    const char* executable = *command->args;
+    if (strchr(executable, '/') == NULL) {
+        executable = path_lookup(executable);
+    }
+    if (executable == NULL || stat(executable, &info) == -1) {
+        return -1;
+    }
+    memo_identity(key, &info);
+
+    /* the input, identified by the file rather than its contents, unless given inline */
+    if (command->here_text != NULL) {
+        memo_append(key, "here", strlen("here") + 1);
+        memo_append(key, command->here_text, command->here_length);
+    } else if (stdin_fd != -1) {
+        if (fstat(stdin_fd, &info) == -1) {
+            return -1;
+        }
+        memo_identity(key, &info);
+    } else {
+        memo_append(key, "no input", strlen("no input") + 1);
+    }
+
+    /* variables affecting most programs, and those named by SEASHELL_MEMO_ENV */
+    for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]); i++) {
+        memo_variable(key, variables[i], strlen(variables[i]));
+    }
+    const char* names = getenv("SEASHELL_MEMO_ENV");
+    while (names != NULL && *names != '\0') {
+        size_t length = strcspn(names, ": ");
+        if (length > 0) {
+            memo_variable(key, names, length);
+        }
+        names += length + (names[length] != '\0');
+    }
+
+    return key->overflow ? -1 : 0;
+}
+
+/**
+ * @brief Adds the identity of a file (device, inode, size and modification time) to a key.
+ *
+ * @param key key being built
+ * @param info status of the file
+ */
+void memo_identity(MemoBuffer* key, const struct stat* info)
+{
+    char identity[128];
+
+    int length = snprintf(identity, sizeof(identity), "%llu:%llu:%lld:%lld.%09ld",
+                          (unsigned long long)info->st_dev, (unsigned long long)info->st_ino,
+                          (long long)info->st_size, (long long)info->st_mtim.tv_sec,
+                          info->st_mtim.tv_nsec);
+    memo_append(key, identity, (size_t)length + 1);
+}
+
+/**
+ * @brief Adds an environment variable to a key, noting when it is not set.
+ *
+ * @param key key being built
+ * @param name name of the variable, not necessarily terminated
+ * @param length length of the name
+ */
+void memo_variable(MemoBuffer* key, const char* name, size_t length)
+{
+    char buffer[MAX_BUFFER];
+
+    if (length >= sizeof(buffer)) {
+        return;
+    }
+    memcpy(buffer, name, length);
+    buffer[length] = '\0';
+
+    const char* value = getenv(buffer);
+    memo_append(key, buffer, length);
+    if (value != NULL) {
+        memo_append(key, "=", 1);
+        memo_append(key, value, strlen(value));
+    }
+    memo_append(key, "", 1);
+}
+
+/**
+ * @brief Appends data to a buffer, growing it as required.
+ *
+ * Once MEMO_CAPTURE_MAX bytes are exceeded the data is discarded and the buffer marked as
+ * overflowed.
+ *
+ * @param buffer buffer to append to
+ * @param data bytes to append
+ * @param length number of bytes
+ */
+void memo_append(MemoBuffer* buffer, const char* data, size_t length)
+{
+    if (buffer->overflow) {
+        return;
+    }
+    if (buffer->length + length > MEMO_CAPTURE_MAX) {
+        free(buffer->data);
+        buffer->data = NULL;
+        buffer->length = buffer->capacity = 0;
+        buffer->overflow = 1;
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char* grown = realloc(buffer->data, capacity);
+        if (grown == NULL) {
+            free(buffer->data);
+            buffer->data = NULL;
+            buffer->length = buffer->capacity = 0;
+            buffer->overflow = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+/**
+ * @brief Locates the store, creating it if necessary.
+ *
+ * The store is SEASHELL_MEMO if set, else seashell/memo within XDG_CACHE_HOME or ~/.cache.
+ *
+ * @return path of the store, or NULL if it could not be created
+ */
+const char* memo_directory(void)
+{
+    static char directory[PATH_MAX];
+    const char* base;
+
+    if (directory[0] != '\0') {
+        return directory;
+    }
+
+    if ((base = getenv("SEASHELL_MEMO")) != NULL && *base != '\0') {
+        snprintf(directory, sizeof(directory), "%s", base);
+    } else if ((base = getenv("XDG_CACHE_HOME")) != NULL && *base != '\0') {
+        snprintf(directory, sizeof(directory), "%s/seashell/memo", base);
+    } else if ((base = getenv("HOME")) != NULL && *base != '\0') {
+        snprintf(directory, sizeof(directory), "%s/.cache/seashell/memo", base);
+    } else {
+        fprintf(stderr, "error - unable to locate memo store, set SEASHELL_MEMO\n");
+        return NULL;
+    }
+
+    /* create every missing directory along the way */
+    for (char* slash = strchr(directory + 1, '/'); ; slash = strchr(slash + 1, '/')) {
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        int result = mkdir(directory, 0777);
+        if (slash != NULL) {
+            *slash = '/';
+        }
+        if (result == -1 && errno != EEXIST) {
+            perror("error - unable to create memo store");
+            directory[0] = '\0';
+            return NULL;
+        }
+        if (slash == NULL) {
+            break;
+        }
+    }
+
+    return directory;
+}
+
+/**
+ * @brief Determines the location of the entry for a key.
+ *
+ * @param path destination for the location
+ * @param size size of path
+ * @param key key of the entry
+ *
+ * @return 0 on success, -1 if there is no store
+ */
+int memo_path(char* path, size_t size, const MemoBuffer* key)
+{
+    const char* directory = memo_directory();
+    unsigned long long hash = 14695981039346656037ULL;
+
+    if (directory == NULL) {
+        return -1;
+    }
+
+    /* FNV-1a */
+    for (size_t i = 0; i < key->length; i++) {
+        hash ^= (unsigned char)key->data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    snprintf(path, size, "%s/%016llx", directory, hash);
+    return 0;
+}
+
+/**
+ * @brief Writes the output stored in an entry to the command's destinations.
+ *
+ * @param path location of the entry
+ * @param key key of the command, compared with the key of the entry
+ * @param fds descriptors opened by open_redirections()
+ * @param status destination for the stored exit status
+ *
+ * @return 0 if the output was replayed, -1 if there is no entry for the key
+ */
+int memo_replay(const char* path, const MemoBuffer* key, int fds[3], int* status)
+{
+    struct stat info;
+    Output out;
+
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(MemoHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    char* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    MemoHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MEMO_MAGIC, sizeof(header.magic)) != 0
+            || header.key_length != key->length
+            || sizeof(header) + header.key_length + header.out_length + header.err_length
+                != (size_t)info.st_size
+            || memcmp(data + sizeof(header), key->data, key->length) != 0) {
+        munmap(data, (size_t)info.st_size);
+        close(fd);
+        return -1;
+    }
+
+    /* the entry has been used, for eviction */
+    futimens(fd, NULL);
+    close(fd);
+
+    const char* stored = data + sizeof(header) + header.key_length;
+    output_init(&out, fds[1] != -1 ? fds[1] : STDOUT_FILENO);
+    output_write(&out, stored, header.out_length);
+    output_flush(&out);
+    output_init(&out, fds[2] != -1 ? fds[2] : STDERR_FILENO);
+    output_write(&out, stored + header.out_length, header.err_length);
+    output_flush(&out);
+
+    *status = header.status;
+    munmap(data, (size_t)info.st_size);
+    return 0;
+}
+
+/**
+ * @brief Runs a command, copying its output to its destinations as well as into the store.
+ *
+ * stdout and stderr are connected to pipes which are drained by the shell. The entry is only
+ * stored if the command exited normally and its output was no larger than MEMO_CAPTURE_MAX.
+ *
+ * @param command command to run
+ * @param path location of the entry
+ * @param key key of the command
+ * @param fds descriptors opened by open_redirections()
+ * @param status destination for the exit status
+ */
+void memo_capture(Command* command, const char* path, const MemoBuffer* key, int fds[3],
+                  int* status)
+{
+    MemoBuffer captured[2] = { { NULL, 0, 0, 0 }, { NULL, 0, 0, 0 } };
+    Output* out = malloc(2 * sizeof(Output));
+    int pipes[2][2] = { { -1, -1 }, { -1, -1 } };
+    int stdin_fd = fds[0];
+    char buffer[INPUT_BUFFER];
+
+    *status = -1;
+    if (out == NULL || pipe2(pipes[0], O_CLOEXEC) == -1 || pipe2(pipes[1], O_CLOEXEC) == -1) {
+        perror("error - unable to capture output");
+        for (int i = 0; i < 2; i++) {
+            if (pipes[i][0] != -1) {
+                close(pipes[i][0]);
+                close(pipes[i][1]);
+            }
+        }
+        free(out);
+        return;
+    }
+    if (stdin_fd == -1) {
+        stdin_fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+    }
+
+    /* the redirections have been opened already, the process is handed the descriptors */
+    char* files[3] = { command->file_stdin, command->file_stdout, command->file_stderr };
+    char* here = command->here_text;
+    command->file_stdin = command->file_stdout = command->file_stderr = NULL;
+    command->here_text = NULL;
+    command->fd_stdin = stdin_fd;
+    command->fd_stdout = pipes[0][1];
+    command->fd_stderr = pipes[1][1];
+
+    struct timespec start;
+    metrics_now(&start);
+    pid_t pid = spawn_process(command);
+
+    command->file_stdin = files[0];
+    command->file_stdout = files[1];
+    command->file_stderr = files[2];
+    command->here_text = here;
+    command->fd_stdin = command->fd_stdout = command->fd_stderr = -1;
+    close(pipes[0][1]);
+    close(pipes[1][1]);
+    if (stdin_fd != fds[0] && stdin_fd != -1) {
+        close(stdin_fd);
+    }
+
+    /* copy stdout and stderr until the process, and anything it started, closes them */
+    output_init(&out[0], fds[1] != -1 ? fds[1] : STDOUT_FILENO);
+    output_init(&out[1], fds[2] != -1 ? fds[2] : STDERR_FILENO);
+    struct pollfd streams[2] = { { pipes[0][0], POLLIN, 0 }, { pipes[1][0], POLLIN, 0 } };
+    int open_streams = 2;
+    while (pid > 0 && open_streams > 0) {
+        if (poll(streams, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("error - unable to capture output");
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (streams[i].fd == -1 || streams[i].revents == 0) {
+                continue;
+            }
+            ssize_t count = read(streams[i].fd, buffer, sizeof(buffer));
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                streams[i].fd = -1;
+                open_streams--;
+                continue;
+            }
+            output_write(&out[i], buffer, (size_t)count);
+            output_flush(&out[i]);
+            memo_append(&captured[i], buffer, (size_t)count);
+        }
+    }
+    close(pipes[0][0]);
+    close(pipes[1][0]);
+
+    if (pid > 0) {
+        struct rusage usage;
+        int result = 0;
+        pid_t wpid;
+        do {
+            wpid = wait4(pid, &result, 0, &usage);
+        } while (wpid == -1 && errno == EINTR);
+
+        if (wpid == pid) {
+            metrics_reaped(command->args[0], pid, &start, result, &usage);
+            *status = result;
+            if (WIFEXITED(result) && !captured[0].overflow && !captured[1].overflow) {
+                memo_store(path, key, captured, result);
+            }
+        }
+    }
+
+    free(captured[0].data);
+    free(captured[1].data);
+    free(out);
+}
+
+/**
+ * @brief Writes an entry to the store.
+ *
+ * The entry is written to a temporary file which is then renamed into place, so a concurrent
+ * shell never sees a partial entry.
+ *
+ * @param path location of the entry
+ * @param key key of the command
+ * @param captured stdout and stderr of the command
+ * @param status exit status of the command
+ */
+void memo_store(const char* path, const MemoBuffer* key, const MemoBuffer captured[2], int status)
+{
+    char temporary[PATH_MAX];
+    MemoHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MEMO_MAGIC, sizeof(header.magic));
+    header.key_length = key->length;
+    header.out_length = captured[0].length;
+    header.err_length = captured[1].length;
+    header.status = status;
+
+    size_t size = sizeof(header) + key->length + captured[0].length + captured[1].length;
+    long long limit = memo_limit();
+    if ((long long)size > limit) {
+        return;
+    }
+
+    snprintf(temporary, sizeof(temporary), "%s.XXXXXX", path);
+    int fd = mkostemp(temporary, O_CLOEXEC);
+    if (fd == -1) {
+        perror("error - unable to write memo store");
+        return;
+    }
+
+    struct iovec parts[4] = {
+        { &header, sizeof(header) },
+        { key->data, key->length },
+        { captured[0].data, captured[0].length },
+        { captured[1].data, captured[1].length },
+    };
+    ssize_t written = writev(fd, parts, 4);
+    close(fd);
+    if (written != (ssize_t)size || rename(temporary, path) == -1) {
+        if (written == -1) {
+            perror("error - unable to write memo store");
+        }
+        unlink(temporary);
+        return;
+    }
+    memo_stored++;
+
+    if (memo_total == -1) {
+        memo_evict(limit);
+    } else if ((memo_total += (long long)size) > limit) {
+        memo_evict(limit);
+    }
+}
+
+/**
+ * @brief Determines the size limit of the store, SEASHELL_MEMO_SIZE bytes if set.
+ *
+ * @return limit in bytes
+ */
+long long memo_limit(void)
+{
+    const char* value = getenv("SEASHELL_MEMO_SIZE");
+    char* end;
+
+    if (value != NULL && *value != '\0') {
+        long long limit = strtoll(value, &end, 10);
+        if (*end == '\0' && limit > 0) {
+            return limit;
+        }
+    }
+    return MEMO_SIZE;
+}
+
+/**
+ * @brief Totals the size of the store, removing the entries used least recently while it exceeds
+ * the limit.
+ *
+ * @param limit size limit in bytes
+ *
+ * @return number of entries remaining
+ */
+long memo_evict(long long limit)
+{
+    const char* directory = memo_directory();
+    MemoFile* files = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent* item;
+    struct stat info;
+
+    if (directory == NULL) {
+        return 0;
+    }
+    DIR* store = opendir(directory);
+    if (store == NULL) {
+        return 0;
+    }
+
+    memo_total = 0;
+    while ((item = readdir(store)) != NULL) {
+        /* entries are named by their hash, anything else (e.g. a temporary file) is skipped */
+        if (strlen(item->d_name) != 16 || strspn(item->d_name, "0123456789abcdef") != 16
+                || fstatat(dirfd(store), item->d_name, &info, AT_SYMLINK_NOFOLLOW) == -1) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            MemoFile* grown = realloc(files, capacity * sizeof(MemoFile));
+            if (grown == NULL) {
+                break;
+            }
+            files = grown;
+        }
+        memcpy(files[count].name, item->d_name, sizeof(files[count].name));
+        files[count].size = info.st_size;
+        files[count].used = info.st_mtim;
+        memo_total += info.st_size;
+        count++;
+    }
+
+    size_t remaining = count;
+    if (memo_total > limit) {
+        qsort(files, count, sizeof(MemoFile), memo_compare);
+        for (size_t i = 0; i < count && memo_total > limit; i++) {
+            if (unlinkat(dirfd(store), files[i].name, 0) == 0) {
+                memo_total -= files[i].size;
+                memo_evicted++;
+                remaining--;
+            }
+        }
+    }
+
+    closedir(store);
+    free(files);
+    return (long)remaining;
+}
+
+/**
+ * @brief Orders entries of the store for qsort(), the entry used least recently first.
+ */
+int memo_compare(const void* a, const void* b)
+{
+    const struct timespec* x = &((const MemoFile*)a)->used;
+    const struct timespec* y = &((const MemoFile*)b)->used;
+
+    if (x->tv_sec != y->tv_sec) {
+        return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/**
+ * @brief Prints the size of the store and the hits and misses of this session.
+ *
+ * @param command memo --stats, possibly redirected
+ */
+void memo_stats(Command* command)
+{
+    int fds[3] = { -1, -1, -1 };
+    char line[PATH_MAX + 64];
+    Output out;
+
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+    const char* directory = memo_directory();
+    long long limit = memo_limit();
+
+    /* count the entries, removing any beyond the limit */
+    long entries = memo_evict(limit);
+
+    output_init(&out, builtin_stdout(command, fds));
+    snprintf(line, sizeof(line), "store\t%s\n", directory != NULL ? directory : "(none)");
+    output_string(&out, line);
+    snprintf(line, sizeof(line), "entries\t%ld\nsize\t%lld bytes (limit %lld)\n", entries,
+             memo_total > 0 ? memo_total : 0, limit);
+    output_string(&out, line);
+    snprintf(line, sizeof(line), "hits\t%ld\nmisses\t%ld\nstored\t%ld\nevicted\t%ld\n",
+             memo_hits, memo_misses, memo_stored, memo_evicted);
+    output_string(&out, line);
+    output_flush(&out);
+
+    close_redirections(fds);
+}
@@ -0,0 +1,202 @@
+/**
+ * @file metrics.c
+ * @brief Resource accounting of child processes, for the time built-in and the metrics log.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/* log appended to for every command reaped, -1 when SEASHELL_METRICS is not set */
+static int metrics_fd = -1;
+
+/* measurement in progress by the time built-in, NULL when there is none */
+static Timing* metrics_timing = NULL;
+
+/**
+ * @brief Opens the log named by the SEASHELL_METRICS environment variable, if it is set.
+ */
+void metrics_setup(void)
+{
+    const char* path = getenv("SEASHELL_METRICS");
+
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+
+    metrics_fd = open(path, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0666);
+    if (metrics_fd == -1) {
+        perror("error - unable to open metrics log");
+    }
+}
+
+/**
+ * @brief Closes the metrics log.
+ */
+void metrics_close(void)
+{
+    if (metrics_fd != -1) {
+        close(metrics_fd);
+        metrics_fd = -1;
+    }
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @param time destination for the current time
+ */
+void metrics_now(struct timespec* time)
+{
+    clock_gettime(CLOCK_MONOTONIC, time);
+}
+
+/**
+ * @brief Converts a point in time to nanoseconds.
+ *
+ * @param time time to convert
+ *
+ * @return number of nanoseconds
+ */
+long long metrics_nanoseconds(const struct timespec* time)
+{
+    return (long long)time->tv_sec * 1000000000LL + time->tv_nsec;
+}
+
+/**
+ * @brief Converts a CPU time to microseconds.
+ *
+ * @param time time to convert
+ *
+ * @return number of microseconds
+ */
+long long metrics_microseconds(const struct timeval* time)
+{
+    return (long long)time->tv_sec * 1000000LL + time->tv_usec;
+}
+
+/**
+ * @brief Accounts for a child process which has been reaped.
+ *
+ * The usage is added to the measurement of the time built-in, if there is one in progress, and
+ * a line is appended to the metrics log, if it is enabled.
+ *
+ * @param name name of the command (argv[0])
+ * @param pid process id of the child
+ * @param start time the child was launched
+ * @param status status reported by wait4
+ * @param usage resources used by the child, as reported by wait4
+ */
+void metrics_reaped(const char* name, pid_t pid, const struct timespec* start, int status,
+                    const struct rusage* usage)
+{
+    if (metrics_timing != NULL) {
+        timeradd(&metrics_timing->utime, &usage->ru_utime, &metrics_timing->utime);
+        timeradd(&metrics_timing->stime, &usage->ru_stime, &metrics_timing->stime);
+        if (usage->ru_maxrss > metrics_timing->maxrss) {
+            metrics_timing->maxrss = usage->ru_maxrss;
+        }
+    }
+
+    if (metrics_fd == -1) {
+        return;
+    }
+
+    struct timespec end;
+    char escaped[METRICS_NAME_MAX * 6 + 1];
+    char line[sizeof(escaped) + 512];
+
+    metrics_now(&end);
+    metrics_escape(escaped, sizeof(escaped), name != NULL ? name : "");
+
+    int length = snprintf(line, sizeof(line),
+        "{\"argv0\":\"%s\",\"pid\":%d,\"status\":%d,\"signal\":%d,"
+        "\"start_ns\":%lld,\"end_ns\":%lld,\"wall_us\":%lld,\"user_us\":%lld,\"sys_us\":%lld,"
+        "\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}\n",
+        escaped, pid,
+        WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+        WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+        metrics_nanoseconds(start), metrics_nanoseconds(&end),
+        (metrics_nanoseconds(&end) - metrics_nanoseconds(start)) / 1000,
+        metrics_microseconds(&usage->ru_utime), metrics_microseconds(&usage->ru_stime),
+        usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt, usage->ru_nvcsw, usage->ru_nivcsw);
+
+    /* a single write, so lines from concurrent shells appending to the log are not interleaved */
+    if (length > 0 && write(metrics_fd, line, (size_t)length) == -1) {
+        perror("error - unable to write metrics log");
+        metrics_close();
+    }
+}
+
+/**
+ * @brief Escapes a string for inclusion in a JSON string, truncating it if it is too long.
+ *
+ * @param buffer destination, at least 6 times the length of the string plus one
+ * @param size size of buffer
+ * @param string string to escape
+ */
+void metrics_escape(char* buffer, size_t size, const char* string)
+{
+    size_t length = 0;
+
+    for (size_t i = 0; string[i] != '\0' && i < METRICS_NAME_MAX && length + 7 <= size; i++) {
+        unsigned char c = (unsigned char)string[i];
+        if (c == '"' || c == '\\') {
+            buffer[length++] = '\\';
+            buffer[length++] = (char)c;
+        } else if (c < 0x20) {
+            length += (size_t)snprintf(buffer + length, size - length, "\\u%04x", c);
+        } else {
+            buffer[length++] = (char)c;
+        }
+    }
+    buffer[length] = '\0';
+}
+
+/**
+ * @brief Starts measuring the time taken to evaluate a command.
+ *
+ * @param timing measurement to start
+ */
+void metrics_time_begin(Timing* timing)
+{
+    memset(timing, 0, sizeof(Timing));
+    getrusage(RUSAGE_SELF, &timing->self);
+    metrics_now(&timing->start);
+    metrics_timing = timing;
+}
+
+/**
+ * @brief Finishes a measurement and prints it to stderr.
+ *
+ * The user and system times include the time spent by the shell itself, so built-in functions
+ * are measured as well as child processes.
+ *
+ * @param timing measurement to finish
+ */
+void metrics_time_end(Timing* timing)
+{
+    struct timespec end;
+    struct rusage self;
+
+    metrics_now(&end);
+    getrusage(RUSAGE_SELF, &self);
+    metrics_timing = NULL;
+
+    timersub(&self.ru_utime, &timing->self.ru_utime, &self.ru_utime);
+    timersub(&self.ru_stime, &timing->self.ru_stime, &self.ru_stime);
+    timeradd(&timing->utime, &self.ru_utime, &timing->utime);
+    timeradd(&timing->stime, &self.ru_stime, &timing->stime);
+
+    long long wall = (metrics_nanoseconds(&end) - metrics_nanoseconds(&timing->start)) / 1000;
+    long long user = metrics_microseconds(&timing->utime);
+    long long sys = metrics_microseconds(&timing->stime);
+
+    fflush(stdout);
+    fprintf(stderr, "\nreal\t%lldm%lld.%03llds\nuser\t%lldm%lld.%03llds\nsys\t%lldm%lld.%03llds\n"
+            "maxrss\t%ld KB\n",
+            wall / 60000000, wall / 1000000 % 60, wall / 1000 % 1000,
+            user / 60000000, user / 1000000 % 60, user / 1000 % 1000,
+            sys / 60000000, sys / 1000000 % 60, sys / 1000 % 1000,
+            timing->maxrss);
+}
@@ -0,0 +1,510 @@
+/**
+ * @file mux.c
+ * @brief Output of background jobs, written a whole line at a time and labelled with the job.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * With --job-output, the stdout and stderr of every background job are pipes owned by the shell.
+ * A thread waits upon all of them with a single epoll loop, and writes each line it reads to the
+ * shell's own stdout or stderr, preceded by the job number, with a single writev so lines of
+ * different jobs are never mixed. Should SEASHELL_JOB_LOGS name a directory, the output is also
+ * written to a log per job, limited to SEASHELL_JOB_LOG_SIZE bytes.
+ *
+ * Each stream holds at most MUX_RING bytes, a longer line is written in pieces. A job writing
+ * faster than the terminal can take its output blocks on its own pipe, never the shell or other
+ * jobs, as the thread only ever reads as much as it has room for.
+ */
+#include "seashell.h"
+
+/* whether the output of background jobs is captured (--job-output) */
+int mux_enabled = 0;
+
+/* streams being read, linked and unlinked under mux_lock; only the thread reads or frees them */
+static MuxStream* mux_streams = NULL;
+static pthread_mutex_t mux_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mux_finished = PTHREAD_COND_INITIALIZER; /* signalled as streams close */
+
+/* the thread, its event loop and the eventfd which asks it to stop */
+static pthread_t mux_thread;
+static int mux_running = 0;
+static pid_t mux_owner = -1;
+static int mux_epoll = -1;
+static int mux_wake = -1;
+
+/**
+ * @brief Starts the thread writing the output of background jobs, unless already started.
+ *
+ * The thread blocks every signal, they remain for the shell to handle.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int mux_start(void)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    sigset_t all;
+    sigset_t previous;
+
+    if (mux_running) {
+        return 0;
+    }
+
+    mux_epoll = epoll_create1(EPOLL_CLOEXEC);
+    mux_wake = eventfd(0, EFD_CLOEXEC);
+    if (mux_epoll == -1 || mux_wake == -1
+            || epoll_ctl(mux_epoll, EPOLL_CTL_ADD, mux_wake, &event) == -1) {
+        perror("error - unable to capture job output");
+        goto failed;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    int error = pthread_create(&mux_thread, NULL, mux_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (error != 0) {
+        fprintf(stderr, "error - unable to capture job output: %s\n", strerror(error));
+        goto failed;
+    }
+
+    mux_running = 1;
+    mux_owner = getpid();
+    return 0;
+
+failed:
+    if (mux_epoll != -1) {
+        close(mux_epoll);
+    }
+    if (mux_wake != -1) {
+        close(mux_wake);
+    }
+    mux_epoll = mux_wake = -1;
+    /* don't try again for every job */
+    mux_enabled = 0;
+    return -1;
+}
+
+/**
+ * @brief Creates the pipes a background job writes its output to, when --job-output is given.
+ *
+ * @param pipes destination for the stdout pipe, then the stderr pipe, both close-on-exec
+ *
+ * @return 0 if the pipes were created, -1 if the job should write to the shell's output
+ */
+int mux_prepare(int pipes[2][2])
+{
+    if (!mux_enabled || mux_start() == -1) {
+        return -1;
+    }
+    if (pipe2(pipes[0], O_CLOEXEC) == -1) {
+        perror("error - unable to capture job output");
+        return -1;
+    }
+    if (pipe2(pipes[1], O_CLOEXEC) == -1) {
+        perror("error - unable to capture job output");
+        close(pipes[0][0]);
+        close(pipes[0][1]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands the pipes of a launched job to the thread, closing the shell's write ends.
+ *
+ * @param job job which writes to the pipes, or NULL if none was launched
+ * @param pipes pipes created by mux_prepare(), a write end already closed is -1
+ */
+void mux_attach(Job* job, int pipes[2][2])
+{
+    MuxLog* log = NULL;
+
+    for (int i = 0; i < 2; i++) {
+        if (pipes[i][1] != -1) {
+            close(pipes[i][1]);
+            pipes[i][1] = -1;
+        }
+    }
+    if (job == NULL) {
+        close(pipes[0][0]);
+        close(pipes[1][0]);
+        return;
+    }
+
+    log = mux_log_open();
+    for (int i = 0; i < 2; i++) {
+        MuxStream* stream = malloc(sizeof(MuxStream));
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = stream };
+
+        if (stream == NULL) {
+            perror("error - unable to capture job output");
+            close(pipes[i][0]);
+            mux_log_release(log);
+            continue;
+        }
+        stream->fd = pipes[i][0];
+        stream->target = (i == 0) ? STDOUT_FILENO : STDERR_FILENO;
+        stream->job = job->id;
+        stream->log = log;
+        stream->head = stream->length = stream->scanned = 0;
+
+        pthread_mutex_lock(&mux_lock);
+        stream->next = mux_streams;
+        mux_streams = stream;
+        pthread_mutex_unlock(&mux_lock);
+
+        /* the thread only learns of the stream once it is complete */
+        if (epoll_ctl(mux_epoll, EPOLL_CTL_ADD, stream->fd, &event) == -1) {
+            perror("error - unable to capture job output");
+            pthread_mutex_lock(&mux_lock);
+            mux_streams = stream->next;
+            pthread_mutex_unlock(&mux_lock);
+            close(stream->fd);
+            mux_log_release(log);
+            free(stream);
+        }
+    }
+
+    #ifdef DEBUG
+    printf("debug: output of job %d captured, log %d\n", job->id, log != NULL ? log->fd : -1);
+    #endif
+}
+
+/**
+ * @brief Opens the log of a job, job-PID-N.log within the directory SEASHELL_JOB_LOGS, if set.
+ *
+ * N counts the logs opened by the shell: job numbers are reused once jobs finish, and would have
+ * a later job replace the log of an earlier one. The log is limited to SEASHELL_JOB_LOG_SIZE
+ * bytes if set (a number optionally followed by K, M or G), else MUX_LOG_SIZE.
+ *
+ * @return the log, held for both streams of the job, or NULL if there is none
+ */
+MuxLog* mux_log_open(void)
+{
+    static unsigned long opened = 0;
+    const char* directory = getenv("SEASHELL_JOB_LOGS");
+    const char* size = getenv("SEASHELL_JOB_LOG_SIZE");
+    char path[PATH_MAX];
+    long long cap = MUX_LOG_SIZE;
+
+    if (directory == NULL || *directory == '\0') {
+        return NULL;
+    }
+    if (size != NULL && *size != '\0' && (placement_number(size, &cap) == -1 || cap <= 0)) {
+        fprintf(stderr, "error - invalid SEASHELL_JOB_LOG_SIZE %s\n", size);
+        cap = MUX_LOG_SIZE;
+    }
+
+    MuxLog* log = malloc(sizeof(MuxLog));
+    if (log == NULL) {
+        perror("error - unable to open job log");
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/job-%d-%lu.log", directory, (int)getpid(), ++opened);
+    log->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0644);
+    if (log->fd == -1) {
+        fprintf(stderr, "error - unable to open job log %s: %s\n", path, strerror(errno));
+        free(log);
+        return NULL;
+    }
+    log->references = 2;
+    log->written = 0;
+    log->cap = cap;
+    log->truncated = 0;
+    return log;
+}
+
+/**
+ * @brief Releases a stream's hold on a log, closing it once neither stream holds it.
+ *
+ * Only the thread releases a log once its streams have been handed over.
+ *
+ * @param log log to release, or NULL
+ */
+void mux_log_release(MuxLog* log)
+{
+    if (log != NULL && --log->references == 0) {
+        close(log->fd);
+        free(log);
+    }
+}
+
+/**
+ * @brief Body of the thread, reading every stream ready until asked to stop.
+ *
+ * Once asked to stop, whatever the streams hold or can be read without waiting is written, and
+ * every stream is closed.
+ *
+ * @param unused unused
+ *
+ * @return NULL
+ */
+void* mux_loop(void* unused UNUSED)
+{
+    struct epoll_event events[MUX_EVENTS];
+    int stopping = 0;
+
+    while (!stopping) {
+        int count = epoll_wait(mux_epoll, events, MUX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            MuxStream* stream = events[i].data.ptr;
+            if (stream == NULL) {
+                stopping = 1;
+            } else if (mux_read(stream) == 0) {
+                mux_close(stream);
+            }
+        }
+    }
+
+    while (mux_streams != NULL) {
+        MuxStream* stream = mux_streams;
+        fcntl(stream->fd, F_SETFL, fcntl(stream->fd, F_GETFL) | O_NONBLOCK);
+        while (mux_read(stream) > 0) {
+        }
+        if (stream->length > 0) {
+            mux_emit(stream, stream->length, 1);
+        }
+        mux_close(stream);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads what there is room for from a stream, then writes every complete line held.
+ *
+ * A line filling the whole ring, or left incomplete at the end of the stream, is written as it
+ * is, ended by a newline.
+ *
+ * @param stream stream to read
+ *
+ * @return 1 if anything was read, 0 at the end of the stream, -1 if nothing was available
+ */
+int mux_read(MuxStream* stream)
+{
+    struct iovec parts[2];
+    size_t tail = (stream->head + stream->length) % MUX_RING;
+    size_t room = MUX_RING - stream->length;
+    int count = 1;
+    ssize_t length;
+
+    parts[0].iov_base = stream->ring + tail;
+    parts[0].iov_len = room;
+    if (tail + room > MUX_RING) {
+        parts[0].iov_len = MUX_RING - tail;
+        parts[1].iov_base = stream->ring;
+        parts[1].iov_len = room - parts[0].iov_len;
+        count = 2;
+    }
+
+    do {
+        length = readv(stream->fd, parts, count);
+    } while (length == -1 && errno == EINTR);
+
+    if (length == -1 && errno == EAGAIN) {
+        return -1;
+    }
+    if (length <= 0) {
+        if (stream->length > 0) {
+            mux_emit(stream, stream->length, 1);
+        }
+        return 0;
+    }
+    stream->length += (size_t)length;
+    mux_lines(stream);
+    return 1;
+}
+
+/**
+ * @brief Writes every complete line a stream holds, or the whole ring should it hold no newline.
+ *
+ * @param stream stream to write from
+ */
+void mux_lines(MuxStream* stream)
+{
+    while (stream->scanned < stream->length) {
+        size_t at = (stream->head + stream->scanned) % MUX_RING;
+        size_t span = stream->length - stream->scanned;
+        if (span > MUX_RING - at) {
+            span = MUX_RING - at;
+        }
+        char* newline = memchr(stream->ring + at, '\n', span);
+        if (newline == NULL) {
+            stream->scanned += span;
+        } else {
+            mux_emit(stream, stream->scanned + (size_t)(newline - (stream->ring + at)) + 1, 0);
+        }
+    }
+    if (stream->length == MUX_RING) {
+        mux_emit(stream, MUX_RING, 1);
+    }
+}
+
+/**
+ * @brief Writes the bytes at the start of a stream's ring as a line, then discards them.
+ *
+ * The line is written to the shell's output preceded by the job number, and to the job's log
+ * as it is, each with a single writev.
+ *
+ * @param stream stream to write from
+ * @param length bytes to write, ending with a newline unless forced
+ * @param forced whether to add a newline
+ */
+void mux_emit(MuxStream* stream, size_t length, int forced)
+{
+    char prefix[24];
+    struct iovec parts[4];
+    int count = 1;
+    size_t first = MUX_RING - stream->head;
+
+    parts[0].iov_base = prefix;
+    parts[0].iov_len = (size_t)snprintf(prefix, sizeof(prefix), "[%d] ", stream->job);
+    parts[count].iov_base = stream->ring + stream->head;
+    parts[count++].iov_len = (length < first) ? length : first;
+    if (length > first) {
+        parts[count].iov_base = stream->ring;
+        parts[count++].iov_len = length - first;
+    }
+    if (forced) {
+        parts[count].iov_base = "\n";
+        parts[count++].iov_len = 1;
+    }
+    mux_writev(stream->target, parts, count);
+
+    MuxLog* log = stream->log;
+    if (log != NULL && !log->truncated) {
+        long long size = (long long)length + forced;
+        if (log->written + size <= log->cap) {
+            mux_writev(log->fd, parts + 1, count - 1);
+            log->written += size;
+        } else {
+            /* only whole lines are logged, the log ends with the first which doesn't fit */
+            static const char marker[] = "[log truncated]\n";
+            struct iovec part = { .iov_base = (void*)marker, .iov_len = sizeof(marker) - 1 };
+            mux_writev(log->fd, &part, 1);
+            log->truncated = 1;
+        }
+    }
+
+    stream->head = (stream->head + length) % MUX_RING;
+    stream->length -= length;
+    stream->scanned = 0;
+}
+
+/**
+ * @brief Writes the whole of several buffers, continuing after a partial write.
+ *
+ * Errors are ignored, there being nowhere left to report them.
+ *
+ * @param fd descriptor to write to
+ * @param parts buffers to write, adjusted as they are written
+ * @param count number of buffers
+ */
+void mux_writev(int fd, struct iovec* parts, int count)
+{
+    while (count > 0) {
+        ssize_t length = writev(fd, parts, count);
+        if (length == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (count > 0 && (size_t)length >= parts->iov_len) {
+            length -= (ssize_t)parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = (char*)parts->iov_base + length;
+            parts->iov_len -= (size_t)length;
+        }
+    }
+}
+
+/**
+ * @brief Closes a stream at its end, waking anything waiting for its job's output.
+ *
+ * @param stream stream to close
+ */
+void mux_close(MuxStream* stream)
+{
+    pthread_mutex_lock(&mux_lock);
+    MuxStream** link = &mux_streams;
+    while (*link != NULL && *link != stream) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = stream->next;
+    }
+    pthread_cond_broadcast(&mux_finished);
+    pthread_mutex_unlock(&mux_lock);
+
+    /* a child yet to execute may share the pipe, so closing would not remove it from the loop */
+    epoll_ctl(mux_epoll, EPOLL_CTL_DEL, stream->fd, NULL);
+    close(stream->fd);
+    mux_log_release(stream->log);
+    free(stream);
+}
+
+/**
+ * @brief Waits for the output of a finished job to be written, before it is reported.
+ *
+ * A process the job left running in the background may hold its output open, so the wait
+ * gives up after MUX_DRAIN milliseconds; its output is still written as it arrives.
+ *
+ * @param id number of the job
+ */
+void mux_drain(int id)
+{
+    struct timespec deadline;
+
+    if (!mux_running) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MUX_DRAIN / 1000;
+    deadline.tv_nsec += (MUX_DRAIN % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&mux_lock);
+    while (1) {
+        MuxStream* stream = mux_streams;
+        while (stream != NULL && stream->job != id) {
+            stream = stream->next;
+        }
+        if (stream == NULL || pthread_cond_timedwait(&mux_finished, &mux_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mux_lock);
+}
+
+/**
+ * @brief Stops the thread, once it has written what it can without waiting.
+ *
+ * Jobs still running lose any further output. Does nothing within a copy of the shell, to
+ * which the thread never belonged.
+ */
+void mux_stop(void)
+{
+    uint64_t one = 1;
+
+    if (!mux_running || getpid() != mux_owner) {
+        return;
+    }
+    if (write(mux_wake, &one, sizeof(one)) == (ssize_t)sizeof(one)) {
+        pthread_join(mux_thread, NULL);
+    }
+    close(mux_epoll);
+    close(mux_wake);
+    mux_epoll = mux_wake = -1;
+    mux_running = 0;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file output.c
+ * @brief Buffered output written directly to a file descriptor.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/**
+ * @brief Prepares a buffered writer for the given file descriptor.
+ *
+ * Anything pending on stdout is flushed first, so that output from the writer appears after it.
+ *
+ * @param out writer to initialise
+ * @param fd destination file descriptor
+ */
+void output_init(Output* out, int fd)
+{
+    fflush(stdout);
+    out->fd = fd;
+    out->length = 0;
+    out->failed = 0;
+}
+
+/**
+ * @brief Appends data to the writer, flushing to the file descriptor whenever the buffer fills.
+ *
+ * @param out writer
+ * @param data bytes to write
+ * @param length number of bytes to write
+ */
+void output_write(Output* out, const char* data, size_t length)
+{
+    while (length > 0) {
+        if (out->length == sizeof(out->buffer)) {
+            output_flush(out);
+        }
+        size_t chunk = sizeof(out->buffer) - out->length;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(out->buffer + out->length, data, chunk);
+        out->length += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+/**
+ * @brief Appends a string to the writer.
+ *
+ * @param out writer
+ * @param string NULL terminated string to write
+ */
+void output_string(Output* out, const char* string)
+{
+    output_write(out, string, strlen(string));
+}
+
+/**
+ * @brief Writes everything buffered so far to the file descriptor.
+ *
+ * Once a write has failed (e.g. the reading end of a pipe was closed) further output is
+ * discarded.
+ *
+ * @param out writer
+ */
+void output_flush(Output* out)
+{
+    size_t done = 0;
+
+    while (done < out->length && !out->failed) {
+        ssize_t written = write(out->fd, out->buffer + done, out->length - done);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EPIPE) {
+                perror("error - unable to write output");
+            }
+            out->failed = 1;
+            break;
+        }
+        done += (size_t)written;
+    }
+
+    out->length = 0;
+}
@@ -0,0 +1,634 @@
+/**
+ * @file parallel.c
+ * @brief Parallel batch execution, keeping several external commands running at once.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * Also the parallel built-in, which runs a command once for every line of its input. The output
+ * of each command is captured through a pipe: one command at a time (the owner) has its output
+ * written as it is produced, the output of the others is held back in memory until the owner
+ * has finished, so the output of different commands is never interleaved.
+ */
+#include "seashell.h"
+
+/* maximum number of commands running at once, 0 when parallel execution is disabled */
+int parallel_jobs = 0;
+
+/* processes launched in parallel which have not yet been reaped */
+static ParallelProcess* parallel_running = NULL;
+static int parallel_count = 0;
+
+/* totals reported once the batch has finished */
+static int parallel_commands = 0;
+static int parallel_failures = 0;
+
+/**
+ * @brief Enables parallel execution of external commands.
+ *
+ * @param jobs maximum number of commands running at once
+ */
+void parallel_setup(int jobs)
+{
+    parallel_running = calloc((size_t)jobs, sizeof(ParallelProcess));
+    if (parallel_running == NULL) {
+        perror("error - unable to enable parallel execution");
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+    parallel_jobs = jobs;
+}
+
+/**
+ * @brief Waits until fewer than the maximum number of commands are running.
+ */
+void parallel_reserve(void)
+{
+    while (parallel_count >= parallel_jobs) {
+        if (parallel_reap() == -1) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Records a process launched in parallel.
+ *
+ * @param command command which was launched
+ * @param pid process id of the launched command, or -1 if it could not be launched
+ * @param start time the command was launched
+ */
+void parallel_track(Command* command, pid_t pid, const struct timespec* start)
+{
+    parallel_commands++;
+    if (pid > 0) {
+        ParallelProcess* process = &parallel_running[parallel_count++];
+        process->pid = pid;
+        process->start = *start;
+        /* the command itself is released along with the rest of the line */
+        snprintf(process->name, sizeof(process->name), "%s", command->args[0]);
+    } else {
+        parallel_failures++;
+    }
+}
+
+/**
+ * @brief Counts a command which was waited for by a built-in function (e.g. memo) towards the
+ * totals for the batch.
+ *
+ * @param status exit status of the command, as reported by wait4
+ */
+void parallel_record(int status)
+{
+    if (parallel_jobs == 0) {
+        return;
+    }
+    parallel_commands++;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        parallel_failures++;
+    }
+}
+
+/**
+ * @brief Waits for any child process to finish.
+ *
+ * Children which were not launched in parallel (i.e. background commands) are recorded in the
+ * job table.
+ *
+ * @return pid of the reaped child, or -1 if there are no children left
+ */
+pid_t parallel_reap(void)
+{
+    struct rusage usage;
+    int status = 0;
+    pid_t pid;
+
+    do {
+        pid = wait4(-1, &status, 0, &usage);
+    } while (pid == -1 && errno == EINTR);
+
+    if (pid == -1) {
+        /* nothing left to wait for, forget anything which was missed */
+        parallel_count = 0;
+        return -1;
+    }
+
+    if (jobs_reaped(pid, status, &usage)) {
+        return pid;
+    }
+
+    for (int i = 0; i < parallel_count; i++) {
+        if (parallel_running[i].pid == pid) {
+            metrics_reaped(parallel_running[i].name, pid, &parallel_running[i].start, status, &usage);
+            parallel_running[i] = parallel_running[--parallel_count];
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                parallel_failures++;
+            }
+            #ifdef DEBUG
+            printf("debug: %d exited with %d\n", pid, status);
+            #endif
+            break;
+        }
+    }
+
+    return pid;
+}
+
+/**
+ * @brief Waits for every command launched in parallel to finish.
+ *
+ * Used as a barrier, so that commands after it only start once those before it have completed.
+ */
+void parallel_wait(void)
+{
+    while (parallel_count > 0) {
+        if (parallel_reap() == -1) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Waits for all outstanding commands and reports the totals for the batch.
+ *
+ * @return EXIT_SUCCESS if every command launched in parallel succeeded, else EXIT_FAILURE
+ */
+int parallel_finish(void)
+{
+    if (parallel_jobs == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    parallel_wait();
+    fflush(stdout);
+    fprintf(stderr, "seashell: %d commands, %d failed\n", parallel_commands, parallel_failures);
+
+    return parallel_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Runs a command once for every line of input, several at once.
+ *
+ * parallel [-j jobs] [-k] command ... reads items from stdin (or a < redirection), one per line,
+ * and runs the command for each with every {} within its arguments replaced by the item, or the
+ * item added as the last argument if there is no {}. At most jobs commands (by default, the
+ * number of processors) run at once. The output of each command is written as a whole, in the
+ * order the commands finish, or with -k in the order of the input. Commands read from
+ * /dev/null, and their errors are not held back. Failed items are reported as they finish, and
+ * the totals once every command has finished.
+ *
+ * Supports i/o redirection.
+ *
+ * @param command built-in function being executed
+ * @param env list environment variables provided to program
+ */
+void do_parallel(Command* command, char** env)
+{
+    ParallelRun run;
+    Command template;
+    Input in;
+    int fds[3] = { -1, -1, -1 };
+
+    memset(&run, 0, offsetof(ParallelRun, out));
+    run.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (run.jobs < 1) {
+        run.jobs = 1;
+    }
+    int skip = parallel_options(&run, command);
+    if (skip == -1) {
+        return;
+    }
+
+    /* the command to run is whatever follows the options */
+    template = *command;
+    template.args += skip;
+    template.argc -= skip;
+    template.next = NULL;
+    template.is_background = 0;
+    template.file_stdin = template.file_stdout = template.file_stderr = NULL;
+    template.here_delimiter = template.here_text = NULL;
+    template.here_length = 0;
+    if (template.args[0] == NULL) {
+        fprintf(stderr, "error - parallel requires a command\n");
+        return;
+    }
+    const Builtin* builtin = command_builtin(&template);
+    if (builtin != NULL && (builtin->flags & BUILTIN_PARENT)) {
+        fprintf(stderr, "error - parallel: %s can not be run in parallel\n", builtin->name);
+        return;
+    }
+
+    if (open_redirections(command, fds) == -1) {
+        return;
+    }
+    run.command = &template;
+    run.env = env;
+    run.errors = fds[2];
+    run.running = calloc((size_t)run.jobs, sizeof(ParallelItem*));
+    run.polled = calloc((size_t)run.jobs, sizeof(ParallelItem*));
+    run.polls = calloc((size_t)run.jobs, sizeof(struct pollfd));
+    run.buffer = malloc(COPY_BUFFER);
+    run.input = open("/dev/null", O_RDONLY|O_CLOEXEC);
+    if (run.running == NULL || run.polled == NULL || run.polls == NULL || run.buffer == NULL || run.input == -1
+            || input_open(&in, builtin_stdin(command, fds)) == -1) {
+        perror("error - parallel");
+        free(run.running);
+        free(run.polled);
+        free(run.polls);
+        free(run.buffer);
+        if (run.input != -1) {
+            close(run.input);
+        }
+        close_redirections(fds);
+        return;
+    }
+    output_init(&run.out, builtin_stdout(command, fds));
+
+    /* the shell, or a later parallel, carries on after the items read */
+    in.shared = 1;
+
+    /* keep jobs commands running until the input is exhausted */
+    char* line;
+    while ((line = input_line(&in)) != NULL) {
+        if (*line == '\0') {
+            continue;
+        }
+        while (run.count >= run.jobs) {
+            parallel_collect(&run);
+        }
+        parallel_launch(&run, line, run.items++);
+    }
+    while (run.count > 0) {
+        parallel_collect(&run);
+    }
+    output_flush(&run.out);
+
+    fprintf(stderr, "parallel: %lu items, %lu failed\n", run.items, run.failed);
+
+    /* the descriptor belongs to the redirection, or is the shell's own stdin */
+    in.fd = -1;
+    input_close(&in);
+    close(run.input);
+    free(run.running);
+    free(run.polled);
+    free(run.polls);
+    free(run.buffer);
+    close_redirections(fds);
+}
+
+/**
+ * @brief Parses the options of the parallel built-in.
+ *
+ * @param run state to record the options in
+ * @param command built-in function being executed
+ *
+ * @return number of arguments taken by the built-in and its options, or -1 if they are invalid
+ */
+int parallel_options(ParallelRun* run, Command* command)
+{
+    int i = 1;
+
+    for (; command->args[i] != NULL && command->args[i][0] == '-'; i++) {
+        char* option = command->args[i];
+
+        if (strcmp(option, "--") == 0) {
+            return i + 1;
+        } else if (strcmp(option, "-k") == 0) {
+            run->ordered = 1;
+        } else if (strncmp(option, "-j", 2) == 0) {
+            /* the number of jobs may be attached, -j4, or follow, -j 4 */
+            char* value = (option[2] != '\0') ? option + 2 : command->args[++i];
+            char* end = NULL;
+            long jobs = (value != NULL) ? strtol(value, &end, 10) : 0;
+            if (end == value || *end != '\0' || jobs < 1 || jobs > INT_MAX) {
+                fprintf(stderr, "error - parallel: invalid number of jobs %s\n",
+                        value != NULL ? value : "");
+                return -1;
+            }
+            run->jobs = (int)jobs;
+        } else {
+            fprintf(stderr, "error - parallel: unknown option %s\n"
+                            "usage: parallel [-j jobs] [-k] command ...\n", option);
+            return -1;
+        }
+    }
+    return i;
+}
+
+/**
+ * @brief Launches the command for an item, capturing its output.
+ *
+ * External commands are launched through spawn_process(), so the PATH hash table and the spawn
+ * helper are used as for any other command; built-in functions run within a forked copy of the
+ * shell.
+ *
+ * @param run state of the built-in
+ * @param line the item
+ * @param index position of the item within the input
+ */
+void parallel_launch(ParallelRun* run, const char* line, unsigned long index)
+{
+    int pipes[2] = { -1, -1 };
+    ParallelItem* item = calloc(1, sizeof(ParallelItem));
+
+    if (item == NULL || (item->item = strdup(line)) == NULL) {
+        perror("error - parallel");
+        free(item);
+        run->failed++;
+        return;
+    }
+    item->index = index;
+    item->pid = -1;
+    item->output = -1;
+
+    Command launch = *run->command;
+    launch.args = parallel_arguments(run->command, line);
+    if (launch.args == NULL || pipe2(pipes, O_CLOEXEC) == -1) {
+        perror("error - parallel");
+    } else {
+        for (launch.argc = 0; launch.args[launch.argc] != NULL; launch.argc++);
+        launch.capacity = launch.argc + 1;
+        launch.fd_stdin = run->input;
+        launch.fd_stdout = pipes[1];
+        launch.fd_stderr = run->errors;
+
+        fflush(stdout);
+        metrics_now(&item->start);
+        if (command_builtin(&launch) != NULL) {
+            item->pid = fork_builtin(&launch, NULL, run->env);
+        } else {
+            item->pid = spawn_process(&launch);
+        }
+        close(pipes[1]);
+    }
+    free(launch.args);
+
+    #ifdef DEBUG
+    printf("debug: parallel item %lu (%s) is %d\n", index, line, item->pid);
+    #endif
+
+    if (item->pid <= 0) {
+        if (pipes[0] != -1) {
+            close(pipes[0]);
+        }
+        parallel_done(run, item);
+        return;
+    }
+    item->output = pipes[0];
+    run->running[run->count++] = item;
+
+    /* with -k, the item may be the one whose output is written next */
+    parallel_advance(run);
+}
+
+/**
+ * @brief Builds the arguments of the command for an item.
+ *
+ * Every {} within the arguments is replaced by the item, if there are none the item is added as
+ * the last argument.
+ *
+ * @param command command to run for every item
+ * @param line the item
+ *
+ * @return NULL terminated argument list, released with free() along with its strings, or NULL
+ *         if out of memory
+ */
+char** parallel_arguments(Command* command, const char* line)
+{
+    size_t item = strlen(line);
+    size_t size = 0;
+    int found = 0;
+
+    /* measure, then copy */
+    for (char** temp = command->args; *temp != NULL; temp++) {
+        size += strlen(*temp) + 1;
+        for (char* c = strstr(*temp, "{}"); c != NULL; c = strstr(c + 2, "{}")) {
+            size += item - 2;
+            found++;
+        }
+    }
+    if (found == 0) {
+        size += item + 1;
+    }
+
+    size_t count = (size_t)command->argc + (found == 0) + 1;
+    char** args = malloc(count * sizeof(char*) + size);
+    if (args == NULL) {
+        return NULL;
+    }
+
+    char* end = (char*)(args + count);
+    int i = 0;
+    for (char** temp = command->args; *temp != NULL; temp++) {
+        args[i++] = end;
+        char* from = *temp;
+        for (char* c = strstr(from, "{}"); c != NULL; c = strstr(from, "{}")) {
+            memcpy(end, from, (size_t)(c - from));
+            end += c - from;
+            memcpy(end, line, item);
+            end += item;
+            from = c + 2;
+        }
+        end = stpcpy(end, from) + 1;
+    }
+    if (found == 0) {
+        args[i++] = end;
+        memcpy(end, line, item + 1);
+    }
+    args[i] = NULL;
+
+    return args;
+}
+
+/**
+ * @brief Waits for output from any running command, and handles every command which finishes.
+ *
+ * @param run state of the built-in
+ */
+void parallel_collect(ParallelRun* run)
+{
+    int count = run->count;
+
+    /* the running list changes as commands finish, work from a copy */
+    for (int i = 0; i < count; i++) {
+        run->polled[i] = run->running[i];
+        run->polls[i].fd = run->running[i]->output;
+        run->polls[i].events = POLLIN;
+        run->polls[i].revents = 0;
+    }
+
+    if (poll(run->polls, (nfds_t)count, -1) == -1) {
+        if (errno != EINTR) {
+            perror("error - parallel");
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (run->polls[i].revents == 0) {
+            continue;
+        }
+        ParallelItem* item = run->polled[i];
+        ssize_t length = read(item->output, run->buffer, COPY_BUFFER);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (length > 0) {
+            /* the first to produce output while nothing is written has it written directly */
+            if (run->owner == NULL && !run->ordered) {
+                parallel_claim(run, item);
+            }
+            if (run->owner == item) {
+                output_write(&run->out, run->buffer, (size_t)length);
+                output_flush(&run->out);
+            } else {
+                parallel_hold(item, run->buffer, (size_t)length);
+            }
+            continue;
+        }
+
+        /* the command, and anything it started, has closed its output */
+        close(item->output);
+        item->output = -1;
+
+        struct rusage usage;
+        pid_t pid;
+        do {
+            pid = wait4(item->pid, &item->status, 0, &usage);
+        } while (pid == -1 && errno == EINTR);
+        if (pid == item->pid) {
+            metrics_reaped(run->command->args[0], pid, &item->start, item->status, &usage);
+        }
+
+        for (int j = 0; j < run->count; j++) {
+            if (run->running[j] == item) {
+                run->running[j] = run->running[--run->count];
+                break;
+            }
+        }
+        parallel_done(run, item);
+    }
+}
+
+/**
+ * @brief Holds back output of a command while another command's output is being written.
+ *
+ * @param item item the output belongs to
+ * @param data bytes of output
+ * @param length number of bytes
+ */
+void parallel_hold(ParallelItem* item, const char* data, size_t length)
+{
+    if (item->length + length > item->capacity) {
+        size_t capacity = item->capacity ? item->capacity : PARALLEL_CAPTURE;
+        while (capacity < item->length + length) {
+            capacity *= 2;
+        }
+        char* grown = realloc(item->data, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "error - parallel: %s: output discarded, out of memory\n", item->item);
+            return;
+        }
+        item->data = grown;
+        item->capacity = capacity;
+    }
+    memcpy(item->data + item->length, data, length);
+    item->length += length;
+}
+
+/**
+ * @brief Records a command which has finished, and writes its output if it is its turn.
+ *
+ * @param run state of the built-in
+ * @param item item whose command has finished, or could not be launched
+ */
+void parallel_done(ParallelRun* run, ParallelItem* item)
+{
+    if (item->pid <= 0) {
+        run->failed++;
+    } else if (WIFSIGNALED(item->status)) {
+        run->failed++;
+        fprintf(stderr, "error - parallel: %s: %s\n", item->item, strsignal(WTERMSIG(item->status)));
+    } else if (WEXITSTATUS(item->status) != 0) {
+        run->failed++;
+        fprintf(stderr, "error - parallel: %s: exit status %d\n", item->item,
+                WEXITSTATUS(item->status));
+    }
+
+    parallel_record(item->pid > 0 ? item->status : -1);
+
+    if (run->owner == item) {
+        run->owner = NULL;
+        run->next++;
+        parallel_release(item);
+        parallel_advance(run);
+        return;
+    }
+
+    /* with -k the held back output is kept in the order of the input, else of finishing */
+    ParallelItem** link = &run->finished;
+    while (*link != NULL && (!run->ordered || (*link)->index < item->index)) {
+        link = &(*link)->next;
+    }
+    item->next = *link;
+    *link = item;
+    parallel_advance(run);
+}
+
+/**
+ * @brief Has an item's output written as it is produced, after what was held back.
+ *
+ * @param run state of the built-in
+ * @param item running item
+ */
+void parallel_claim(ParallelRun* run, ParallelItem* item)
+{
+    output_write(&run->out, item->data, item->length);
+    output_flush(&run->out);
+    free(item->data);
+    item->data = NULL;
+    item->length = item->capacity = 0;
+    run->owner = item;
+}
+
+/**
+ * @brief Writes the held back output of finished items for as long as nothing else is being
+ * written, and with -k passes the output on to the item next in order.
+ *
+ * @param run state of the built-in
+ */
+void parallel_advance(ParallelRun* run)
+{
+    while (run->owner == NULL && run->finished != NULL
+            && (!run->ordered || run->finished->index == run->next)) {
+        ParallelItem* item = run->finished;
+        run->finished = item->next;
+        output_write(&run->out, item->data, item->length);
+        run->next++;
+        parallel_release(item);
+    }
+    output_flush(&run->out);
+
+    if (run->owner != NULL || !run->ordered) {
+        return;
+    }
+    for (int i = 0; i < run->count; i++) {
+        if (run->running[i]->index == run->next) {
+            parallel_claim(run, run->running[i]);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Releases an item once its output has been written.
+ *
+ * @param item item to release
+ */
+void parallel_release(ParallelItem* item)
+{
+    free(item->item);
+    free(item->data);
+    free(item);
+}
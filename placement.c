@@ -0,0 +1,456 @@
+/**
+ * @file placement.c
+ * @brief Processor affinity, niceness and resource limits of commands (pin, nice and limit).
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * The prefixes record their settings on the commands which follow them, rather than executing
+ * taskset, nice or prlimit, so no extra program is executed. The settings are applied by the
+ * process itself, after restore_signals() and before the command is executed. posix_spawn has
+ * no way to apply them, so such commands are launched through the spawn helper when there is
+ * one (-z), else by fork. Built-in functions are likewise run in a forked copy of the shell, see
+ * fork_builtin(), as applying the settings to the shell would outlast the command.
+ */
+#include "seashell.h"
+
+/* resources which can be limited, by the names prlimit uses */
+static const struct {
+    const char* name;
+    int resource;
+} placement_resources[] = {
+    { "as", RLIMIT_AS },
+    { "core", RLIMIT_CORE },
+    { "cpu", RLIMIT_CPU },
+    { "data", RLIMIT_DATA },
+    { "fsize", RLIMIT_FSIZE },
+    { "locks", RLIMIT_LOCKS },
+    { "memlock", RLIMIT_MEMLOCK },
+    { "msgqueue", RLIMIT_MSGQUEUE },
+    { "nice", RLIMIT_NICE },
+    { "nofile", RLIMIT_NOFILE },
+    { "nproc", RLIMIT_NPROC },
+    { "rss", RLIMIT_RSS },
+    { "rtprio", RLIMIT_RTPRIO },
+    { "rttime", RLIMIT_RTTIME },
+    { "sigpending", RLIMIT_SIGPENDING },
+    { "stack", RLIMIT_STACK },
+};
+
+/* launches made with a round-robin placement, the next of its cpus to use */
+static unsigned long placement_turn = 0;
+
+/**
+ * @brief Runs the rest of the line on the given processors.
+ *
+ * pin [-r] cpus command ... where cpus is a list such as 0-3,8 or node:N for the processors of a
+ * NUMA node. With -r every command launched runs on a single one of the cpus, the next in turn,
+ * which spreads background and parallel (-j) commands evenly; without a list all the processors
+ * available to the shell are used in turn.
+ *
+ * @param command first command of the pipeline, beginning with pin
+ * @param env list environment variables provided to program
+ */
+void do_pin(Command* command, char** env)
+{
+    cpu_set_t allowed;
+    int count = 1;
+
+    Placement* placement = placement_get(command);
+    if (placement == NULL) {
+        return;
+    }
+    if (command->args[count] != NULL && strcmp(command->args[count], "-r") == 0) {
+        placement->round_robin = 1;
+        count++;
+    }
+
+    char* cpus = command->args[count];
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) {
+        perror("error - pin");
+        return;
+    }
+    if (cpus != NULL && (strncmp(cpus, "node:", 5) == 0 || strspn(cpus, "0123456789,-") == strlen(cpus))) {
+        if (placement_cpus(cpus, &placement->cpus) == -1) {
+            return;
+        }
+        count++;
+    } else if (placement->round_robin) {
+        placement->cpus = allowed;
+    } else {
+        fprintf(stderr, "error - pin requires a list of cpus\n"
+                        "usage: pin [-r] cpus command ...\n");
+        return;
+    }
+
+    /* only the processors the shell may use itself, so round-robin never picks another */
+    CPU_AND(&placement->cpus, &placement->cpus, &allowed);
+    if (CPU_COUNT(&placement->cpus) == 0) {
+        fprintf(stderr, "error - pin: none of the cpus %s are available\n", cpus);
+        return;
+    }
+    placement->has_cpus = 1;
+
+    placement_prefix(command, count, env);
+}
+
+/**
+ * @brief Runs the rest of the line with its niceness adjusted.
+ *
+ * nice [-n] [adjustment] command ... adds the adjustment (10 if none is given) to the niceness of
+ * the shell. Lowering the niceness below that of the shell requires privilege.
+ *
+ * @param command first command of the pipeline, beginning with nice
+ * @param env list environment variables provided to program
+ */
+void do_nice(Command* command, char** env)
+{
+    long adjustment = PLACEMENT_NICE;
+    int count = 1;
+    char* end = NULL;
+
+    Placement* placement = placement_get(command);
+    if (placement == NULL) {
+        return;
+    }
+
+    char* value = command->args[1];
+    if (value != NULL && strcmp(value, "-n") == 0) {
+        value = command->args[2];
+        adjustment = (value != NULL) ? strtol(value, &end, 10) : 0;
+        if (end == value || *end != '\0') {
+            fprintf(stderr, "error - nice: invalid adjustment %s\n", value != NULL ? value : "");
+            return;
+        }
+        count = 3;
+    } else if (value != NULL) {
+        long number = strtol(value, &end, 10);
+        if (end != value && *end == '\0') {
+            adjustment = number;
+            count = 2;
+        }
+    }
+
+    /* nested adjustments add up, as they do when nice executes nice */
+    placement->nice = (int)(placement->has_nice ? placement->nice + adjustment : adjustment);
+    placement->has_nice = 1;
+
+    placement_prefix(command, count, env);
+}
+
+/**
+ * @brief Runs the rest of the line with resources limited.
+ *
+ * limit resource=value ... command ... sets both the soft and hard limit to the value, or with
+ * resource=soft:hard each separately. Values may be followed by K, M, G or T, or be unlimited.
+ *
+ * @param command first command of the pipeline, beginning with limit
+ * @param env list environment variables provided to program
+ */
+void do_limit(Command* command, char** env)
+{
+    int count = 1;
+
+    Placement* placement = placement_get(command);
+    if (placement == NULL) {
+        return;
+    }
+
+    for (; command->args[count] != NULL && strchr(command->args[count], '=') != NULL; count++) {
+        if (placement_limit(placement, command->args[count]) == -1) {
+            return;
+        }
+    }
+    if (count == 1) {
+        fprintf(stderr, "error - limit requires a resource\n"
+                        "usage: limit resource=value ... command ...\n");
+        return;
+    }
+
+    placement_prefix(command, count, env);
+}
+
+/**
+ * @brief Returns the placement of a command, creating it if necessary.
+ *
+ * @param command command to examine
+ *
+ * @return the placement, allocated from the line's arena, or NULL if out of memory
+ */
+Placement* placement_get(Command* command)
+{
+    if (command->placement == NULL) {
+        command->placement = arena_alloc(&line_arena, sizeof(Placement));
+        if (command->placement == NULL) {
+            perror("error - unable to record placement");
+            return NULL;
+        }
+        memset(command->placement, 0, sizeof(Placement));
+    }
+    return command->placement;
+}
+
+/**
+ * @brief Evaluates the pipeline following a prefix, with the placement given to every stage.
+ *
+ * @param command first command of the pipeline, beginning with the prefix
+ * @param count number of arguments taken by the prefix, including its name
+ * @param env list environment variables provided to program
+ */
+void placement_prefix(Command* command, int count, char** env)
+{
+    const char* name = command->args[0];
+    Pipeline rest;
+
+    if (prefix_pipeline(command, count, &rest) == -1) {
+        fprintf(stderr, "error - %s requires a command\n", name);
+        return;
+    }
+    for (Command* temp = rest.first->next; temp != NULL; temp = temp->next) {
+        temp->placement = command->placement;
+    }
+
+    evaluate_args(&rest, env);
+}
+
+/**
+ * @brief Parses a list of processors, e.g. 0-3,8, or node:N for those of a NUMA node.
+ *
+ * @param list list to parse
+ * @param cpus destination for the processors
+ *
+ * @return 0 on success, -1 if the list is invalid
+ */
+int placement_cpus(const char* list, cpu_set_t* cpus)
+{
+    char path[PATH_MAX];
+    char nodes[MAX_BUFFER];
+
+    /* the kernel lists the processors of a node in the same form */
+    if (strncmp(list, "node:", 5) == 0) {
+        const char* node = list + 5;
+        if (*node == '\0' || strspn(node, "0123456789") != strlen(node)) {
+            fprintf(stderr, "error - pin: invalid node %s\n", node);
+            return -1;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%s/cpulist", node);
+        int fd = open(path, O_RDONLY|O_CLOEXEC);
+        ssize_t length = (fd != -1) ? read(fd, nodes, sizeof(nodes) - 1) : -1;
+        if (fd != -1) {
+            close(fd);
+        }
+        if (length <= 0) {
+            fprintf(stderr, "error - pin: no such node %s\n", node);
+            return -1;
+        }
+        nodes[length] = '\0';
+        nodes[strcspn(nodes, "\n")] = '\0';
+        list = nodes;
+    }
+
+    CPU_ZERO(cpus);
+    for (const char* c = list; *c != '\0'; ) {
+        char* end;
+        unsigned long first = strtoul(c, &end, 10);
+        unsigned long last = first;
+        if (end == c) {
+            break;
+        }
+        if (*end == '-') {
+            c = end + 1;
+            last = strtoul(c, &end, 10);
+            if (end == c) {
+                break;
+            }
+        }
+        if (first > last || last >= CPU_SETSIZE) {
+            break;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*end == '\0') {
+            return 0;
+        }
+        if (*end != ',') {
+            break;
+        }
+        c = end + 1;
+    }
+
+    fprintf(stderr, "error - pin: invalid list of cpus %s\n", list);
+    return -1;
+}
+
+/**
+ * @brief Parses the value of a resource limit, a number optionally followed by K, M, G or T
+ * (powers of 1024), or unlimited.
+ *
+ * @param text value to parse
+ * @param value destination for the value
+ *
+ * @return 0 on success, -1 if the value is invalid
+ */
+int placement_number(const char* text, long long* value)
+{
+    static const char suffixes[] = "KMGT";
+    char* end;
+
+    if (strcmp(text, "unlimited") == 0 || strcmp(text, "infinity") == 0) {
+        *value = (long long)RLIM_INFINITY;
+        return 0;
+    }
+    if (*text < '0' || *text > '9') {
+        return -1;
+    }
+
+    errno = 0;
+    *value = strtoll(text, &end, 10);
+    if (errno != 0) {
+        return -1;
+    }
+    if (*end != '\0') {
+        const char* suffix = strchr(suffixes, toupper((unsigned char)*end));
+        if (suffix == NULL || end[1] != '\0') {
+            return -1;
+        }
+        for (const char* c = suffixes; c <= suffix; c++) {
+            if (*value > LLONG_MAX / 1024) {
+                return -1;
+            }
+            *value *= 1024;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds a resource limit, resource=value or resource=soft:hard, to a placement.
+ *
+ * @param placement placement to add the limit to
+ * @param text limit to parse
+ *
+ * @return 0 on success, -1 if the limit is invalid
+ */
+int placement_limit(Placement* placement, const char* text)
+{
+    char name[MAX_BUFFER];
+    char soft[MAX_BUFFER];
+    long long values[2];
+    int resource = -1;
+
+    size_t length = strcspn(text, "=");
+    if (length >= sizeof(name) || strlen(text + length + 1) >= sizeof(soft)) {
+        fprintf(stderr, "error - limit: invalid limit %s\n", text);
+        return -1;
+    }
+    memcpy(name, text, length);
+    name[length] = '\0';
+    for (size_t i = 0; i < sizeof(placement_resources) / sizeof(placement_resources[0]); i++) {
+        if (strcmp(placement_resources[i].name, name) == 0) {
+            resource = placement_resources[i].resource;
+            break;
+        }
+    }
+    if (resource == -1) {
+        fprintf(stderr, "error - limit: unknown resource %s\n", name);
+        return -1;
+    }
+
+    /* a single value sets both limits, as prlimit does */
+    strcpy(soft, text + length + 1);
+    char* hard = strchr(soft, ':');
+    if (hard != NULL) {
+        *hard++ = '\0';
+    }
+    if (placement_number(soft, &values[0]) == -1
+            || placement_number(hard != NULL ? hard : soft, &values[1]) == -1) {
+        fprintf(stderr, "error - limit: invalid value %s\n", text + length + 1);
+        return -1;
+    }
+
+    int i = 0;
+    while (i < placement->limit_count && placement->resources[i] != resource) {
+        i++;
+    }
+    if (i == PLACEMENT_LIMITS) {
+        fprintf(stderr, "error - limit: too many limits\n");
+        return -1;
+    }
+    placement->resources[i] = resource;
+    placement->limits[i].rlim_cur = (rlim_t)values[0];
+    placement->limits[i].rlim_max = (rlim_t)values[1];
+    if (i == placement->limit_count) {
+        placement->limit_count++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Works out the settings of a single launch from a command's placement.
+ *
+ * With round-robin the next processor is chosen, and the niceness is made absolute from that of
+ * the shell.
+ *
+ * @param placement placement of the command, or NULL
+ * @param launch destination for the settings
+ *
+ * @return launch, or NULL if the command has no placement
+ */
+const Placement* placement_launch(const Placement* placement, Placement* launch)
+{
+    if (placement == NULL) {
+        return NULL;
+    }
+    *launch = *placement;
+
+    if (placement->has_cpus && placement->round_robin) {
+        int skip = (int)(placement_turn++ % (unsigned long)CPU_COUNT(&placement->cpus));
+        CPU_ZERO(&launch->cpus);
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &placement->cpus) && skip-- == 0) {
+                CPU_SET(cpu, &launch->cpus);
+                break;
+            }
+        }
+    }
+
+    if (placement->has_nice) {
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0) {
+            nice = 0;
+        }
+        nice += placement->nice;
+        launch->nice = (nice < -20) ? -20 : (nice > 19) ? 19 : nice;
+    }
+
+    #ifdef DEBUG
+    printf("debug: placement of %d cpus, nice %d, %d limits\n", CPU_COUNT(&launch->cpus),
+           launch->nice, launch->limit_count);
+    #endif
+    return launch;
+}
+
+/**
+ * @brief Applies the settings of a launch to the calling process, about to execute the command.
+ *
+ * @param placement settings from placement_launch()
+ *
+ * @return 0 on success, -1 on failure (with errno set)
+ */
+int placement_apply(const Placement* placement)
+{
+    if (placement->has_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1) {
+        return -1;
+    }
+    if (placement->has_nice && setpriority(PRIO_PROCESS, 0, placement->nice) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < placement->limit_count; i++) {
+        if (setrlimit(placement->resources[i], &placement->limits[i]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
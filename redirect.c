@@ -0,0 +1,117 @@
+/**
+ * @file redirect.c
+ * @brief Cache of files opened for appending, shared by every command redirected to them.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/* files held open for appending, keyed by the path as written */
+static RedirectEntry redirect_cache[REDIRECT_CACHE];
+
+/* incremented on every use, the entry used least recently is replaced first */
+static unsigned long redirect_clock = 0;
+
+/**
+ * @brief Opens a file for appending, reusing the descriptor from an earlier redirection.
+ *
+ * Appending writes always go to the end of the file, so a single descriptor can safely be handed
+ * to every command redirected to the file, including commands running at the same time. Before
+ * reuse the path is checked to still refer to the same file, so a log which has been rotated is
+ * opened afresh. Only regular files are cached, closing a FIFO or device may be significant.
+ *
+ * @param path file to open
+ *
+ * @return the descriptor, close-on-exec, or -1 on error; release it with redirect_close()
+ */
+int redirect_append(const char* path)
+{
+    RedirectEntry* slot = NULL;
+    struct stat info;
+
+    for (int i = 0; i < REDIRECT_CACHE; i++) {
+        RedirectEntry* entry = &redirect_cache[i];
+        if (entry->path == NULL || strcmp(entry->path, path) != 0) {
+            continue;
+        }
+        if (stat(path, &info) == 0 && info.st_dev == entry->dev && info.st_ino == entry->ino) {
+            entry->used = ++redirect_clock;
+            return entry->fd;
+        }
+        #ifdef DEBUG
+        printf("debug: %s has been replaced, reopening\n", path);
+        #endif
+        redirect_evict(entry);
+        break;
+    }
+
+    int fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0666);
+    if (fd == -1 || fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        return fd;
+    }
+
+    /* an empty entry, else the one used least recently */
+    for (int i = 0; i < REDIRECT_CACHE; i++) {
+        RedirectEntry* entry = &redirect_cache[i];
+        if (entry->path == NULL) {
+            slot = entry;
+            break;
+        }
+        if (slot == NULL || entry->used < slot->used) {
+            slot = entry;
+        }
+    }
+    redirect_evict(slot);
+
+    slot->path = strdup(path);
+    if (slot->path == NULL) {
+        return fd;
+    }
+    slot->fd = fd;
+    slot->dev = info.st_dev;
+    slot->ino = info.st_ino;
+    slot->used = ++redirect_clock;
+    return fd;
+}
+
+/**
+ * @brief Releases a descriptor opened for a redirection. Cached descriptors are kept open.
+ *
+ * @param fd descriptor to release
+ */
+void redirect_close(int fd)
+{
+    for (int i = 0; i < REDIRECT_CACHE; i++) {
+        if (redirect_cache[i].path != NULL && redirect_cache[i].fd == fd) {
+            return;
+        }
+    }
+    close(fd);
+}
+
+/**
+ * @brief Removes an entry from the cache, closing its descriptor.
+ *
+ * @param entry entry to remove
+ */
+void redirect_evict(RedirectEntry* entry)
+{
+    if (entry->path == NULL) {
+        return;
+    }
+    close(entry->fd);
+    free(entry->path);
+    entry->path = NULL;
+    entry->fd = -1;
+}
+
+/**
+ * @brief Closes every cached descriptor.
+ */
+void redirect_clear(void)
+{
+    for (int i = 0; i < REDIRECT_CACHE; i++) {
+        redirect_evict(&redirect_cache[i]);
+    }
+}
@@ -0,0 +1,340 @@
+/**
+ * @file scan.c
+ * @brief Byte scanning for the tokenizer, finding the bounds of tokens many bytes at a time.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * A token ends at whitespace (SEPARATORS), a | or the end of the line. On x86 the bytes are
+ * compared 16 at a time with SSE2, or 32 at a time with AVX2 where the processor has it, the
+ * positions matching being gathered into a bit mask. Every load is aligned, so it never crosses
+ * into the next page however close the end of the line is to it; the bytes before the line,
+ * or after its end, are masked off or never looked at. A table of byte classes may also be
+ * used, one byte at a time, as may strspn() and strcspn().
+ *
+ * The engine is chosen once by scan_setup(), every engine finds exactly the same bounds. The
+ * intrinsics are only worth calling once the compiler inlines them: built without optimisation,
+ * as the makefile does, the vector engines are several times slower than libc, so it is used.
+ */
+#include "seashell.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/* the aligned loads may read past the end of the line, within the same page */
+#define SCAN_UNCHECKED __attribute__ ((no_sanitize_address))
+
+/* classes of the bytes which matter to the tokenizer */
+#define SCAN_SEPARATOR 0x1
+#define SCAN_BOUNDARY 0x2
+
+static const unsigned char scan_classes[256] = {
+    ['\0'] = SCAN_BOUNDARY,
+    [' '] = SCAN_SEPARATOR|SCAN_BOUNDARY,
+    ['\t'] = SCAN_SEPARATOR|SCAN_BOUNDARY,
+    ['\n'] = SCAN_SEPARATOR|SCAN_BOUNDARY,
+    ['|'] = SCAN_BOUNDARY,
+};
+
+/* available engines, the default first, then slowest first */
+const ScanEngine scan_engines[] = {
+    { "libc", scan_skip_libc, scan_end_libc, NULL },
+    { "scalar", scan_skip_scalar, scan_end_scalar, NULL },
+    #ifdef SCAN_X86
+    { "sse2", scan_skip_sse2, scan_end_sse2, scan_has_sse2 },
+    { "avx2", scan_skip_avx2, scan_end_avx2, scan_has_avx2 },
+    #endif
+    { NULL, NULL, NULL, NULL },
+};
+
+/* engine used by next_token(), the libc one unless scan_setup() finds a faster one */
+const ScanEngine* scan_engine = &scan_engines[0];
+
+/**
+ * @brief Chooses the fastest engine the processor supports.
+ *
+ * Unless the shell is optimised only libc is used, see the top of this file.
+ */
+void scan_setup(void)
+{
+    #ifdef __OPTIMIZE__
+    for (const ScanEngine* engine = scan_engines; engine->name != NULL; engine++) {
+        if (engine->supported != NULL && engine->supported()) {
+            scan_engine = engine;
+        }
+    }
+    #endif
+
+    #ifdef DEBUG
+    printf("debug: tokenizer scanning with %s\n", scan_engine->name);
+    #endif
+}
+
+/**
+ * @brief Finds the first byte which is not whitespace with strspn().
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found, possibly the terminating NULL
+ */
+char* scan_skip_libc(const char* text)
+{
+    return (char*)text + strspn(text, SEPARATORS);
+}
+
+/**
+ * @brief Finds the first whitespace, | or NULL with strcspn().
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found
+ */
+char* scan_end_libc(const char* text)
+{
+    return (char*)text + strcspn(text, SEPARATORS "|");
+}
+
+/**
+ * @brief Finds the first byte which is not whitespace, one byte at a time.
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found, possibly the terminating NULL
+ */
+char* scan_skip_scalar(const char* text)
+{
+    while (scan_classes[(unsigned char)*text] & SCAN_SEPARATOR) {
+        text++;
+    }
+    return (char*)text;
+}
+
+/**
+ * @brief Finds the first whitespace, | or NULL, one byte at a time.
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found
+ */
+char* scan_end_scalar(const char* text)
+{
+    while (!(scan_classes[(unsigned char)*text] & SCAN_BOUNDARY)) {
+        text++;
+    }
+    return (char*)text;
+}
+
+#ifdef SCAN_X86
+
+/**
+ * @brief Determines whether the processor has SSE2, which every x86-64 processor does.
+ *
+ * @return non-zero if it does
+ */
+int scan_has_sse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+/**
+ * @brief Determines whether the processor, and the kernel, support AVX2.
+ *
+ * @return non-zero if they do
+ */
+int scan_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/**
+ * @brief Marks the whitespace within 16 bytes.
+ *
+ * @param bytes bytes to examine
+ *
+ * @return bit mask with a bit set for each byte which is whitespace
+ */
+__attribute__ ((target("sse2")))
+static inline unsigned int scan_separators_sse2(__m128i bytes)
+{
+    __m128i found = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                    _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')),
+                                 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))));
+    return (unsigned int)_mm_movemask_epi8(found);
+}
+
+/**
+ * @brief Finds the first byte which is not whitespace, 16 bytes at a time.
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found, possibly the terminating NULL
+ */
+__attribute__ ((target("sse2"))) SCAN_UNCHECKED
+char* scan_skip_sse2(const char* text)
+{
+    /* usually a single space, or none at all, separates tokens */
+    if (!(scan_classes[(unsigned char)*text] & SCAN_SEPARATOR)) {
+        return (char*)text;
+    }
+    size_t offset = (uintptr_t)text & 15;
+    const char* block = text - offset;
+    unsigned int mask = ~scan_separators_sse2(_mm_load_si128((const __m128i*)block))
+                        & (0xFFFFu << offset) & 0xFFFFu;
+
+    while (mask == 0) {
+        block += 16;
+        mask = ~scan_separators_sse2(_mm_load_si128((const __m128i*)block)) & 0xFFFFu;
+    }
+    return (char*)block + __builtin_ctz(mask);
+}
+
+/**
+ * @brief Finds the first whitespace, | or NULL, 16 bytes at a time.
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found
+ */
+__attribute__ ((target("sse2"))) SCAN_UNCHECKED
+char* scan_end_sse2(const char* text)
+{
+    size_t offset = (uintptr_t)text & 15;
+    const char* block = text - offset;
+    __m128i bytes = _mm_load_si128((const __m128i*)block);
+    unsigned int mask = (scan_separators_sse2(bytes)
+                         | (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('|')))
+                         | (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128())))
+                        & (0xFFFFu << offset);
+
+    while (mask == 0) {
+        block += 16;
+        bytes = _mm_load_si128((const __m128i*)block);
+        mask = scan_separators_sse2(bytes)
+               | (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('|')))
+               | (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+    }
+    return (char*)block + __builtin_ctz(mask);
+}
+
+/**
+ * @brief Marks the whitespace within 32 bytes.
+ *
+ * @param bytes bytes to examine
+ *
+ * @return bit mask with a bit set for each byte which is whitespace
+ */
+__attribute__ ((target("avx2")))
+static inline unsigned int scan_separators_avx2(__m256i bytes)
+{
+    __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t')),
+                                    _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))));
+    return (unsigned int)_mm256_movemask_epi8(found);
+}
+
+/**
+ * @brief Finds the first byte which is not whitespace, 32 bytes at a time.
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found, possibly the terminating NULL
+ */
+__attribute__ ((target("avx2"))) SCAN_UNCHECKED
+char* scan_skip_avx2(const char* text)
+{
+    /* usually a single space, or none at all, separates tokens */
+    if (!(scan_classes[(unsigned char)*text] & SCAN_SEPARATOR)) {
+        return (char*)text;
+    }
+    size_t offset = (uintptr_t)text & 31;
+    const char* block = text - offset;
+    unsigned int mask = ~scan_separators_avx2(_mm256_load_si256((const __m256i*)block))
+                        & (0xFFFFFFFFu << offset);
+
+    while (mask == 0) {
+        block += 32;
+        mask = ~scan_separators_avx2(_mm256_load_si256((const __m256i*)block));
+    }
+    return (char*)block + __builtin_ctz(mask);
+}
+
+/**
+ * @brief Finds the first whitespace, | or NULL, 32 bytes at a time.
+ *
+ * @param text text to scan, NULL terminated
+ *
+ * @return the byte found
+ */
+__attribute__ ((target("avx2"))) SCAN_UNCHECKED
+char* scan_end_avx2(const char* text)
+{
+    size_t offset = (uintptr_t)text & 31;
+    const char* block = text - offset;
+    __m256i bytes = _mm256_load_si256((const __m256i*)block);
+    unsigned int mask = (scan_separators_avx2(bytes)
+                         | (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('|')))
+                         | (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())))
+                        & (0xFFFFFFFFu << offset);
+
+    while (mask == 0) {
+        block += 32;
+        bytes = _mm256_load_si256((const __m256i*)block);
+        mask = scan_separators_avx2(bytes)
+               | (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('|')))
+               | (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+    }
+    return (char*)block + __builtin_ctz(mask);
+}
+
+#endif
+
+/**
+ * @brief Classifies a token as a redirection operator from its first few bytes.
+ *
+ * The operators are <, 0<, >, 1>, >>, 1>>, 2>, 2>>, &>, >& and &>>.
+ *
+ * @param token token to classify
+ *
+ * @return the streams redirected (TOKEN_STDIN, TOKEN_STDOUT, TOKEN_STDERR) and TOKEN_APPEND, or
+ *         0 if the token is not a redirection operator
+ */
+int scan_redirection(const char* token)
+{
+    int kind;
+
+    switch (token[0]) {
+    case '<':
+        return (token[1] == '\0') ? TOKEN_STDIN : 0;
+    case '0':
+        return (token[1] == '<' && token[2] == '\0') ? TOKEN_STDIN : 0;
+    case '>':
+        if (token[1] == '&') {
+            return (token[2] == '\0') ? TOKEN_STDOUT|TOKEN_STDERR : 0;
+        }
+        kind = TOKEN_STDOUT;
+        token += 1;
+        break;
+    case '1':
+    case '2':
+    case '&':
+        if (token[1] != '>') {
+            return 0;
+        }
+        kind = (token[0] == '1') ? TOKEN_STDOUT : (token[0] == '2') ? TOKEN_STDERR
+            : TOKEN_STDOUT|TOKEN_STDERR;
+        token += 2;
+        break;
+    default:
+        return 0;
+    }
+
+    /* all that may follow is a second > to append */
+    if (token[0] == '\0') {
+        return kind;
+    }
+    return (token[0] == '>' && token[1] == '\0') ? kind|TOKEN_APPEND : 0;
+}
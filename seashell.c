@@ -8,11 +8,37 @@
 #include "seashell.h"
 #include "signals.c"
 #include "builtins.c"
+#include "spawn.c"
+#include "hash.c"
+#include "output.c"
+#include "parallel.c"
+#include "input.c"
+#include "arena.c"
+#include "jobs.c"
+#include "metrics.c"
+#include "dir.c"
+#include "redirect.c"
+#include "zygote.c"
+#include "memo.c"
+#include "compile.c"
+#include "vars.c"
+#include "glob.c"
+#include "here.c"
+#include "copy.c"
+#include "placement.c"
+#include "mux.c"
+#include "trace.c"
+#include "scan.c"
+#include "serve.c"
 
-FILE *input_file;
+/* reader for the batch file, or stdin */
+Input input;
 
-/* struct to hold details regarding command */
-Command cmd;
+/* memory holding the parsed form of the current line */
+Arena line_arena;
+
+/* compiled batch file, used in place of input when loaded */
+Compiled program;
 
 /**
  * @brief Core process loop
@@ -25,188 +51,521 @@ Command cmd;
  */
 int main (int argc, char* argv[], char** env)
 {
-    char raw_input[MAX_BUFFER];
+    char* raw_input;
+    Pipeline* pipeline;
 
     setup_signal_handlers();
+    setup_builtins();
+    scan_setup();
+    jobs_setup();
+    metrics_setup();
+    var_setup(env);
     setup_input_file(argc, argv);
     setup_env_variables();
 
-    /* loop over each command until the end of file is reached */
-    while (!feof(input_file)) {
+    /* with --serve, requests are run by copies of the shell, which carry on from here */
+    if (serve_path != NULL) {
+        int status = serve_run(serve_path);
+        if (status != SERVE_REQUEST) {
+            cleanup();
+            return status;
+        }
+        env = environ;
+    }
+
+    /* loop over each command until the end of input is reached */
+    while (1) {
+        /* reap background jobs which have finished */
+        jobs_update();
+
         prompt();
 
-        /* reset the command information */
-        clear_cmd();
+        /* release the previous line's commands */
+        arena_reset(&line_arena);
 
-        /* read next line from the input_file */
-        if (fgets(raw_input, (int)sizeof(raw_input), input_file) != NULL) {
+        if (program.map != NULL) {
+            /* a compiled batch file holds the lines already parsed */
+            int next;
+            TRACE("input", "read", NULL, next = compile_next(&program, &line_arena, &pipeline));
+            if (next == -1) {
+                break;
+            }
+        } else {
+            /* read next line from the input */
+            TRACE("input", "read", NULL, raw_input = input_line(&input));
+            if (raw_input == NULL) {
+                break;
+            }
 
-            /* ensure fgets received actual input */
-            if (raw_input[0] == '\n') {
+            /* ensure actual input was received */
+            if (raw_input[0] == '\0') {
                 continue;
             }
 
-            /* tokenize the raw input */
-            process_input(raw_input);
-
-            /* evaluate the processed arguments */
-            evaluate_args(env);
+            /* the body of a here-document follows, and reading it replaces the line */
+            int here = (strstr(raw_input, "<<") != NULL);
+            if (here) {
+                size_t length = strlen(raw_input) + 1;
+                char* copy = arena_alloc(&line_arena, length);
+                if (copy == NULL) {
+                    continue;
+                }
+                raw_input = memcpy(copy, raw_input, length);
+            }
 
+            /* tokenize the raw input */
+            TRACE("parse", "parse", NULL, pipeline = process_input(&line_arena, raw_input));
+            if (here && pipeline != NULL && here_read(&line_arena, pipeline, &input, NULL) == -1) {
+                pipeline = NULL;
+            }
         }
-        else if (ferror(input_file)) {
-            // handle file errors
-            perror("error - file");
-            cleanup();
-            return 1;
+
+        if (pipeline == NULL) {
+            continue;
         }
+
+        /* evaluate the processed arguments */
+        TRACE("eval", "evaluate", pipeline->first != NULL ? pipeline->first->args[0] : NULL,
+              evaluate_args(pipeline, env));
+    }
+
+    if (input.error != 0) {
+        // handle file errors
+        errno = input.error;
+        perror("error - file");
+        cleanup();
+        return 1;
     }
 
+    int status = parallel_finish();
     cleanup();
-    return 0;
+    return status;
 }
 
 /**
- * @brief Tokenizes input line, extracts tokens related to redirection and background execution.
+ * @brief Tokenizes the input line into a pipeline of commands, extracts tokens related to
+ * redirection and background execution.
  *
+ * Tokens are terminated in place within raw_input, everything else (the pipeline, its commands
+ * and their argument lists) is allocated from the arena. There is no limit on the number of
+ * arguments or commands. References to variables within arguments and file names are expanded
+ * (see var_expand()); an argument which expands to nothing is dropped. Arguments holding
+ * patterns are then replaced by the names they match (see glob_expand()), directories read
+ * for one pattern being reused by the rest of the line.
+ *
+ * @param arena arena to allocate the pipeline from, reset before each line
  * @param raw_input input string
+ *
+ * @return the parsed pipeline (with no commands for a blank line), or NULL on a syntax error
  */
-void process_input(char* raw_input)
+Pipeline* process_input(Arena* arena, char* raw_input)
 {
-    /* reset arg pointer to args */
-    cmd.arg = cmd.args;
-    *cmd.arg++ = strtok(raw_input, SEPARATORS); /* get command */
+    Scanner scanner = { raw_input, 0 };
+    GlobCache globs = { NULL };
+    Pipeline* pipeline = arena_alloc(arena, sizeof(Pipeline));
+    Command* command = NULL;
+    Command** link;
     char* token;
-    while ((token = strtok(NULL, SEPARATORS))) {
 
-        if (strcmp(token, "<") == 0 || strcmp(token, "0<") == 0) {
-            /* redirect stdin */
-            cmd.file_stdin = strtok(NULL, SEPARATORS);
-            #ifdef DEBUG
-            printf("debug: stdin redirection from: %s\n", cmd.file_stdin);
-            #endif
-
-        } else if (strcmp(token, ">") == 0 || strcmp(token, "1>") == 0) {
-            /* redirect stdout */
-            cmd.file_stdout = strtok(NULL, SEPARATORS);
-            #ifdef DEBUG
-            printf("debug: stdout redirection to %s with append = %d\n", cmd.file_stdout, cmd.is_stdout_append);
-            #endif
+    if (pipeline == NULL) {
+        return NULL;
+    }
+    pipeline->first = NULL;
+    pipeline->length = 0;
+    link = &pipeline->first;
 
-        } else if (strcmp(token, ">>") == 0 || strcmp(token, "1>>") == 0) {
-            /* redirect stdout and append */
-            cmd.file_stdout = strtok(NULL, SEPARATORS);
-            cmd.is_stdout_append = 1;
-            #ifdef DEBUG
-            printf("debug: stdout redirection to %s with append = %d\n", cmd.file_stdout, cmd.is_stdout_append);
-            #endif
+    while ((token = next_token(&scanner)) != NULL) {
 
-        } else if (strcmp(token, "2>") == 0 || strcmp(token, "2>") == 0) {
-            /* redirect stderr */
-            cmd.file_stderr = strtok(NULL, SEPARATORS);
-            #ifdef DEBUG
-            printf("debug: stderr redirection to %s with append = %d\n", cmd.file_stderr, cmd.is_stderr_append);
-            #endif
+        /* start of a new command */
+        if (command == NULL) {
+            if ((command = new_command(arena)) == NULL) {
+                return NULL;
+            }
+            *link = command;
+            link = &command->next;
+            pipeline->length++;
+        }
 
-        } else if (strcmp(token, "2>>") == 0 || strcmp(token, "2>>") == 0) {
-            /* redirect stderr and append */
-            cmd.file_stderr = strtok(NULL, SEPARATORS);
-            cmd.is_stderr_append = 1;
-            #ifdef DEBUG
-            printf("debug: stderr redirection to %s with append = %d\n", cmd.file_stderr, cmd.is_stderr_append);
-            #endif
+        if (strncmp(token, "<<", 2) == 0) {
+            /* here-document (<<EOF) or here-string (<<< word), which may be attached */
+            int string = (token[2] == '<');
+            char* word = token + 2 + string;
+            if (*word == '\0') {
+                word = next_token(&scanner);
+            }
+            if (word == NULL || (word[0] == '|' && word[1] == '\0')) {
+                fprintf(stderr, "error - missing %s for %s\n", string ? "word" : "delimiter",
+                        string ? "<<<" : "<<");
+                return NULL;
+            }
+            if (!string) {
+                /* the body is read once the whole line has been parsed, see here_read() */
+                command->here_delimiter = word;
+            } else if ((word = var_expand(arena, word)) == NULL
+                    || here_string(arena, command, word) == -1) {
+                return NULL;
+            }
 
-        } else if (strcmp(token, "&>") == 0 || strcmp(token, ">&") == 0) {
-            /* redirect stdout & stderr */
-            cmd.file_stderr = strtok(NULL, SEPARATORS);
-            cmd.file_stdout = cmd.file_stderr;
-            #ifdef DEBUG
-            printf("debug: stdout+stderr redirection to %s (%s)\n", cmd.file_stderr, cmd.file_stdout);
-            #endif
+        } else if (token[0] == '|' && token[1] == '\0') {
+            /* end of a pipeline stage */
+            if (command->argc == 0) {
+                fprintf(stderr, "error - missing command in pipeline\n");
+                return NULL;
+            }
+            command = NULL;
 
-        } else if (strcmp(token, "&>>") == 0) {
-            /* redirect stdout & stderr and append*/
-            cmd.file_stderr = strtok(NULL, SEPARATORS);
-            cmd.file_stdout = cmd.file_stderr;
-            cmd.is_stderr_append = 1;
-            cmd.is_stdout_append = 1;
-            #ifdef DEBUG
-            printf("debug: stdout+stderr redirection to %s (%s) append %d (%d)\n", cmd.file_stderr, cmd.file_stdout, cmd.is_stderr_append, cmd.is_stdout_append);
-            #endif
+        } else if (is_redirection(token)) {
+            char* file = next_token(&scanner);
+            if (file == NULL || (file[0] == '|' && file[1] == '\0')) {
+                fprintf(stderr, "error - missing file for redirection %s\n", token);
+                return NULL;
+            }
+            if ((file = var_expand(arena, file)) == NULL) {
+                return NULL;
+            }
+            process_redirection(command, token, file);
 
         } else {
-            /* add to argument arg array */
-            *cmd.arg++ = token;
+            char* expanded = var_expand(arena, token);
+            if (expanded == NULL) {
+                return NULL;
+            }
+            /* a reference to a variable which is not set, or is empty, is no argument at all */
+            if (expanded != token && expanded[0] == '\0') {
+                continue;
+            }
+            if (glob_pattern(expanded)) {
+                if (glob_expand(arena, &globs, command, expanded) == -1) {
+                    return NULL;
+                }
+            } else if (add_argument(arena, command, expanded) == -1) {
+                return NULL;
+            }
         }
+    }
+
+    /* a trailing | leaves the last stage without a command */
+    if (command == NULL && pipeline->length > 0) {
+        fprintf(stderr, "error - missing command in pipeline\n");
+        return NULL;
+    }
 
+    /* a line with no arguments, e.g. only variables which are not set, runs nothing */
+    if (command != NULL && command->argc == 0) {
+        if (pipeline->length > 1) {
+            fprintf(stderr, "error - missing command in pipeline\n");
+            return NULL;
+        }
+        pipeline->first = NULL;
+        pipeline->length = 0;
     }
-    *cmd.arg = token; /* required due to using token in the while loop */
 
     /* check if & is last token in the command list */
-    if (strcmp(*(cmd.arg-1), "&") == 0) {
+    if (command != NULL && command->argc > 0 && strcmp(command->args[command->argc-1], "&") == 0) {
         #ifdef DEBUG
         printf("debug: running as background\n");
         #endif
-        cmd.is_background = 1;
-        *(cmd.arg-1) = NULL;
+        command->args[--command->argc] = NULL;
+        for (Command* stage = pipeline->first; stage != NULL; stage = stage->next) {
+            stage->is_background = 1;
+        }
+    }
+
+    return pipeline;
+}
+
+/**
+ * @brief Returns the next token of the input, terminating it in place.
+ *
+ * Tokens are separated by whitespace. A | is always a token of its own, even when not
+ * surrounded by whitespace. The bounds are found by the engine chosen by scan_setup().
+ *
+ * @param scanner position within the input
+ *
+ * @return the token, or NULL at the end of the input
+ */
+char* next_token(Scanner* scanner)
+{
+    /* a | which terminated the previous token */
+    if (scanner->pending_pipe) {
+        scanner->pending_pipe = 0;
+        return "|";
+    }
+
+    char* start = scan_engine->skip(scanner->cursor);
+    if (*start == '\0') {
+        scanner->cursor = start;
+        return NULL;
+    }
+    if (*start == '|') {
+        scanner->cursor = start + 1;
+        return "|";
+    }
+
+    char* end = scan_engine->end(start);
+    if (*end == '|') {
+        scanner->pending_pipe = 1;
+    }
+    if (*end != '\0') {
+        *end++ = '\0';
     }
+    scanner->cursor = end;
+
+    return start;
+}
+
+/**
+ * @brief Allocates an empty command.
+ *
+ * @param arena arena to allocate from
+ *
+ * @return the command, or NULL if out of memory
+ */
+Command* new_command(Arena* arena)
+{
+    Command* command = arena_alloc(arena, sizeof(Command));
+
+    if (command != NULL) {
+        memset(command, 0, sizeof(Command));
+        command->fd_stdin = -1;
+        command->fd_stdout = -1;
+        command->fd_stderr = -1;
+    }
+    return command;
+}
+
+/**
+ * @brief Appends an argument to a command, growing its NULL terminated argument list.
+ *
+ * @param arena arena the command was allocated from
+ * @param command command to extend
+ * @param token argument to append
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int add_argument(Arena* arena, Command* command, char* token)
+{
+    /* room for the new argument and the terminator */
+    if (command->argc + 2 > command->capacity) {
+        int capacity = (command->capacity == 0) ? ARGS_INITIAL : command->capacity * 2;
+        char** args = arena_grow(arena, command->args,
+                (size_t)command->capacity * sizeof(char*), (size_t)capacity * sizeof(char*));
+        if (args == NULL) {
+            return -1;
+        }
+        command->args = args;
+        command->capacity = capacity;
+    }
+
+    command->args[command->argc++] = token;
+    command->args[command->argc] = NULL;
+    return 0;
+}
+
+/**
+ * @brief Determines whether a token is a redirection operator.
+ *
+ * @param token token to examine
+ *
+ * @return 1 if the token is a redirection operator, else 0
+ */
+int is_redirection(const char* token)
+{
+    return scan_redirection(token) != 0;
 }
 
 /**
- * @brief Resets the command variables for re-use.
+ * @brief Records a redirection on a command.
+ *
+ * @param command command the redirection applies to
+ * @param token redirection operator
+ * @param file file to redirect to or from
  */
-void clear_cmd()
+void process_redirection(Command* command, const char* token, char* file)
 {
-    cmd.is_stderr_append = 0;
-    cmd.is_stdout_append = 0;
-    cmd.is_background = 0;
-    cmd.file_stdin = NULL;
-    cmd.file_stdout = NULL;
-    cmd.file_stderr = NULL;
-    cmd.args[0] = NULL;
-    cmd.arg = cmd.args;
+    int kind = scan_redirection(token);
+
+    if (kind & TOKEN_STDIN) {
+        /* redirect stdin */
+        command->file_stdin = file;
+        #ifdef DEBUG
+        printf("debug: stdin redirection from: %s\n", command->file_stdin);
+        #endif
+    }
+    if (kind & TOKEN_STDOUT) {
+        /* redirect stdout, and append if >> */
+        command->file_stdout = file;
+        command->is_stdout_append = (kind & TOKEN_APPEND) != 0;
+        #ifdef DEBUG
+        printf("debug: stdout redirection to %s with append = %d\n", command->file_stdout, command->is_stdout_append);
+        #endif
+    }
+    if (kind & TOKEN_STDERR) {
+        /* redirect stderr, and append if >> */
+        command->file_stderr = file;
+        command->is_stderr_append = (kind & TOKEN_APPEND) != 0;
+        #ifdef DEBUG
+        printf("debug: stderr redirection to %s with append = %d\n", command->file_stderr, command->is_stderr_append);
+        #endif
+    }
 }
 
 /**
  * @brief Establishes the file to obtain input from.
  *
- * If a batch file was provided, then that is opened as input. Else stdin is used.
+ * If a batch file was provided, then that is opened as input. Else stdin is used. The -j option
+ * enables parallel execution with the given number of jobs, -z launches external programs through
+ * a spawn helper, --job-output captures the output of background jobs (see mux.c), and --trace
+ * records a timeline of the shell's work (see trace.c). A compiled batch file, or an up to date
+ * compiled copy of the batch file, is used in place of the batch file. With --compile the batch
+ * file is compiled instead, to the file given by -o. With --serve no input is read, the shell
+ * serves batch files sent by --client instead (see serve.c).
  *
  * @param argc number of arguments provided to program
  * @param argv list of arguments provided to program
  */
 void setup_input_file(int argc, char* argv[])
 {
-    /* read from stdin by default */
-    input_file = stdin;
+    static const struct option options[] = {
+        { "compile", required_argument, NULL, 'c' },
+        { "job-output", no_argument, NULL, 'J' },
+        { "trace", required_argument, NULL, 't' },
+        { "serve", required_argument, NULL, 's' },
+        { "client", required_argument, NULL, 'C' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char* compile = NULL;
+    const char* client = NULL;
+    const char* destination = NULL;
+    int opt;
+    int fd = STDIN_FILENO; /* read from stdin by default */
+
+    while ((opt = getopt_long(argc, argv, "j:zo:", options, NULL)) != -1) {
+        if (opt == 'c') {
+            compile = optarg;
+        } else if (opt == 'o') {
+            destination = optarg;
+        } else if (opt == 't') {
+            /* record a timeline of the shell's work, written when it exits */
+            if (trace_open(optarg) == -1) {
+                cleanup();
+                exit(EXIT_FAILURE);
+            }
+        } else if (opt == 's') {
+            /* run batch files sent to the socket, by copies of the shell set up once */
+            serve_path = optarg;
+        } else if (opt == 'C') {
+            /* send the batch file to a server instead of running it */
+            client = optarg;
+        } else if (opt == 'J') {
+            /* write the output of background jobs a line at a time, labelled with the job */
+            mux_enabled = 1;
+        } else if (opt == 'z') {
+            /* launch external programs through a helper forked while the shell is small */
+            zygote_start();
+        } else if (opt == 'j') {
+            /* parallel execution */
+            char* end;
+            long jobs = strtol(optarg, &end, 10);
+            if (*end != '\0' || jobs < 1 || jobs > INT_MAX) {
+                fprintf(stderr, "error - number of jobs must be a positive integer\n");
+                cleanup();
+                exit(EXIT_FAILURE);
+            }
+            parallel_setup((int)jobs);
+        } else {
+            fprintf(stderr, "usage: seashell [-j jobs] [-z] [--job-output] [--trace file] [batchfile]\n"
+                    "       seashell --compile batchfile [-o compiled]\n"
+                    "       seashell --serve socket [-j jobs] [--job-output]\n"
+                    "       seashell --client socket [batchfile]\n");
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (client != NULL) {
+        if (serve_path != NULL || argc - optind > 1) {
+            fprintf(stderr, "usage: seashell --client socket [batchfile]\n");
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+        int status = serve_client(client, (argc - optind == 1) ? argv[optind] : NULL);
+        cleanup();
+        exit(status);
+    }
+
+    if (serve_path != NULL) {
+        if (compile != NULL || argc - optind > 0) {
+            fprintf(stderr, "usage: seashell --serve socket [-j jobs] [--job-output]\n");
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+        /* each request reads its own input */
+        input.fd = -1;
+        return;
+    }
+
+    if (compile != NULL || destination != NULL) {
+        if (compile == NULL || argc - optind > 0) {
+            fprintf(stderr, "usage: seashell --compile batchfile [-o compiled]\n");
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+        int status = compile_file(compile, destination);
+        cleanup();
+        exit(status);
+    }
 
-    if (argc > 2) {
+    if (argc - optind > 1) {
         fprintf(stderr, "error - only one argument should be given\n");
         cleanup();
         exit(EXIT_FAILURE);
     }
 
     /* if argument given, use that file as the input */
-    if (argc > 1) {
+    if (argc - optind == 1) {
 
         /* determine file accessibility */
-        if( access( argv[1], R_OK ) == -1 ) {
+        if( access( argv[optind], R_OK ) == -1 ) {
             perror("error - cannot open batch file");
             cleanup();
             exit(EXIT_FAILURE);
         }
 
-        input_file = fopen(argv[1], "r");
+        fd = open(argv[optind], O_RDONLY|O_CLOEXEC);
 
-        if (input_file == NULL) {
+        if (fd == -1) {
             perror("error - cannot open batch file");
             cleanup();
             exit(EXIT_FAILURE);
         }
+
+        /* nothing needs to be parsed if the batch file is, or has, a compiled copy */
+        int compiled = compile_open(&program, fd, argv[optind]);
+        if (compiled == -1) {
+            close(fd);
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+        if (compiled == 1) {
+            input.fd = -1;
+            return;
+        }
+    }
+
+    if (input_open(&input, fd) == -1) {
+        perror("error - cannot read input");
+        cleanup();
+        exit(EXIT_FAILURE);
     }
+    /* commands reading stdin carry on from the line being run */
+    input.shared = (fd == STDIN_FILENO);
 }
 
 /**
- * @brief Sets the SHELL environment variable to the location of the myshell binary.
+ * @brief Sets the SHELL and PARENT environment variables to the location of the myshell binary.
+ *
+ * Both are exported, so every program launched by the shell sees PARENT.
  */
 void setup_env_variables()
 {
@@ -219,235 +578,448 @@ void setup_env_variables()
     #ifdef DEBUG
     printf("debug: setting SHELL=%s\n", buffer);
     #endif
-    setenv("SHELL", buffer, 1);
+    var_set("SHELL", buffer, VAR_EXPORT);
+    var_set("PARENT", buffer, VAR_EXPORT);
 }
 
 
 /**
- * @brief Closes a batch file if used.
+ * @brief Closes a batch file if used, and releases parsed commands.
  */
 void cleanup()
 {
 
     /* close file, if opened */
-    if (input_file != stdin) {
-        if(fclose(input_file) != 0) {
-            perror("failed to close file\n");
-        }
+    input_close(&input);
+    compile_close(&program);
+
+    arena_free(&line_arena);
+
+    jobs_free();
+
+    mux_stop();
+
+    trace_close();
+
+    metrics_close();
+
+    redirect_clear();
+
+    zygote_stop(1);
+
+    serve_close();
+
+    var_free();
+
+    glob_free();
+
+}
+
+
+/**
+ * @brief Evaluates the processed input line, either a single command or a pipeline.
+ *
+ * A built-in function registered with BUILTIN_PREFIX at the start of the line is given the
+ * first command, and evaluates the rest of the line itself (see prefix_pipeline()). A line made
+ * up only of assignments (NAME=value) sets shell variables.
+ *
+ * @param pipeline commands parsed from the line
+ * @param env list environment variables provided to program
+ */
+void evaluate_args(Pipeline* pipeline, char** env)
+{
+    if (pipeline->length == 1 && var_assign(pipeline->first) == 0) {
+        return;
     }
 
-    clear_cmd();
+    /* a prefix (e.g. time) applies to the whole of the pipeline following it */
+    if (pipeline->length > 0 && pipeline->first->args[0] != NULL) {
+        const Builtin* builtin = command_builtin(pipeline->first);
+        if (builtin != NULL && (builtin->flags & BUILTIN_PREFIX)) {
+            TRACE("builtin", builtin->name, NULL, builtin->function(pipeline->first, env));
+            return;
+        }
+    }
 
+    if (pipeline->length > 1) {
+        do_pipeline(pipeline, env);
+    } else if (pipeline->length == 1) {
+        evaluate_command(pipeline->first, env);
+    }
 }
 
+/**
+ * @brief Removes a prefix from the first command of a pipeline.
+ *
+ * @param command first command of the pipeline, beginning with the prefix
+ * @param count number of arguments taken by the prefix, including its name
+ * @param rest destination for the pipeline which follows the prefix
+ *
+ * @return 0 on success, -1 if nothing follows the prefix
+ */
+int prefix_pipeline(Command* command, int count, Pipeline* rest)
+{
+    for (int i = 0; i < count; i++) {
+        if (command->args[0] == NULL) {
+            return -1;
+        }
+        command->args++;
+        command->argc--;
+        command->capacity--;
+    }
+
+    rest->first = command;
+    rest->length = 0;
+    for (Command* temp = command; temp != NULL; temp = temp->next) {
+        rest->length++;
+    }
+    return (command->args[0] != NULL) ? 0 : -1;
+}
 
 /**
  * @brief Evaluates the command.
  *
- * Compares the command to built-in functions, if a match is found the built-in function is
- * executed, if no match is found the command is treated as an external command to be exec'ed.
+ * Looks the command up in the registry of built-in functions, if a match is found the built-in
+ * function is executed, if no match is found the command is treated as an external command to be
+ * exec'ed. A built-in function given a placement (pin, nice or limit) is run in a forked copy of
+ * the shell.
  *
+ * @param command command to evaluate
  * @param env list environment variables provided to program
  */
-void evaluate_args(char** env)
+void evaluate_command(Command* command, char** env)
 {
-    if (cmd.args[0]) {
-        if ((strcmp(cmd.args[0], "env") == 0) || strcmp(cmd.args[0], "environ") == 0) {
-            do_environ(env);
-        } else if (strcmp(cmd.args[0], "dir") == 0) {
-            do_dir();
-        } else if (strcmp(cmd.args[0], "clr") == 0) {
-            do_clear();
-        } else if (strcmp(cmd.args[0], "quit") == 0) {
-            quit();
-        } else if (strcmp(cmd.args[0], "cd") == 0) {
-            do_cd();
-        } else if (strcmp(cmd.args[0], "echo") == 0) {
-            do_echo();
-        } else if (strcmp(cmd.args[0], "pause") == 0) {
-            do_pause();
-        } else if (strcmp(cmd.args[0], "help") == 0) {
-            do_help();
-        } else {
-            do_execute();
-        }
+    if (command->args[0] == NULL) {
+        return;
+    }
+
+    const Builtin* builtin = command_builtin(command);
+
+    if (builtin == NULL) {
+        do_execute(command);
+    } else if (!(builtin->flags & BUILTIN_REDIRECT) && has_redirection(command)) {
+        fprintf(stderr, "error - %s does not support redirection\n", builtin->name);
+    } else if (command->placement != NULL && (builtin->flags & BUILTIN_PARENT)) {
+        fprintf(stderr, "error - %s runs within the shell, it cannot be given a placement\n",
+                builtin->name);
+    } else if (command->placement != NULL) {
+        /* pin, nice and limit apply to a copy of the shell, never the shell itself */
+        Pipeline placed = { command, 1 };
+        do_pipeline(&placed, env);
+    } else {
+        TRACE("builtin", builtin->name, NULL, builtin->function(command, env));
     }
 }
 
+/**
+ * @brief Determines whether any of a command's standard streams are redirected to files.
+ *
+ * @param command command to examine
+ *
+ * @return 1 if a redirection was given, else 0
+ */
+int has_redirection(Command* command)
+{
+    return command->file_stdin != NULL || command->file_stdout != NULL || command->file_stderr != NULL
+        || command->here_delimiter != NULL || command->here_text != NULL;
+}
+
 
 /**
  * @brief Performs the execution of external processes.
  *
- * A fork is created in which the external process is exec'ed. The child has appropriate actions
- * performed upon it including, restoration of signal handlers, application of i/o redirection ...
+ * The external process is launched by spawn_process(), then waited upon unless it was requested
+ * to run in the background. In parallel mode the process is left running, and the shell only
+ * waits once the maximum number of commands are running.
  *
+ * @param command command to execute
  */
-void do_execute()
+void do_execute(Command* command)
 {
 
     #ifdef DEBUG
     printf("debug: ");
     char** temp;
     int argcount = 0;
-    for (temp = cmd.args; *temp != NULL; temp++) {
+    for (temp = command->args; *temp != NULL; temp++) {
         printf("%d=%s ", argcount++, *temp);
     }
     printf("%d=%s", argcount, *temp++); /* show (null) */
     printf("\n");
     #endif
 
-    int pid = fork();
+    /* flush pending output so it appears before the child's */
+    fflush(stdout);
 
-    if (pid == 0) {
-        restore_signals();
-        apply_io_redirection();
-        setenv("PARENT", getenv("SHELL"), 1);
-        execvp(*cmd.args, cmd.args);
-        perror("error - unable to execute external program");
-        cleanup();
-        exit(EXIT_FAILURE);
+    /* in parallel mode, wait only until there is room for another command */
+    int parallel = (parallel_jobs > 0 && command->is_background == 0);
+    if (parallel) {
+        parallel_reserve();
+    }
+
+    /* with --job-output, a background process writes into pipes read by the shell */
+    int pipes[2][2];
+    int captured = (command->is_background && mux_prepare(pipes) == 0);
+    if (captured) {
+        command->fd_stdout = pipes[0][1];
+        command->fd_stderr = pipes[1][1];
+    }
+
+    struct timespec start;
+    metrics_now(&start);
+
+    pid_t pid;
+    TRACE("exec", "spawn", command->args[0], pid = spawn_process(command));
+
+    if (parallel) {
+        parallel_track(command, pid, &start);
+    // for background, record the job instead of waiting
+    } else if (command->is_background) {
+        Job* job = jobs_add(command, &pid, 1, &start);
+        if (captured) {
+            mux_attach(job, pipes);
+            command->fd_stdout = command->fd_stderr = -1;
+        }
     } else if (pid > 0) {
-        // for background, simply don't wait
-        if (cmd.is_background == 0) {
-            int status = 0;
-            pid_t wpid;
-            // wait until child is finished
-            while ((wpid = waitpid(pid, &status, 0)) > 0) {
-                #ifdef DEBUG
-                printf("debug: %d exited with %d\n", wpid, status);
-                #endif
-            }
+        struct rusage usage;
+        int status = 0;
+        pid_t wpid;
+        // wait until child is finished
+        TRACE("exec", "wait", command->args[0],
+            do {
+                wpid = wait4(pid, &status, 0, &usage);
+            } while (wpid == -1 && errno == EINTR));
+
+        if (wpid == pid) {
+            #ifdef DEBUG
+            printf("debug: %d exited with %d\n", wpid, status);
+            #endif
+            metrics_reaped(command->args[0], pid, &start, status, &usage);
         }
-    } else {
-        perror("error - unable to execute external program");
     }
 
 }
 
 /**
- * @brief Performs the appropriate i/o redirections.
+ * @brief Executes every stage of the pipeline, connecting adjacent stages with pipes.
  *
- * Opens specified files and associates corresponding standard text streams to these files.
+ * External commands are launched directly without an intermediate shell. Built-in functions
+ * registered with BUILTIN_PIPELINE (echo, environ) are run within the shell, writing straight
+ * into their pipe; these are run after every process has been launched, last stage first, so a
+ * full pipe can never block the shell. Other built-in functions, and those given a placement,
+ * are run in a forked copy of the shell, except those registered with BUILTIN_PARENT (e.g. cd),
+ * which are rejected as they would have no effect. Unless the pipeline was requested to run in
+ * the background, the shell waits for every stage to finish.
+ *
+ * @param pipeline commands to execute
+ * @param env list environment variables provided to program
  */
-void apply_io_redirection()
+void do_pipeline(Pipeline* pipeline, char** env)
 {
-    /* input redirection */
-    if (cmd.file_stdin != NULL) {
-       if (freopen(cmd.file_stdin, "r", stdin) == NULL) {
-            perror("error - failed to redirect stdin");
-            cleanup();
-            exit(EXIT_FAILURE);
+    int length = pipeline->length;
+    Command** stages = arena_alloc(&line_arena, (size_t)length * sizeof(Command*));
+    int (*pipes)[2] = arena_alloc(&line_arena, (size_t)length * sizeof(*pipes));
+    pid_t* pids = arena_alloc(&line_arena, (size_t)length * sizeof(pid_t));
+    const Builtin** builtins = arena_alloc(&line_arena, (size_t)length * sizeof(Builtin*));
+
+    if (stages == NULL || pipes == NULL || pids == NULL || builtins == NULL) {
+        return;
+    }
+
+    /* built-in functions which change the shell would have no effect within a pipeline */
+    Command* stage = pipeline->first;
+    for (; stage != NULL; stage = stage->next) {
+        const Builtin* builtin = command_builtin(stage);
+        if (builtin != NULL && (builtin->flags & (BUILTIN_PARENT|BUILTIN_PREFIX))) {
+            fprintf(stderr, "error - %s cannot be used in a pipeline\n", builtin->name);
+            return;
         }
     }
 
-    /* output redirection (stdout) */
-    if (cmd.file_stdout != NULL) {
-        if (cmd.is_stdout_append) {
-            if (freopen(cmd.file_stdout, "a", stdout) == NULL) {
-                perror("error - failed to redirect stdout");
-                cleanup();
-                exit(EXIT_FAILURE);
+    /* create the pipes between stages */
+    for (int i = 0; i < length - 1; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
+            perror("error - unable to create pipe");
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
             }
+            return;
+        }
+    }
+    /* with --job-output, a background pipeline writes into pipes read by the shell */
+    int output[2][2];
+    int captured = (pipeline->first->is_background && mux_prepare(output) == 0);
+
+    stage = pipeline->first;
+    for (int i = 0; i < length; i++, stage = stage->next) {
+        stages[i] = stage;
+        stage->fd_stdin = (i > 0) ? pipes[i - 1][0] : -1;
+        stage->fd_stdout = (i < length - 1) ? pipes[i][1] : -1;
+        if (captured) {
+            stage->fd_stderr = output[1][1];
+        }
+    }
+    if (captured) {
+        stages[length - 1]->fd_stdout = output[0][1];
+    }
+
+    /* flush pending output so it appears before the pipeline's */
+    fflush(stdout);
+
+    struct timespec start;
+    metrics_now(&start);
+
+    /* launch every stage requiring a separate process */
+    for (int i = 0; i < length; i++) {
+        pids[i] = -1;
+        builtins[i] = command_builtin(stages[i]);
+        if (builtins[i] == NULL) {
+            TRACE("exec", "spawn", stages[i]->args[0], pids[i] = spawn_process(stages[i]));
+        } else if (!(builtins[i]->flags & BUILTIN_PIPELINE) || stages[i]->placement != NULL) {
+            TRACE("exec", "fork", stages[i]->args[0], pids[i] = fork_builtin(stages[i], pipeline->first, env));
         } else {
-            if (freopen(cmd.file_stdout, "w", stdout) == NULL) {
-                perror("error - failed to redirect stdout");
-                cleanup();
-                exit(EXIT_FAILURE);
-            }
+            continue;
         }
+
+        /* the stage has its own copies of the pipe ends */
+        close_pipes(stages[i]);
     }
 
-    /* output redirection (stderr) */
-    if (cmd.file_stderr != NULL) {
-        if (cmd.is_stderr_append) {
-            if (freopen(cmd.file_stderr, "a", stderr) == NULL) {
-                perror("error - failed to redirect stderr");
-                cleanup();
-                exit(EXIT_FAILURE);
+    /* run the remaining built-in functions within the shell, last stage first */
+    for (int i = length - 1; i >= 0; i--) {
+        if (builtins[i] != NULL && (builtins[i]->flags & BUILTIN_PIPELINE) && stages[i]->placement == NULL) {
+            evaluate_command(stages[i], env);
+            close_pipes(stages[i]);
+        }
+    }
+
+    // for background, record the job instead of waiting
+    if (stages[length - 1]->is_background) {
+        Job* job = jobs_add(pipeline->first, pids, length, &start);
+        if (captured) {
+            /* the last stage's stdout was closed with its pipes */
+            output[0][1] = -1;
+            mux_attach(job, output);
+            for (int i = 0; i < length; i++) {
+                stages[i]->fd_stderr = -1;
             }
-        } else {
-            if (freopen(cmd.file_stderr, "w", stderr) == NULL) {
-                perror("error - failed to redirect stderr");
-                cleanup();
-                exit(EXIT_FAILURE);
+        }
+    } else {
+        for (int i = 0; i < length; i++) {
+            struct rusage usage;
+            int status = 0;
+            pid_t wpid = -1;
+            if (pids[i] > 0) {
+                TRACE("exec", "wait", stages[i]->args[0], wpid = wait4(pids[i], &status, 0, &usage));
+            }
+            if (wpid > 0) {
+                #ifdef DEBUG
+                printf("debug: %d exited with %d\n", pids[i], status);
+                #endif
+                metrics_reaped(stages[i]->args[0], pids[i], &start, status, &usage);
             }
         }
     }
-
 }
 
 /**
- * @brief Applies temporary i/o redirection, to be applied on built-in functions.
+ * @brief Closes the shell's copies of the pipes connected to a pipeline stage.
+ *
+ * @param command pipeline stage
  */
-void redirect_filedescriptors()
+void close_pipes(Command* command)
 {
-    flip_filedescriptors(1);
+    if (command->fd_stdin != -1) {
+        close(command->fd_stdin);
+        command->fd_stdin = -1;
+    }
+    if (command->fd_stdout != -1) {
+        close(command->fd_stdout);
+        command->fd_stdout = -1;
+    }
 }
 
 /**
- * @brief Restores original i/o standard text streams to values before redirection was performed.
+ * @brief Performs the appropriate i/o redirections, within a forked child.
+ *
+ * Connects the pipes of a pipeline stage, then the files opened by the shell, which take
+ * precedence over the pipes.
+ *
+ * @param command command being executed
+ * @param fds descriptors opened by open_redirections()
  */
-void restore_filedescriptors()
+void apply_io_redirection(Command* command, int fds[3])
 {
-    flip_filedescriptors(0);
+    /* pipeline redirection */
+    if (command->fd_stdin != -1 && fds[0] == -1) {
+        dup2(command->fd_stdin, STDIN_FILENO);
+    }
+    if (command->fd_stdout != -1 && fds[1] == -1) {
+        dup2(command->fd_stdout, STDOUT_FILENO);
+    }
+    if (command->fd_stderr != -1 && fds[2] == -1) {
+        dup2(command->fd_stderr, STDERR_FILENO);
+    }
+
+    /* file redirection */
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1 && dup2(fds[i], i) == -1) {
+            perror("error - failed to redirect");
+            _exit(EXIT_FAILURE);
+        }
+    }
 }
 
 /**
- * @brief Toggles the i/o redirection, to be applied on built-in functions.
+ * @brief Applies temporary i/o redirection, to be applied on built-in functions.
+ *
+ * The standard streams are saved, close-on-exec, so that restore_filedescriptors() can put them
+ * back.
  *
- * @param action specifies the action to be performed, 1 = redirect i/o, 0 = restore i/o
+ * @param command built-in function being executed
+ * @param saved destination for the saved streams, -1 where not redirected
+ *
+ * @return 0 on success, -1 if a file could not be opened
  */
-void flip_filedescriptors(int action)
+int redirect_filedescriptors(Command* command, int saved[3])
 {
-    static int backup_stdin = 0;
-    static int new_stdin = 0;
-    static int backup_stdout = 0;
-    static int new_stdout = 0;
-    static int backup_stderr = 0;
-    static int new_stderr = 0;
-
-    /* redirect file descriptors */
-    if (action == 1) {
-        if (cmd.file_stdin != NULL) {
-            new_stdin = open(cmd.file_stdin, O_RDONLY);
-            backup_stdin = dup(fileno(stdin));
-            dup2(new_stdin, fileno(stdin));
-        }
-        if (cmd.file_stdout != NULL) {
-            if (cmd.is_stdout_append) {
-                new_stdout = open(cmd.file_stdout, O_WRONLY|O_CREAT|O_APPEND, 0644);
-            } else {
-                new_stdout = open(cmd.file_stdout, O_WRONLY|O_CREAT|O_TRUNC, 0644);
-            }
-            backup_stdout = dup(fileno(stdout));
-            dup2(new_stdout, fileno(stdout));
-        }
-        if (cmd.file_stderr != NULL) {
-            if (cmd.is_stderr_append) {
-                new_stderr = open(cmd.file_stderr, O_WRONLY|O_CREAT|O_APPEND, 0644);
-            } else {
-                new_stderr = open(cmd.file_stderr, O_WRONLY|O_CREAT|O_TRUNC, 0644);
-            }
-            backup_stderr = dup(fileno(stderr));
-            dup2(new_stderr, fileno(stderr));
-        }
+    int fds[3] = { -1, -1, -1 };
 
-    /* restore file descriptors */
-    } else {
-        if (cmd.file_stdin != NULL) {
-            dup2(backup_stdin, fileno(stdin));
-            close(new_stdin);
-        }
-        if (cmd.file_stdout != NULL) {
-            dup2(backup_stdout, fileno(stdout));
-            close(new_stdout);
-        }
-        if (cmd.file_stderr != NULL) {
-            dup2(backup_stderr, fileno(stderr));
-            close(new_stderr);
+    saved[0] = saved[1] = saved[2] = -1;
+    if (open_redirections(command, fds) == -1) {
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1) {
+            saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+            dup2(fds[i], i);
         }
     }
 
+    close_redirections(fds);
+    return 0;
+}
+
+/**
+ * @brief Restores original i/o standard text streams to values before redirection was performed.
+ *
+ * @param saved streams saved by redirect_filedescriptors()
+ */
+void restore_filedescriptors(int saved[3])
+{
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] != -1) {
+            dup2(saved[i], i);
+            close(saved[i]);
+            saved[i] = -1;
+        }
+    }
 }
 
 /**
@@ -459,7 +1031,8 @@ void flip_filedescriptors(int action)
 void prompt(void)
 {
     /* establish if stdin is really a terminal or the result of file redirection */
-    if (isatty(fileno(input_file))) {
+    if (isatty(input.fd)) {
+        jobs_notify();
         printf("%s $ ", getenv("PWD"));
         fflush(stdout);
     }
@@ -8,6 +8,7 @@
 #ifndef SEASHELL_H
 #define SEASHELL_H
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -15,58 +16,854 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <signal.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <sys/sysmacros.h>
+#include <sys/socket.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 
 //#define DEBUG
-#define MAX_ARGS 64
+//#define FORK_SPAWN /* launch external processes with fork instead of posix_spawn */
 #define MAX_BUFFER 1024
 #define SEPARATORS " \t\n"
+#define PATH_TABLE_SIZE 256 /* must be a power of two */
+#define ARGS_INITIAL 8 /* argument list entries allocated for a new command */
+#define ARENA_BLOCK 65536
+#define ARENA_ALIGN 8
+#define BUILTIN_NAME_MAX 16
+#define UNUSED __attribute__ ((unused))
+#define OUTPUT_BUFFER 16384
+#define INPUT_BUFFER 4096
+#define INPUT_RELEASE (1 << 20) /* bytes of a mapped batch file processed before being released */
+#define JOB_EVENTS 64 /* events collected from the job event loop at once */
+#define METRICS_NAME_MAX 256 /* longest command name recorded in the metrics log */
+#define REDIRECT_CACHE 16 /* files held open for appending */
+#define DIR_BUFFER (1 << 18) /* bytes of directory entries read at once */
+#define DIR_ENTRIES_INITIAL 256
+#define DIR_PARALLEL 1024 /* entries in a directory before it is examined by several threads */
+#define DIR_THREADS 8
+#define DIR_STAT_CHUNK 64 /* entries claimed by a thread at a time */
+#define DIR_NAME_CACHE 16 /* must be a power of two */
+#define DIR_RECENT (31556952 / 2) /* files modified within six months show the time, not the year */
+#define COPY_CHUNK (1 << 30) /* bytes requested of a single copy_file_range, splice or sendfile */
+#define COPY_BUFFER 131072 /* bytes copied at a time when the kernel cannot copy */
+#define COPY_UNSUPPORTED -2 /* a method of copying was refused before anything was copied */
+#define PARALLEL_CAPTURE 4096 /* initial size of the output held back for an item of parallel */
+#define SPAWN_SHELL "/bin/sh" /* runs executable files which are not programs, as execvp does */
+#define ZYGOTE_FD 3 /* descriptor of the spawn helper's connection to the shell */
+#define COMPILED_MAGIC "SSC\0\0\0\0\1" /* format version in the last byte */
+#define COMPILED_EXTENSION ".ssc"
+#define COMPILED_NONE UINT32_MAX /* offset of a string which is absent */
+#define GLOB_CACHE_SIZE 64 /* buckets of the directories read for a line, must be a power of two */
+#define VARIABLE_TABLE_SIZE 256 /* must be a power of two */
+#define MEMO_SIZE (64LL << 20) /* default size limit of the memo store */
+#define MEMO_CAPTURE_MAX (16 << 20) /* largest output of a command which is memoized */
+#define MEMO_MAGIC "SSMEMO1"
+#define MEMO_ENVIRONMENT { "PATH", "LANG", "LC_ALL", "LC_CTYPE", "LC_COLLATE", "TZ" }
+#define PLACEMENT_LIMITS 16 /* resources limited for a single command */
+#define PLACEMENT_NICE 10 /* adjustment made by nice without a number */
+#define MUX_RING 16384 /* bytes of a background job's output held while awaiting a newline */
+#define MUX_EVENTS 64 /* events collected from the job output loop at once */
+#define MUX_LOG_SIZE (1LL << 20) /* default size limit of a job's log */
+#define MUX_DRAIN 1000 /* milliseconds waited for a finished job's output to be written */
+#define TRACE_SPANS 4096 /* spans room is first made for when tracing */
+#define TRACE_SPANS_MAX (1 << 20) /* spans recorded at most, later ones are dropped */
+#define TRACE_DETAIL 48 /* longest detail (e.g. command name) kept for a span, plus one */
+#define SERVE_MAGIC 0x53535631 /* first field of a request to the server */
+#define SERVE_BACKLOG 64 /* connections awaiting the server */
+#define SERVE_STRINGS_MAX (16 << 20) /* largest directory or environment of a request */
+#define SERVE_LEARNED 65536 /* bytes of command locations handed back by a finished request */
+#define SERVE_REQUEST -1 /* returned by serve_run() within the copy running a request */
 
-/* structure to hold information relevant to the current command being evaluated/executed */
+/* records the time taken by a statement as a span, when tracing (--trace), see trace.c */
+#define TRACE(category, name, detail, ...) do { \
+        if (__builtin_expect(trace_enabled, 0)) { \
+            long long trace_start = trace_now(); \
+            __VA_ARGS__; \
+            trace_span(category, name, detail, trace_start); \
+        } else { \
+            __VA_ARGS__; \
+        } \
+    } while (0)
+
+/* streams redirected by a redirection operator, see scan_redirection() */
+#define TOKEN_STDIN 0x1
+#define TOKEN_STDOUT 0x2
+#define TOKEN_STDERR 0x4
+#define TOKEN_APPEND 0x8
+
+/* properties of a built-in function */
+#define BUILTIN_REDIRECT 0x1 /* supports i/o redirection */
+#define BUILTIN_PIPELINE 0x2 /* can run within the shell as a pipeline stage */
+#define BUILTIN_PARENT 0x4 /* must run within the shell itself, never a copy of it */
+#define BUILTIN_PREFIX 0x8 /* applies to the pipeline which follows it, e.g. time */
+
+/* kinds of token within a compiled pattern */
+#define GLOB_CHAR 0
+#define GLOB_ANY 1
+#define GLOB_STAR 2
+#define GLOB_SET 3
+
+/* properties of a shell variable being set */
+#define VAR_EXPORT 0x1 /* placed in the environment of programs launched */
+#define VAR_IMPORTED 0x2 /* already in the shell's own environment */
+
+/* properties of a command in a compiled batch file */
+#define COMPILED_BUILTIN 0x1
+#define COMPILED_BACKGROUND 0x2
+#define COMPILED_STDOUT_APPEND 0x4
+#define COMPILED_STDERR_APPEND 0x8
+
+/* settings applied to a process before it executes, given by pin, nice and limit */
+typedef struct Placement {
+    cpu_set_t cpus; /* processors the process may run on */
+    int nice; /* adjustment of the niceness, made absolute when launched */
+    int limit_count;
+    int resources[PLACEMENT_LIMITS]; /* RLIMIT_... */
+    struct rlimit limits[PLACEMENT_LIMITS];
+    unsigned short has_cpus : 1;
+    unsigned short has_nice : 1;
+    unsigned short round_robin : 1; /* each launch runs on the next of the cpus in turn */
+} Placement;
+
+/* structure to hold information relevant to a command being evaluated/executed */
 typedef struct Command {
+    struct Command* next; /* following stage of the pipeline */
     unsigned short is_stderr_append : 1;
     unsigned short is_stdout_append : 1;
     unsigned short is_background : 1;
+    unsigned short is_external : 1; /* known not to be a built-in function, see compile.c */
     char* file_stdin;
     char* file_stdout;
     char* file_stderr;
-    char* args[MAX_ARGS];
-    char** arg;
+    int fd_stdin; /* pipe to read from when part of a pipeline, else -1 */
+    int fd_stdout; /* pipe to write to when part of a pipeline, else -1 */
+    int fd_stderr; /* descriptor to write errors to, e.g. when captured by memo, else -1 */
+    char* here_delimiter; /* ends the body of a here-document (<<EOF), see here.c */
+    char* here_text; /* text of a here-document or here-string, given as stdin */
+    size_t here_length;
+    Placement* placement; /* given by pin, nice or limit, else NULL */
+    int argc;
+    int capacity;
+    char** args; /* NULL terminated */
 } Command;
 
-extern FILE *input_file;
-extern Command cmd;
+/* commands parsed from a single line, joined by pipes */
+typedef struct Pipeline {
+    Command* first;
+    int length;
+} Pipeline;
+
+/* entry in the registry of built-in functions */
+typedef struct Builtin {
+    const char* name;
+    void (*function)(Command*, char**);
+    unsigned int flags;
+    struct Builtin* next;
+} Builtin;
+
+/* way of finding the bounds of tokens, see scan.c */
+typedef struct ScanEngine {
+    const char* name;
+    char* (*skip)(const char*); /* first byte which is not whitespace */
+    char* (*end)(const char*); /* first whitespace, | or NULL */
+    int (*supported)(void); /* or NULL if always supported */
+} ScanEngine;
+
+/* position of the tokenizer within a line */
+typedef struct Scanner {
+    char* cursor;
+    unsigned short pending_pipe : 1;
+} Scanner;
+
+/* block of memory within an arena */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+/* bump allocator, released all at once */
+typedef struct Arena {
+    ArenaBlock* first;
+    ArenaBlock* current;
+    void* last; /* most recent allocation */
+} Arena;
+
+/* buffered writer used by built-in functions to produce output */
+typedef struct Output {
+    int fd;
+    size_t length;
+    unsigned short failed : 1;
+    char buffer[OUTPUT_BUFFER];
+} Output;
+
+/* entry in the table of resolved command locations */
+typedef struct PathEntry {
+    struct PathEntry* next;
+    char* name;
+    char* path;
+    unsigned int hits;
+} PathEntry;
+
+/* source of input lines, either a mapped batch file or a stream */
+typedef struct Input {
+    int fd;
+    size_t limit; /* longest line accepted */
+    size_t length; /* length of the last line returned */
+    char* map;
+    size_t map_size;
+    size_t position;
+    size_t released;
+    char* buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+    int error;
+    unsigned short eof : 1;
+    unsigned short skipping : 1;
+    unsigned short shared : 1; /* commands read the descriptor too, its offset follows the lines */
+} Input;
+
+/* process belonging to a background job */
+typedef struct JobProcess {
+    pid_t pid;
+    int pidfd; /* watched by the job event loop, -1 if unavailable or reaped */
+    int status;
+    struct timespec start;
+    char name[METRICS_NAME_MAX + 1]; /* argv[0], for the metrics log */
+    unsigned short running : 1;
+} JobProcess;
+
+/* process launched in parallel which has not yet been reaped */
+typedef struct ParallelProcess {
+    pid_t pid;
+    struct timespec start;
+    char name[METRICS_NAME_MAX + 1]; /* argv[0], for the metrics log */
+} ParallelProcess;
+
+/* command launched by the parallel built-in, until its output has been written */
+typedef struct ParallelItem {
+    struct ParallelItem* next; /* among the finished items whose output is held back */
+    unsigned long index; /* position of the item within the input */
+    char* item; /* line of input substituted for {} */
+    pid_t pid; /* -1 if it could not be launched */
+    int output; /* pipe the command's stdout is captured from, -1 once closed */
+    int status; /* as reported by wait4 */
+    struct timespec start;
+    char* data; /* output held back while another item's output is being written */
+    size_t length;
+    size_t capacity;
+} ParallelItem;
+
+/* state of the parallel built-in */
+typedef struct ParallelRun {
+    Command* command; /* command to run for every item, containing {} */
+    char** env;
+    int jobs; /* maximum number of commands running at once */
+    int count; /* number running */
+    ParallelItem** running;
+    ParallelItem** polled; /* running when the outputs were last polled */
+    struct pollfd* polls;
+    ParallelItem* owner; /* item whose output is written as it is produced */
+    ParallelItem* finished; /* finished items whose output is held back, in the order written */
+    unsigned long next; /* with -k, index of the item whose output is written next */
+    unsigned long items;
+    unsigned long failed;
+    int input; /* stdin of the commands */
+    int errors; /* stderr of the commands, -1 to share the shell's */
+    char* buffer;
+    unsigned short ordered : 1; /* output is written in the order of the input (-k) */
+    Output out;
+} ParallelRun;
+
+/* measurement taken by the time built-in */
+typedef struct Timing {
+    struct timespec start;
+    struct rusage self; /* usage of the shell itself when the measurement started */
+    struct timeval utime; /* accumulated from the child processes reaped */
+    struct timeval stime;
+    long maxrss;
+} Timing;
+
+/* command or pipeline launched in the background */
+typedef struct Job {
+    struct Job* next;
+    int id;
+    char* command; /* as typed, for display */
+    int running; /* processes not yet reaped */
+    int status; /* status of the last process */
+    int count;
+    JobProcess processes[];
+} Job;
+
+/* span of the shell's work recorded when tracing, see trace.c */
+typedef struct TraceSpan {
+    const char* category;
+    const char* name;
+    long long start; /* nanoseconds, monotonic */
+    long long end;
+    char detail[TRACE_DETAIL];
+} TraceSpan;
+
+/* log of a job's output, shared by its stdout and stderr streams */
+typedef struct MuxLog {
+    int fd;
+    int references; /* streams still writing to it */
+    long long written;
+    long long cap; /* bytes written before the log is truncated */
+    unsigned short truncated : 1;
+} MuxLog;
+
+/* stdout or stderr of a background job, read by the output thread (see mux.c) */
+typedef struct MuxStream {
+    struct MuxStream* next;
+    int fd; /* read end of the pipe the job writes to */
+    int target; /* STDOUT_FILENO or STDERR_FILENO */
+    int job; /* id of the job, written before each line */
+    MuxLog* log; /* or NULL */
+    size_t head; /* offset of the first byte held within ring */
+    size_t length; /* bytes held */
+    size_t scanned; /* bytes held already known to hold no newline */
+    char ring[MUX_RING];
+} MuxStream;
+
+/* file held open for appending, see redirect.c */
+typedef struct RedirectEntry {
+    char* path; /* as written in the redirection, NULL if the entry is unused */
+    int fd;
+    dev_t dev; /* identity of the file, to notice when the path is replaced */
+    ino_t ino;
+    unsigned long used;
+} RedirectEntry;
+
+/* request sent to the spawn helper, followed by its strings, see zygote.c */
+typedef struct ZygoteRequest {
+    size_t length; /* bytes of strings following the request */
+    int argc;
+    int envc;
+    int placed; /* whether the placement is to be applied */
+    Placement placement;
+} ZygoteRequest;
+
+/* reply from the spawn helper */
+typedef struct ZygoteReply {
+    pid_t pid; /* -1 if no process was created */
+    int error; /* errno value if the command could not be executed, else 0 */
+} ZygoteReply;
+
+/* request sent by a client to the server, followed by its strings, see serve.c */
+typedef struct ServeRequest {
+    int magic; /* SERVE_MAGIC */
+    int envc; /* variables within the environment */
+    size_t cwd_length; /* bytes of the current directory, including its terminator */
+    size_t env_length; /* bytes of the environment, each variable NULL terminated */
+} ServeRequest;
+
+/* request being run by a copy of the server */
+typedef struct ServeWorker {
+    struct ServeWorker* next;
+    pid_t pid;
+    int connection; /* to the client, the exit status is written to it */
+    int learned; /* pipe the copy hands the commands it found back through, see path_share() */
+} ServeWorker;
+
+/* entry of a directory read while expanding patterns, see glob.c */
+typedef struct GlobEntry {
+    char* name;
+    unsigned char type; /* d_type, DT_UNKNOWN if the file system does not provide it */
+} GlobEntry;
+
+/* directory read while expanding the patterns of a line */
+typedef struct GlobDirectory {
+    struct GlobDirectory* next; /* within its bucket */
+    char* path;
+    GlobEntry* entries;
+    size_t count;
+    int readable;
+} GlobDirectory;
+
+/* directories read for a line, shared by every pattern within it */
+typedef struct GlobCache {
+    GlobDirectory** buckets; /* GLOB_CACHE_SIZE, allocated when first needed */
+} GlobCache;
+
+/* element of a compiled pattern */
+typedef struct GlobToken {
+    unsigned char type; /* GLOB_* */
+    unsigned char c; /* for GLOB_CHAR */
+    unsigned char* set; /* for GLOB_SET, a bit for every byte value matched */
+} GlobToken;
+
+/* component of a pattern, between two / */
+typedef struct GlobPattern {
+    GlobToken* tokens;
+    int count;
+    char* text;
+    unsigned int wild : 1; /* holds a wildcard, else text is just a name */
+    unsigned int dot : 1; /* starts with ., so may match hidden names */
+    unsigned int recursive : 1; /* ** */
+} GlobPattern;
+
+/* expansion of a single argument */
+typedef struct GlobState {
+    Arena* arena;
+    GlobCache* cache;
+    GlobPattern* patterns;
+    int count;
+    int directories; /* pattern ends with /, only directories match */
+    char** results;
+    size_t length;
+    size_t capacity;
+    int failed;
+} GlobState;
+
+/* shell variable, see vars.c */
+typedef struct Variable {
+    struct Variable* next; /* within its bucket */
+    struct Variable* following; /* in order of creation */
+    char* entry; /* NAME=value */
+    size_t name_length;
+    unsigned short exported : 1;
+} Variable;
+
+/* header of a compiled batch file, see compile.c */
+typedef struct CompiledHeader {
+    char magic[8];
+    uint32_t builtins; /* fingerprint of the built-in functions it was compiled against */
+    uint32_t lines;
+    uint64_t source_hash; /* FNV-1a of the batch file */
+    int64_t source_mtime; /* modification time of the batch file, in nanoseconds */
+    uint64_t source_size;
+    uint64_t strings; /* offset of the strings, following the records */
+    uint64_t length; /* size of the compiled file */
+} CompiledHeader;
+
+/* compiled batch file being executed */
+typedef struct Compiled {
+    char* map; /* NULL if no compiled file is loaded */
+    size_t size;
+    const uint32_t* records;
+    size_t words; /* number of words of records */
+    size_t position; /* next word to read */
+    char* strings;
+    size_t strings_size;
+} Compiled;
+
+/* compiled batch file being written */
+typedef struct CompiledWriter {
+    Output out; /* receives the header and records */
+    size_t words; /* number of words of records written */
+    char* strings; /* written once the records are complete */
+    size_t length;
+    size_t capacity;
+    int failed;
+} CompiledWriter;
+
+/* header of an entry in the memo store, followed by its key, stdout and stderr */
+typedef struct MemoHeader {
+    char magic[8];
+    size_t key_length;
+    size_t out_length;
+    size_t err_length;
+    int status; /* as reported by wait4 */
+} MemoHeader;
+
+/* key or captured output of a memoized command */
+typedef struct MemoBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int overflow; /* exceeded MEMO_CAPTURE_MAX, the data has been discarded */
+} MemoBuffer;
+
+/* entry of the memo store examined for eviction */
+typedef struct MemoFile {
+    char name[17];
+    off_t size;
+    struct timespec used;
+} MemoFile;
+
+/* directory entry being listed */
+typedef struct DirEntry {
+    char* name;
+    int error; /* errno if the entry could not be examined, else 0 */
+    mode_t mode;
+    nlink_t nlink;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    blkcnt_t blocks;
+    time_t mtime;
+    unsigned int rdev_major;
+    unsigned int rdev_minor;
+} DirEntry;
+
+/* entries shared between the threads examining a directory */
+typedef struct DirWork {
+    int dirfd;
+    DirEntry* entries;
+    size_t count;
+    size_t next; /* first entry not yet claimed by a thread */
+} DirWork;
+
+/* width of each column of a listing */
+typedef struct DirWidths {
+    int links;
+    int user;
+    int group;
+    int size;
+    int major;
+    int minor;
+} DirWidths;
+
+/* remembered name of a user or group */
+typedef struct DirName {
+    unsigned int id;
+    unsigned short valid : 1;
+    char name[64];
+} DirName;
+
+extern Input input;
+extern int parallel_jobs;
+extern int mux_enabled;
+extern int trace_enabled;
+extern const char* serve_path;
+extern const ScanEngine scan_engines[];
+extern const ScanEngine* scan_engine;
+extern Arena line_arena;
+extern char **environ;
 
 /* shell.c */
-void process_input(char*);
-void clear_cmd(void);
+Pipeline* process_input(Arena*, char*);
+char* next_token(Scanner*);
+Command* new_command(Arena*);
+int add_argument(Arena*, Command*, char*);
+int is_redirection(const char*);
+void process_redirection(Command*, const char*, char*);
 void setup_input_file(int, char**);
 void setup_env_variables(void);
 void cleanup(void);
 void prompt(void);
-void evaluate_args(char**);
-void do_execute(void);
-void apply_io_redirection(void);
-void flip_filedescriptors(int);
-void redirect_filedescriptors(void);
-void restore_filedescriptors(void);
+void evaluate_args(Pipeline*, char**);
+int prefix_pipeline(Command*, int, Pipeline*);
+void evaluate_command(Command*, char**);
+int has_redirection(Command*);
+void do_execute(Command*);
+void do_pipeline(Pipeline*, char**);
+void close_pipes(Command*);
+void apply_io_redirection(Command*, int[3]);
+int redirect_filedescriptors(Command*, int[3]);
+void restore_filedescriptors(int[3]);
 
 
 /* builtins.c */
-void do_environ(char **);
-void do_dir(void);
-void do_clear(void);
-void do_echo(void);
-__attribute__ ((noreturn)) void quit(void);
-void do_cd(void);
-void do_pause(void);
-void do_help(void);
+void setup_builtins(void);
+int builtin_register(Builtin*);
+const Builtin* builtin_lookup(const char*);
+const Builtin* builtin_find(const char*, size_t);
+const Builtin* command_builtin(Command*);
+uint32_t builtin_fingerprint(void);
+uint32_t builtin_hash(uint32_t, const char*);
+int builtin_stdout(Command*, int[3]);
+int builtin_stdin(Command*, int[3]);
+void builtin_external(Command*);
+void do_cat(Command*, char**);
+void do_tee(Command*, char**);
+void do_environ(Command*, char**);
+void do_dir(Command*, char**);
+void dir_ls(Command*);
+void do_clear(Command*, char**);
+void do_echo(Command*, char**);
+__attribute__ ((noreturn)) void quit(Command*, char**);
+void do_cd(Command*, char**);
+void do_pause(Command*, char**);
+void do_help(Command*, char**);
+void do_export(Command*, char**);
+void do_unset(Command*, char**);
+void do_hash(Command*, char**);
+void do_wait(Command*, char**);
+void do_jobs(Command*, char**);
+void do_time(Command*, char**);
+void do_memo(Command*, char**);
+void do_parallel(Command*, char**);
+void do_pin(Command*, char**);
+void do_nice(Command*, char**);
+void do_limit(Command*, char**);
+
+/* spawn.c */
+pid_t spawn_process(Command*);
+int spawn_start(pid_t*, const char*, Command*, int[3], const Placement*, posix_spawn_file_actions_t*,
+                posix_spawnattr_t*);
+pid_t fork_process(Command*, const char*, int[3], const Placement*);
+char** spawn_environment(void);
+int open_redirections(Command*, int[3]);
+void close_redirections(int[3]);
+pid_t fork_builtin(Command*, Command*, char**);
+int spawn_count(char**);
+void spawn_script(const char*, char**, char**);
+
+/* parallel.c */
+void parallel_setup(int);
+void parallel_reserve(void);
+void parallel_track(Command*, pid_t, const struct timespec*);
+pid_t parallel_reap(void);
+void parallel_wait(void);
+void parallel_record(int);
+int parallel_finish(void);
+int parallel_options(ParallelRun*, Command*);
+void parallel_launch(ParallelRun*, const char*, unsigned long);
+char** parallel_arguments(Command*, const char*);
+void parallel_collect(ParallelRun*);
+void parallel_hold(ParallelItem*, const char*, size_t);
+void parallel_done(ParallelRun*, ParallelItem*);
+void parallel_claim(ParallelRun*, ParallelItem*);
+void parallel_advance(ParallelRun*);
+void parallel_release(ParallelItem*);
+
+/* jobs.c */
+void jobs_setup(void);
+Job* jobs_add(Command*, const pid_t*, int, const struct timespec*);
+void jobs_record(Job*, JobProcess*, int, const struct rusage*);
+void jobs_check(Job*, int);
+int jobs_reaped(pid_t, int, const struct rusage*);
+void jobs_update(void);
+Job* jobs_find(const char*);
+int jobs_wait(Job*);
+void jobs_wait_all(void);
+void jobs_remove(Job*);
+char* jobs_state(Job*, char*, size_t);
+void jobs_print(Output*, int);
+void jobs_notify(void);
+void jobs_free(void);
+
+/* metrics.c */
+void metrics_setup(void);
+void metrics_close(void);
+void metrics_now(struct timespec*);
+long long metrics_nanoseconds(const struct timespec*);
+long long metrics_microseconds(const struct timeval*);
+void metrics_reaped(const char*, pid_t, const struct timespec*, int, const struct rusage*);
+void metrics_escape(char*, size_t, const char*);
+void metrics_time_begin(Timing*);
+void metrics_time_end(Timing*);
+
+/* dir.c */
+void dir_list(Output*, char**);
+void dir_directory(Output*, const char*);
+DirEntry* dir_read(int, const char*, size_t*);
+void dir_stat(int, DirEntry*);
+void dir_stat_all(int, DirEntry*, size_t);
+void* dir_worker(void*);
+int dir_compare(const void*, const void*);
+void dir_widths(DirEntry*, int, DirWidths*);
+void dir_print(Output*, int, DirEntry*, int, const DirWidths*);
+void dir_column(Output*, const char*, int);
+void dir_mode(mode_t, char*);
+const char* dir_user(uid_t);
+const char* dir_group(gid_t);
+
+/* redirect.c */
+int redirect_append(const char*);
+void redirect_close(int);
+void redirect_evict(RedirectEntry*);
+void redirect_clear(void);
+
+/* compile.c */
+int compile_file(const char*, const char*);
+char* compile_here(Input*, CompiledHeader*, char*, size_t*);
+void compile_hash(uint64_t*, const char*, size_t);
+void compile_line(CompiledWriter*, Pipeline*, const char*);
+void compile_word(CompiledWriter*, uint32_t);
+uint32_t compile_string(CompiledWriter*, const char*);
+int compile_open(Compiled*, int, const char*);
+int compile_map(Compiled*, int, const CompiledHeader*);
+int compile_next(Compiled*, Arena*, Pipeline**);
+int compile_read(Compiled*, uint32_t*);
+int compile_damaged(Compiled*);
+char* compile_text(Compiled*, uint32_t);
+void compile_close(Compiled*);
+
+/* placement.c */
+Placement* placement_get(Command*);
+void placement_prefix(Command*, int, char**);
+int placement_cpus(const char*, cpu_set_t*);
+int placement_number(const char*, long long*);
+int placement_limit(Placement*, const char*);
+const Placement* placement_launch(const Placement*, Placement*);
+int placement_apply(const Placement*);
+
+/* mux.c */
+int mux_start(void);
+int mux_prepare(int[2][2]);
+void mux_attach(Job*, int[2][2]);
+MuxLog* mux_log_open(void);
+void mux_log_release(MuxLog*);
+void* mux_loop(void*);
+int mux_read(MuxStream*);
+void mux_lines(MuxStream*);
+void mux_emit(MuxStream*, size_t, int);
+void mux_writev(int, struct iovec*, int);
+void mux_close(MuxStream*);
+void mux_drain(int);
+void mux_stop(void);
+
+/* scan.c */
+void scan_setup(void);
+char* scan_skip_libc(const char*);
+char* scan_end_libc(const char*);
+char* scan_skip_scalar(const char*);
+char* scan_end_scalar(const char*);
+int scan_has_sse2(void);
+int scan_has_avx2(void);
+char* scan_skip_sse2(const char*);
+char* scan_end_sse2(const char*);
+char* scan_skip_avx2(const char*);
+char* scan_end_avx2(const char*);
+int scan_redirection(const char*);
+
+/* serve.c */
+int serve_address(struct sockaddr_un*, const char*);
+int serve_run(const char*);
+int serve_open(const char*);
+int serve_signals(void);
+int serve_accept(void);
+void serve_reap(void);
+int serve_request(int);
+void serve_close(void);
+int serve_client(const char*, const char*);
+
+/* trace.c */
+int trace_open(const char*);
+long long trace_now(void);
+void trace_span(const char*, const char*, const char*, long long);
+void trace_close(void);
+
+/* memo.c */
+void memo_run(Command*);
+int memo_key(MemoBuffer*, Command*, int);
+void memo_identity(MemoBuffer*, const struct stat*);
+void memo_variable(MemoBuffer*, const char*, size_t);
+void memo_append(MemoBuffer*, const char*, size_t);
+const char* memo_directory(void);
+int memo_path(char*, size_t, const MemoBuffer*);
+int memo_replay(const char*, const MemoBuffer*, int[3], int*);
+void memo_capture(Command*, const char*, const MemoBuffer*, int[3], int*);
+void memo_store(const char*, const MemoBuffer*, const MemoBuffer[2], int);
+long long memo_limit(void);
+long memo_evict(long long);
+int memo_compare(const void*, const void*);
+void memo_stats(Command*);
+
+/* zygote.c */
+void zygote_start(void);
+void zygote_stop(int);
+int zygote_spawn(pid_t*, const char*, Command*, int[3], const Placement*);
+int zygote_send(int, ZygoteRequest*, const char*, int[3]);
+int zygote_read(int, void*, size_t);
+void zygote_serve(int) __attribute__ ((noreturn));
+int zygote_launch(ZygoteRequest*, char*, int[3], pid_t*);
+
+/* copy.c */
+int copy_fd(int, int);
+int copy_range(int, int);
+int copy_splice(int, int);
+int copy_sendfile(int, int);
+int copy_buffered(int, int);
+int copy_write(int, const char*, size_t);
+int copy_tee(int, int, const int*, int);
+
+/* here.c */
+int here_read(Arena*, Pipeline*, Input*, char*);
+char* here_line(Input*, char**);
+int here_string(Arena*, Command*, const char*);
+int here_open(const char*, size_t);
+
+/* glob.c */
+int glob_pattern(const char*);
+int glob_expand(Arena*, GlobCache*, Command*, char*);
+int glob_compile(Arena*, GlobPattern*, const char*, size_t);
+int glob_match(const GlobPattern*, const char*);
+void glob_walk(GlobState*, const char*, int);
+GlobDirectory* glob_scan(GlobState*, const char*);
+char* glob_join(GlobState*, const char*, const char*, const char*);
+int glob_exists(const char*, int);
+void glob_add(GlobState*, const char*, const char*);
+int glob_compare(const void*, const void*);
+void glob_free(void);
+
+/* vars.c */
+void var_setup(char**);
+unsigned int var_hash(const char*, size_t);
+size_t var_name_length(const char*);
+Variable* var_find(const char*, size_t);
+const char* var_get(const char*);
+int var_set(const char*, const char*, int);
+int var_store(const char*, size_t, const char*, int);
+void var_unset(const char*);
+char** var_environment(void);
+size_t var_reference(const char*, const char**, size_t*);
+char* var_expand(Arena*, char*);
+int var_assign(Command*);
+void var_free(void);
+
+/* arena.c */
+void* arena_alloc(Arena*, size_t);
+void* arena_grow(Arena*, void*, size_t, size_t);
+void arena_reset(Arena*);
+void arena_free(Arena*);
+
+/* input.c */
+int input_open(Input*, int);
+char* input_line(Input*);
+char* input_map_line(Input*);
+char* input_stream_line(Input*);
+void input_close(Input*);
+
+/* output.c */
+void output_init(Output*, int);
+void output_write(Output*, const char*, size_t);
+void output_string(Output*, const char*);
+void output_flush(Output*);
+
+/* hash.c */
+unsigned int path_hash(const char*);
+void path_check_variable(void);
+char* path_resolve(const char*, char*, size_t);
+const char* path_lookup(const char*);
+PathEntry* path_remember(const char*, const char*);
+void path_forget(const char*);
+void path_clear(void);
+void path_print(void);
+int path_share(int, const char*);
+void path_learn(const char*, size_t);
 
 /* signals.c */
 void setup_signal_handlers(void);
 void restore_signals(void);
-void handle_sigchld(int);
 void handle_sigtstp(int);
 #endif
@@ -0,0 +1,563 @@
+/**
+ * @file serve.c
+ * @brief Server running batch files for clients on a Unix domain socket (--serve, --client).
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * The server is set up once, as the shell is: the built-in functions registered, the location of
+ * the shell read. It then forks a copy of itself for every connection, which runs the client's
+ * batch file as the shell would, many at once. The copy starts with whatever the server knows,
+ * and once it finishes the locations of the commands it found are handed back to the server
+ * (see path_share()), so later requests find them in the table without searching PATH.
+ *
+ * A request holds the client's current directory and environment, followed by the batch file
+ * itself, which is run as it arrives. The client's stdin, stdout and stderr are passed along with
+ * the request (SCM_RIGHTS) and become those of the copy, so output reaches the client directly.
+ * The exit status is written back once the copy has exited. Only clients of the same user (or
+ * root) are served.
+ */
+#include "seashell.h"
+
+/* socket the server listens on (--serve), NULL unless serving */
+const char* serve_path = NULL;
+
+/* listening socket, and the signals the server waits for; closed within a copy */
+static int serve_socket = -1;
+static int serve_signal = -1;
+
+/* requests being run by copies of the server */
+static ServeWorker* serve_workers = NULL;
+
+/* location of the shell, given to every request as SHELL and PARENT */
+static char* serve_shell = NULL;
+
+/* PATH of the server, the locations handed back must have been found with the same */
+static char* serve_variable = NULL;
+
+/* within a copy: pipe the locations of commands are written to as it finishes */
+static int serve_learned = -1;
+
+/* within a copy: the client's current directory and environment */
+static char* serve_strings = NULL;
+static char** serve_environment = NULL;
+
+/**
+ * @brief Fills in the address of a socket.
+ *
+ * @param address destination
+ * @param path location of the socket
+ *
+ * @return 0 on success, -1 if the location is too long
+ */
+int serve_address(struct sockaddr_un* address, const char* path)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+/**
+ * @brief Serves requests until terminated (SIGTERM).
+ *
+ * Once terminated no more connections are accepted, and the server returns when the requests
+ * being run have finished. The copies running a request return SERVE_REQUEST, with the input
+ * reading the client's batch file, the directory and environment being the client's.
+ *
+ * @param path location of the socket to listen on
+ *
+ * @return the exit status of the server, or SERVE_REQUEST within a copy
+ */
+int serve_run(const char* path)
+{
+    sigset_t mask;
+
+    /* the copies are forked from a small process already, they need no helper */
+    zygote_stop(1);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1
+            || (serve_signal = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC)) == -1) {
+        perror("error - unable to watch signals");
+        return EXIT_FAILURE;
+    }
+    if (serve_open(path) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    const char* shell = var_get("SHELL");
+    const char* variable = getenv("PATH");
+    serve_shell = strdup(shell != NULL ? shell : "");
+    serve_variable = (variable != NULL) ? strdup(variable) : NULL;
+
+    #ifdef DEBUG
+    printf("debug: serving on %s\n", path);
+    #endif
+
+    while (serve_socket != -1 || serve_workers != NULL) {
+        struct pollfd polls[2] = {
+            { serve_signal, POLLIN, 0 },
+            { serve_socket, POLLIN, 0 }, /* ignored once closed */
+        };
+
+        if (poll(polls, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("error - server");
+            break;
+        }
+
+        if ((polls[0].revents & POLLIN) && serve_signals() == SIGTERM && serve_socket != -1) {
+            close(serve_socket);
+            serve_socket = -1;
+            unlink(path);
+        }
+        if ((polls[1].revents & POLLIN) && serve_accept() == SERVE_REQUEST) {
+            return SERVE_REQUEST;
+        }
+    }
+
+    if (serve_socket != -1) {
+        unlink(path);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Creates the socket the server listens on.
+ *
+ * A socket left behind by a server which is no longer running is replaced.
+ *
+ * @param path location of the socket
+ *
+ * @return 0 on success, -1 on failure
+ */
+int serve_open(const char* path)
+{
+    struct sockaddr_un address;
+    struct stat info;
+
+    if (serve_address(&address, path) == -1) {
+        fprintf(stderr, "error - unable to listen on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    serve_socket = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+    if (serve_socket == -1) {
+        perror("error - unable to create socket");
+        return -1;
+    }
+
+    while (bind(serve_socket, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        int error = errno;
+        if (error == EADDRINUSE && lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+            int probe = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+            int refused = (probe != -1
+                           && connect(probe, (struct sockaddr*)&address, sizeof(address)) == -1
+                           && errno == ECONNREFUSED);
+            if (probe != -1) {
+                close(probe);
+            }
+            if (refused && unlink(path) == 0) {
+                continue;
+            }
+        }
+        fprintf(stderr, "error - unable to listen on %s: %s\n", path,
+                (error == EADDRINUSE) ? "in use by another server" : strerror(error));
+        close(serve_socket);
+        serve_socket = -1;
+        return -1;
+    }
+
+    if (listen(serve_socket, SERVE_BACKLOG) == -1) {
+        fprintf(stderr, "error - unable to listen on %s: %s\n", path, strerror(errno));
+        close(serve_socket);
+        serve_socket = -1;
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the signals received by the server, reaping the copies which have exited.
+ *
+ * @return SIGTERM if the server was asked to terminate, else 0
+ */
+int serve_signals(void)
+{
+    struct signalfd_siginfo info;
+    int terminate = 0;
+
+    while (read(serve_signal, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGTERM) {
+            terminate = 1;
+        }
+    }
+
+    /* SIGCHLD is not queued, several copies may have exited for a single one */
+    serve_reap();
+    return terminate ? SIGTERM : 0;
+}
+
+/**
+ * @brief Accepts every pending connection, forking a copy of the server to run each request.
+ *
+ * @return SERVE_REQUEST within a copy, else 0
+ */
+int serve_accept(void)
+{
+    while (1) {
+        struct ucred peer;
+        socklen_t length = sizeof(peer);
+        int learned[2];
+
+        int connection = accept4(serve_socket, NULL, NULL, SOCK_CLOEXEC);
+        if (connection == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("error - unable to accept connection");
+            }
+            return 0;
+        }
+
+        if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &length) == -1
+                || (peer.uid != geteuid() && peer.uid != 0)) {
+            fprintf(stderr, "error - refused a connection from another user\n");
+            close(connection);
+            continue;
+        }
+
+        ServeWorker* worker = malloc(sizeof(ServeWorker));
+        if (worker == NULL || pipe2(learned, O_CLOEXEC|O_NONBLOCK) == -1) {
+            perror("error - unable to serve request");
+            free(worker);
+            close(connection);
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(learned[0]);
+            free(worker);
+            serve_learned = learned[1];
+            if (serve_request(connection) == -1) {
+                cleanup();
+                exit(EXIT_FAILURE);
+            }
+            return SERVE_REQUEST;
+        }
+
+        close(learned[1]);
+        if (pid == -1) {
+            perror("error - unable to serve request");
+            close(learned[0]);
+            close(connection);
+            free(worker);
+            continue;
+        }
+
+        #ifdef DEBUG
+        printf("debug: serving pid %d with pid %d\n", (int)peer.pid, (int)pid);
+        #endif
+
+        worker->pid = pid;
+        worker->connection = connection;
+        worker->learned = learned[0];
+        worker->next = serve_workers;
+        serve_workers = worker;
+    }
+}
+
+/**
+ * @brief Reaps the copies of the server which have exited, writing their exit status to their
+ * clients, and adding the locations of the commands they found to the table.
+ */
+void serve_reap(void)
+{
+    static char pairs[SERVE_LEARNED];
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        ServeWorker* worker = NULL;
+        for (ServeWorker** link = &serve_workers; *link != NULL; link = &(*link)->next) {
+            if ((*link)->pid == pid) {
+                worker = *link;
+                *link = worker->next;
+                break;
+            }
+        }
+        if (worker == NULL) {
+            continue;
+        }
+
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if (send(worker->connection, &code, sizeof(code), MSG_NOSIGNAL|MSG_DONTWAIT) == -1) {
+            #ifdef DEBUG
+            printf("debug: client of pid %d has gone\n", (int)pid);
+            #endif
+        }
+
+        /* whole pairs only, the copy writes as much as the pipe takes */
+        size_t size = 0;
+        ssize_t count;
+        while (size < sizeof(pairs)
+                && (count = read(worker->learned, pairs + size, sizeof(pairs) - size)) > 0) {
+            size += (size_t)count;
+        }
+        path_learn(pairs, size);
+
+        close(worker->connection);
+        close(worker->learned);
+        free(worker);
+    }
+}
+
+/**
+ * @brief Prepares a copy of the server to run the request received on a connection.
+ *
+ * The copy drops what belongs to the server, takes on the client's standard streams, current
+ * directory and environment, and reads the rest of the connection as its input.
+ *
+ * @param connection connection to the client
+ *
+ * @return 0 on success, -1 on failure
+ */
+int serve_request(int connection)
+{
+    ServeRequest request;
+    int streams[3] = { -1, -1, -1 };
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec part = { &request, sizeof(request) };
+    struct msghdr message = {
+        .msg_iov = &part,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    sigset_t mask;
+
+    /* nothing of the server is needed, nor any other request */
+    close(serve_socket);
+    close(serve_signal);
+    serve_socket = serve_signal = -1;
+    while (serve_workers != NULL) {
+        ServeWorker* worker = serve_workers;
+        serve_workers = worker->next;
+        close(worker->connection);
+        close(worker->learned);
+        free(worker);
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+    /* the job event loop must not be shared with the server */
+    jobs_free();
+    jobs_setup();
+
+    ssize_t count;
+    while ((count = recvmsg(connection, &message, MSG_CMSG_CLOEXEC|MSG_WAITALL)) == -1
+           && errno == EINTR);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (header != NULL && header->cmsg_type == SCM_RIGHTS
+            && header->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+        memcpy(streams, CMSG_DATA(header), 3 * sizeof(int));
+    }
+    if (count != sizeof(request) || request.magic != SERVE_MAGIC || streams[0] == -1
+            || request.cwd_length == 0 || request.envc < 0
+            || request.cwd_length > SERVE_STRINGS_MAX || request.env_length > SERVE_STRINGS_MAX) {
+        fprintf(stderr, "error - malformed request\n");
+        return -1;
+    }
+
+    size_t length = request.cwd_length + request.env_length;
+    serve_strings = malloc(length + 1);
+    serve_environment = calloc((size_t)request.envc + 1, sizeof(char*));
+    if (serve_strings == NULL || serve_environment == NULL
+            || zygote_read(connection, serve_strings, length) == -1) {
+        fprintf(stderr, "error - malformed request\n");
+        return -1;
+    }
+    serve_strings[length] = '\0';
+
+    /* the client's streams replace the server's, moved clear of 0-2 first in case they overlap */
+    for (int i = 0; i < 3; i++) {
+        if (streams[i] <= STDERR_FILENO) {
+            streams[i] = fcntl(streams[i], F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        if (streams[i] == -1 || dup2(streams[i], i) == -1) {
+            perror("error - unable to use the client's streams");
+            return -1;
+        }
+        close(streams[i]);
+    }
+
+    /* unpack the strings: the directory, then the NULL terminated variables */
+    char* cwd = serve_strings;
+    char* next = cwd + strnlen(cwd, request.cwd_length) + 1;
+    char* end = serve_strings + length;
+    int envc = 0;
+    while (envc < request.envc && next < end) {
+        serve_environment[envc++] = next;
+        next += strlen(next) + 1;
+    }
+    serve_environment[envc] = NULL;
+
+    if (chdir(cwd) == -1) {
+        fprintf(stderr, "error - cannot change directory to %s: %s\n", cwd, strerror(errno));
+        return -1;
+    }
+
+    /* variables of the server are not the client's */
+    environ = serve_environment;
+    var_free();
+    var_setup(serve_environment);
+    var_set("SHELL", serve_shell, VAR_EXPORT);
+    var_set("PARENT", serve_shell, VAR_EXPORT);
+
+    if (input_open(&input, connection) == -1) {
+        perror("error - cannot read input");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands the locations of the commands found back to the server, within a copy, and
+ * releases everything used by the server.
+ */
+void serve_close(void)
+{
+    if (serve_learned != -1) {
+        if (path_share(serve_learned, serve_variable) == -1) {
+            #ifdef DEBUG
+            printf("debug: not every command location was handed back\n");
+            #endif
+        }
+        close(serve_learned);
+        serve_learned = -1;
+    }
+    if (serve_socket != -1) {
+        close(serve_socket);
+        serve_socket = -1;
+    }
+    if (serve_signal != -1) {
+        close(serve_signal);
+        serve_signal = -1;
+    }
+    free(serve_shell);
+    free(serve_variable);
+    serve_shell = serve_variable = NULL;
+}
+
+/**
+ * @brief Sends a batch file to a server, which runs it as though the shell were run here.
+ *
+ * @param path location of the server's socket
+ * @param script batch file, or NULL to send stdin
+ *
+ * @return the exit status of the batch file, or EXIT_FAILURE if it could not be run
+ */
+int serve_client(const char* path, const char* script)
+{
+    struct sockaddr_un address;
+    ServeRequest request = { SERVE_MAGIC, 0, 0, 0 };
+    int streams[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec part = { &request, sizeof(request) };
+    struct msghdr message = {
+        .msg_iov = &part,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    char cwd[PATH_MAX];
+    int status = EXIT_FAILURE;
+    int batch = STDIN_FILENO;
+    char* strings = NULL;
+
+    if (script != NULL && (batch = open(script, O_RDONLY|O_CLOEXEC)) == -1) {
+        perror("error - cannot open batch file");
+        return EXIT_FAILURE;
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("error - cannot determine the current directory");
+        goto done;
+    }
+
+    /* the directory and environment follow the request */
+    request.cwd_length = strlen(cwd) + 1;
+    for (char** var = environ; *var != NULL; var++) {
+        request.env_length += strlen(*var) + 1;
+        request.envc++;
+    }
+    strings = malloc(request.cwd_length + request.env_length);
+    if (strings == NULL) {
+        perror("error - unable to send request");
+        goto done;
+    }
+    char* next = memcpy(strings, cwd, request.cwd_length);
+    next += request.cwd_length;
+    for (char** var = environ; *var != NULL; var++) {
+        size_t length = strlen(*var) + 1;
+        memcpy(next, *var, length);
+        next += length;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (fd == -1 || serve_address(&address, path) == -1
+            || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        fprintf(stderr, "error - unable to connect to %s: %s\n", path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        goto done;
+    }
+
+    memset(control, 0, sizeof(control));
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(header), streams, 3 * sizeof(int));
+
+    if (sendmsg(fd, &message, MSG_NOSIGNAL) != sizeof(request)
+            || copy_write(fd, strings, request.cwd_length + request.env_length) == -1) {
+        perror("error - unable to send request");
+        close(fd);
+        goto done;
+    }
+
+    /* the batch file is run as it arrives; the server may stop reading it early (quit) */
+    if (copy_fd(batch, fd) == -1 && errno != EPIPE && errno != ECONNRESET) {
+        perror("error - unable to send batch file");
+    }
+    shutdown(fd, SHUT_WR);
+
+    if (zygote_read(fd, &status, sizeof(status)) == -1) {
+        fprintf(stderr, "error - the server closed the connection\n");
+        status = EXIT_FAILURE;
+    }
+    close(fd);
+
+done:
+    free(strings);
+    if (batch != STDIN_FILENO) {
+        close(batch);
+    }
+    return status;
+}
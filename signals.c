@@ -17,8 +17,18 @@ void setup_signal_handlers() {
         cleanup();
         exit(EXIT_FAILURE);
     }
-    if (signal(SIGCHLD, handle_sigchld) == SIG_ERR) {
-        perror("error - unable to set SIGCHILD handler");
+    /* ignore SIGPIPE, writes to a closed pipe are reported as EPIPE instead */
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        perror("error - unable to set SIGPIPE handler");
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
+    /* block SIGCHLD, children are reaped through the job event loop (see jobs.c) */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("error - unable to block SIGCHILD");
         cleanup();
         exit(EXIT_FAILURE);
     }
@@ -33,11 +43,22 @@ void setup_signal_handlers() {
  * @brief Restores signals to default handler functions.
  */
 void restore_signals() {
+    sigset_t mask;
+
+    /* SIGCHLD is blocked by the shell */
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
     if (signal(SIGINT, SIG_DFL) == SIG_ERR) {
         perror("error - unable to restore SIGINT handler");
         cleanup();
         exit(EXIT_FAILURE);
     }
+    if (signal(SIGPIPE, SIG_DFL) == SIG_ERR) {
+        perror("error - unable to restore SIGPIPE handler");
+        cleanup();
+        exit(EXIT_FAILURE);
+    }
     if (signal(SIGCHLD, SIG_DFL) == SIG_ERR) {
         perror("error - unable to restore SIGCHILD handler");
         cleanup();
@@ -50,24 +71,13 @@ void restore_signals() {
     }
 }
 
-/**
- * @brief Handler function to be executed upon receiving signal SIGCHLD.
- *
- * Receives the status from a child, allowing it to terminate completely (instead of getting
- * stuck as a zombie).
- */
-void handle_sigchld() {
-    int status = 0;
-    /* receive status without hanging parent */
-    while(waitpid(-1, &status, WNOHANG) > 0);
-}
-
 /**
  * @brief Handler function to be executed upon receiving signal SIGSTP.
  *
  * Prints a message to the user informing them this shell does not support being placed in the
  * background, nor does it support the suspension of child processes.
  */
-void handle_sigtstp() {
+void handle_sigtstp(int sig) {
+    (void)sig;
     printf("\nCtrl+z is not enabled in this shell.\n");
 }
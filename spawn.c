@@ -0,0 +1,390 @@
+/**
+ * @file spawn.c
+ * @brief Launching of external processes.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ */
+#include "seashell.h"
+
+/**
+ * @brief Launches a command as a new process without copying the shell.
+ *
+ * posix_spawn creates the child with clone(CLONE_VM|CLONE_VFORK), so no page tables are copied
+ * regardless of how large the shell has grown. Signal resets are expressed as spawn attributes
+ * and i/o redirection as spawn file actions. The executable is located through the PATH hash
+ * table rather than by trying every PATH directory in turn. When the shell was started with -z the
+ * process is created by the spawn helper (zygote.c) instead. If the spawn engine is unavailable,
+ * or the command has a placement (pin, nice or limit) which posix_spawn can not apply, the
+ * traditional fork path is used instead.
+ *
+ * @param command command to launch
+ *
+ * @return pid of the new process, or -1 if it could not be launched
+ */
+pid_t spawn_process(Command* command)
+{
+    const char* path = *command->args;
+
+    /* names without a '/' are located through the PATH hash table */
+    if (strchr(path, '/') == NULL) {
+        path = path_lookup(*command->args);
+        if (path == NULL) {
+            errno = ENOENT;
+            perror("error - unable to execute external program");
+            return -1;
+        }
+    }
+
+    int fds[3] = { -1, -1, -1 };
+    Placement launch;
+    const Placement* placement = placement_launch(command->placement, &launch);
+
+    /* open redirection targets in the parent so failures are reported accurately */
+    int opened;
+    TRACE("exec", "redirect", command->args[0], opened = open_redirections(command, fds));
+    if (opened == -1) {
+        return -1;
+    }
+
+    #ifdef FORK_SPAWN
+    pid_t pid = fork_process(command, path, fds, placement);
+    close_redirections(fds);
+    return pid;
+    #else
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults, mask;
+    pid_t pid = -1;
+    int error;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    /* equivalent of restore_signals() */
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF|POSIX_SPAWN_SETSIGMASK);
+
+    /* equivalent of apply_io_redirection(), files take precedence over pipes */
+    if (command->fd_stdin != -1 && fds[0] == -1) {
+        posix_spawn_file_actions_adddup2(&actions, command->fd_stdin, STDIN_FILENO);
+    }
+    if (command->fd_stdout != -1 && fds[1] == -1) {
+        posix_spawn_file_actions_adddup2(&actions, command->fd_stdout, STDOUT_FILENO);
+    }
+    if (command->fd_stderr != -1 && fds[2] == -1) {
+        posix_spawn_file_actions_adddup2(&actions, command->fd_stderr, STDERR_FILENO);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1) {
+            posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+        }
+    }
+
+    error = spawn_start(&pid, path, command, fds, placement, &actions, &attr);
+
+    /* a hashed location which has since disappeared, search PATH again */
+    if (error == ENOENT && path != *command->args) {
+        path_forget(*command->args);
+        path = path_lookup(*command->args);
+        if (path != NULL) {
+            error = spawn_start(&pid, path, command, fds, placement, &actions, &attr);
+        }
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (error == EAGAIN || error == ENOMEM || error == ENOSYS) {
+        /* the spawn engine could not create the process, fall back to fork */
+        #ifdef DEBUG
+        printf("debug: posix_spawn failed (%s), falling back to fork\n", strerror(error));
+        #endif
+        pid = fork_process(command, path, fds, placement);
+    } else if (error != 0) {
+        errno = error;
+        perror("error - unable to execute external program");
+        pid = -1;
+    }
+
+    close_redirections(fds);
+    return pid;
+    #endif
+}
+
+/**
+ * @brief Creates the process for a command, through the spawn helper if there is one.
+ *
+ * @param pid destination for the process id
+ * @param path location of the executable
+ * @param command command to launch
+ * @param fds descriptors opened by open_redirections()
+ * @param placement settings to apply to the process, or NULL
+ * @param actions file actions applying the redirections, used without the helper
+ * @param attr attributes resetting signals, used without the helper
+ *
+ * @return 0 on success, else an errno value (ENOSYS if only fork can apply the placement)
+ */
+int spawn_start(pid_t* pid, const char* path, Command* command, int fds[3],
+                const Placement* placement, posix_spawn_file_actions_t* actions,
+                posix_spawnattr_t* attr)
+{
+    /* the helper is handed the descriptors to use, files take precedence over pipes */
+    int streams[3] = {
+        fds[0] != -1 ? fds[0] : command->fd_stdin != -1 ? command->fd_stdin : STDIN_FILENO,
+        fds[1] != -1 ? fds[1] : command->fd_stdout != -1 ? command->fd_stdout : STDOUT_FILENO,
+        fds[2] != -1 ? fds[2] : command->fd_stderr != -1 ? command->fd_stderr : STDERR_FILENO,
+    };
+
+    int error = zygote_spawn(pid, path, command, streams, placement);
+    if (error != ESRCH) {
+        return error;
+    }
+    if (placement != NULL) {
+        return ENOSYS;
+    }
+    error = posix_spawn(pid, path, actions, attr, command->args, spawn_environment());
+    if (error == ENOEXEC) {
+        char* script[spawn_count(command->args) + 2];
+        spawn_script(path, command->args, script);
+        error = posix_spawn(pid, SPAWN_SHELL, actions, attr, script, spawn_environment());
+    }
+    return error;
+}
+
+/**
+ * @brief Counts the arguments of a command.
+ *
+ * @param args NULL terminated arguments
+ *
+ * @return number of arguments
+ */
+int spawn_count(char** args)
+{
+    int count = 0;
+    while (args[count] != NULL) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Builds the arguments running an executable file which is not a program (e.g. a script
+ * without a #! line) through SPAWN_SHELL, as execvp does.
+ *
+ * @param path location of the file
+ * @param args arguments of the command
+ * @param script destination, with room for the arguments plus two
+ */
+void spawn_script(const char* path, char** args, char** script)
+{
+    script[0] = SPAWN_SHELL;
+    script[1] = (char*)path;
+    for (int i = 1; ; i++) {
+        script[i + 1] = args[i];
+        if (args[i] == NULL) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Launches a command using fork and exec.
+ *
+ * The child has appropriate actions performed upon it including, restoration of signal handlers,
+ * application of the placement (processor affinity, niceness, resource limits), application of
+ * i/o redirection ...
+ *
+ * @param command command to launch
+ * @param path location of the executable
+ * @param fds descriptors opened by open_redirections()
+ * @param placement settings to apply to the process, or NULL
+ *
+ * @return pid of the new process, or -1 if it could not be launched
+ */
+pid_t fork_process(Command* command, const char* path, int fds[3], const Placement* placement)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        restore_signals();
+        if (placement != NULL && placement_apply(placement) == -1) {
+            perror("error - unable to apply pin, nice or limit");
+            cleanup();
+            exit(EXIT_FAILURE);
+        }
+        apply_io_redirection(command, fds);
+        execve(path, command->args, spawn_environment());
+        if (errno == ENOEXEC) {
+            char* script[spawn_count(command->args) + 2];
+            spawn_script(path, command->args, script);
+            execve(SPAWN_SHELL, script, spawn_environment());
+        }
+        perror("error - unable to execute external program");
+        cleanup();
+        exit(EXIT_FAILURE);
+    } else if (pid < 0) {
+        perror("error - unable to execute external program");
+    }
+
+    return pid;
+}
+
+/**
+ * @brief Runs a built-in function within a forked copy of the shell.
+ *
+ * Used for pipeline stages which cannot run within the shell itself. The pipes (or other
+ * descriptors, e.g. those of parallel) of the stage become the standard streams of the copy, which
+ * closes those of every other stage: it never executes anything, so close-on-exec would leave it
+ * holding, e.g., the write end of its own input, which would then never end. The placement of the
+ * command, if any, is applied to the copy.
+ *
+ * @param command built-in function to run
+ * @param first first stage of the pipeline the command belongs to, or NULL
+ * @param env list environment variables provided to program
+ *
+ * @return pid of the new process, or -1 if it could not be created
+ */
+pid_t fork_builtin(Command* command, Command* first, char** env)
+{
+    Placement launch;
+    const Placement* placement = placement_launch(command->placement, &launch);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        /* commands launched by the copy must be its own children */
+        zygote_stop(0);
+        restore_signals();
+        for (Command* stage = first; stage != NULL; stage = stage->next) {
+            if (stage != command) {
+                close_pipes(stage);
+            }
+        }
+        if (command->fd_stdin != -1) {
+            dup2(command->fd_stdin, STDIN_FILENO);
+            command->fd_stdin = -1;
+        }
+        if (command->fd_stdout != -1) {
+            dup2(command->fd_stdout, STDOUT_FILENO);
+            command->fd_stdout = -1;
+        }
+        if (command->fd_stderr != -1) {
+            dup2(command->fd_stderr, STDERR_FILENO);
+            command->fd_stderr = -1;
+        }
+        if (placement != NULL && placement_apply(placement) == -1) {
+            perror("error - unable to apply pin, nice or limit");
+            _exit(EXIT_FAILURE);
+        }
+        command->placement = NULL;
+        evaluate_command(command, env);
+        fflush(stdout);
+        /* skip cleanup(), the batch file is shared with the shell */
+        _exit(EXIT_SUCCESS);
+    } else if (pid < 0) {
+        perror("error - unable to execute built-in function");
+    }
+
+    return pid;
+}
+
+/**
+ * @brief Builds the environment handed to spawned processes.
+ *
+ * This is every exported shell variable, see var_environment(); the list is only rebuilt when
+ * one of them has changed.
+ *
+ * @return NULL terminated environment list, valid until an exported variable changes
+ */
+char** spawn_environment(void)
+{
+    return var_environment();
+}
+
+/**
+ * @brief Opens the files named by a command's redirections.
+ *
+ * The descriptors are opened close-on-exec, the child only ever receives the dup2'ed copies.
+ * When stdout and stderr name the same file (&>), a single descriptor is shared so that both
+ * streams write to the same offset. Files appended to are opened through the cache in
+ * redirect.c, so a log appended to by every line of a batch file is only opened once.
+ *
+ * @param command command being executed
+ * @param fds array of three descriptors (stdin, stdout, stderr), -1 where not redirected
+ *
+ * @return 0 on success, -1 if a file could not be opened
+ */
+int open_redirections(Command* command, int fds[3])
+{
+    /* input redirection, from a here-document or here-string, else a file */
+    if (command->here_text != NULL) {
+        if ((fds[0] = here_open(command->here_text, command->here_length)) == -1) {
+            close_redirections(fds);
+            return -1;
+        }
+    } else if (command->file_stdin != NULL) {
+        fds[0] = open(command->file_stdin, O_RDONLY|O_CLOEXEC);
+        if (fds[0] == -1) {
+            perror("error - failed to redirect stdin");
+            close_redirections(fds);
+            return -1;
+        }
+    }
+
+    /* output redirection (stdout) */
+    if (command->file_stdout != NULL) {
+        if (command->is_stdout_append) {
+            fds[1] = redirect_append(command->file_stdout);
+        } else {
+            fds[1] = open(command->file_stdout, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+        }
+        if (fds[1] == -1) {
+            perror("error - failed to redirect stdout");
+            close_redirections(fds);
+            return -1;
+        }
+    }
+
+    /* output redirection (stderr) */
+    if (command->file_stderr != NULL) {
+        if (command->file_stderr == command->file_stdout) {
+            fds[2] = fds[1];
+        } else if (command->is_stderr_append) {
+            fds[2] = redirect_append(command->file_stderr);
+        } else {
+            fds[2] = open(command->file_stderr, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+        }
+        if (fds[2] == -1) {
+            perror("error - failed to redirect stderr");
+            close_redirections(fds);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Closes descriptors opened by open_redirections().
+ *
+ * @param fds array of three descriptors (stdin, stdout, stderr), -1 where not redirected
+ */
+void close_redirections(int fds[3])
+{
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1) {
+            /* stderr may share the stdout descriptor */
+            if (i != 2 || fds[2] != fds[1]) {
+                redirect_close(fds[i]);
+            }
+        }
+    }
+    fds[0] = fds[1] = fds[2] = -1;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file trace.c
+ * @brief Timeline of the shell's own work (--trace), written as Chrome trace events.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * Each span (reading a line, parsing it, evaluating it, opening its redirections, launching and
+ * waiting for its processes, running a built-in function) is recorded in memory as it ends, and
+ * the whole timeline is written when the shell exits, as a JSON file which Perfetto or
+ * chrome://tracing can display. Spans nest by time, so launching a command appears within the
+ * evaluation of its line.
+ *
+ * The spans are recorded through TRACE(), which costs a single branch when tracing is disabled.
+ * Only the shell itself writes the timeline; the copies of it forked to run built-in functions
+ * within a pipeline do not.
+ */
+#include "seashell.h"
+
+/* whether spans are recorded (--trace) */
+int trace_enabled = 0;
+
+/* spans recorded so far, and those which did not fit within TRACE_SPANS_MAX */
+static TraceSpan* trace_spans = NULL;
+static size_t trace_count = 0;
+static size_t trace_capacity = 0;
+static unsigned long trace_dropped = 0;
+
+/* file the timeline is written to, opened when tracing is enabled */
+static int trace_fd = -1;
+static pid_t trace_owner = -1;
+
+/**
+ * @brief Enables tracing, creating the file the timeline will be written to.
+ *
+ * @param path file to write the timeline to
+ *
+ * @return 0 on success, -1 on failure
+ */
+int trace_open(const char* path)
+{
+    trace_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+    if (trace_fd == -1) {
+        fprintf(stderr, "error - unable to open trace %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    trace_owner = getpid();
+    trace_enabled = 1;
+    return 0;
+}
+
+/**
+ * @brief Reads the monotonic clock, in nanoseconds.
+ *
+ * @return current time
+ */
+long long trace_now(void)
+{
+    struct timespec now;
+
+    metrics_now(&now);
+    return metrics_nanoseconds(&now);
+}
+
+/**
+ * @brief Records a span which ends now.
+ *
+ * @param category kind of span, e.g. "exec"
+ * @param name name displayed for the span, a string which outlives the shell's lines
+ * @param detail what the span applied to (e.g. the command), copied, or NULL
+ * @param start time the span started, from trace_now()
+ */
+void trace_span(const char* category, const char* name, const char* detail, long long start)
+{
+    long long end = trace_now();
+
+    if (trace_count == trace_capacity) {
+        size_t capacity = trace_capacity ? trace_capacity * 2 : TRACE_SPANS;
+        TraceSpan* spans = NULL;
+        if (capacity <= TRACE_SPANS_MAX) {
+            spans = realloc(trace_spans, capacity * sizeof(TraceSpan));
+        }
+        if (spans == NULL) {
+            trace_dropped++;
+            return;
+        }
+        trace_spans = spans;
+        trace_capacity = capacity;
+    }
+
+    TraceSpan* span = &trace_spans[trace_count++];
+    span->category = category;
+    span->name = name;
+    span->start = start;
+    span->end = end;
+    span->detail[0] = '\0';
+    if (detail != NULL) {
+        snprintf(span->detail, sizeof(span->detail), "%s", detail);
+    }
+}
+
+/**
+ * @brief Writes the timeline recorded, then disables tracing.
+ *
+ * Does nothing within a copy of the shell, which leaves the timeline to the shell.
+ */
+void trace_close(void)
+{
+    Output out;
+    char escaped[TRACE_DETAIL * 6 + 1];
+    char line[sizeof(escaped) + 256];
+    int pid = (int)getpid();
+
+    if (!trace_enabled || pid != trace_owner) {
+        return;
+    }
+    trace_enabled = 0;
+
+    output_init(&out, trace_fd);
+    snprintf(line, sizeof(line), "{\"traceEvents\":[\n"
+             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+             "\"args\":{\"name\":\"seashell\"}}", pid, pid);
+    output_string(&out, line);
+
+    for (size_t i = 0; i < trace_count; i++) {
+        const TraceSpan* span = &trace_spans[i];
+        long long duration = span->end - span->start;
+        metrics_escape(escaped, sizeof(escaped), span->detail);
+
+        /* times are in microseconds, kept to the nanosecond */
+        snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                 "\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,\"pid\":%d,\"tid\":%d",
+                 span->name, span->category, span->start / 1000, span->start % 1000,
+                 duration / 1000, duration % 1000, pid, pid);
+        output_string(&out, line);
+        if (escaped[0] != '\0') {
+            output_string(&out, ",\"args\":{\"command\":\"");
+            output_string(&out, escaped);
+            output_string(&out, "\"}");
+        }
+        output_write(&out, "}", 1);
+    }
+    output_string(&out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    output_flush(&out);
+
+    if (trace_dropped > 0) {
+        fprintf(stderr, "error - trace: %lu spans dropped, more than %d were recorded\n",
+                trace_dropped, TRACE_SPANS_MAX);
+    }
+
+    close(trace_fd);
+    trace_fd = -1;
+    free(trace_spans);
+    trace_spans = NULL;
+    trace_count = trace_capacity = 0;
+}
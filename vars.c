@@ -0,0 +1,404 @@
+/**
+ * @file vars.c
+ * @brief Shell variables, their expansion, and the environment handed to external programs.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * Every variable is held as a single NAME=value string, so an exported variable can be placed in
+ * the environment of a program as it is. The environment is rebuilt only when an exported
+ * variable has changed since it was last built (tracked by var_generation), otherwise the same
+ * array is handed to every program launched. Exported variables are also kept in the shell's
+ * own environment, which the C library (e.g. getenv) reads.
+ */
+#include "seashell.h"
+
+/* buckets of the name -> variable table */
+static Variable* var_table[VARIABLE_TABLE_SIZE];
+
+/* every variable in the order it was created, the order of the environment */
+static Variable* var_first = NULL;
+
+/* incremented whenever an exported variable changes */
+static unsigned long var_generation = 0;
+
+/* environment handed to external programs, and the generation it was built for */
+static char** var_envp = NULL;
+static size_t var_envp_capacity = 0;
+static unsigned long var_envp_generation = ~0UL;
+
+/**
+ * @brief Imports the environment the shell was started with, as exported variables.
+ *
+ * @param env list environment variables provided to program
+ */
+void var_setup(char** env)
+{
+    for (char** temp = env; *temp != NULL; temp++) {
+        char* equals = strchr(*temp, '=');
+        if (equals == NULL || var_name_length(*temp) != (size_t)(equals - *temp)) {
+            continue;
+        }
+        var_store(*temp, (size_t)(equals - *temp), equals + 1, VAR_EXPORT|VAR_IMPORTED);
+    }
+}
+
+/**
+ * @brief Hashes a variable name (FNV-1a).
+ *
+ * @param name variable name, not necessarily terminated
+ * @param length length of the name
+ *
+ * @return bucket index within var_table
+ */
+unsigned int var_hash(const char* name, size_t length)
+{
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash & (VARIABLE_TABLE_SIZE - 1);
+}
+
+/**
+ * @brief Measures the valid variable name at the start of a string.
+ *
+ * A name is a letter or underscore followed by letters, digits and underscores.
+ *
+ * @param string string to examine
+ *
+ * @return length of the name, 0 if the string does not start with one
+ */
+size_t var_name_length(const char* string)
+{
+    static const char first[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz_";
+
+    if (*string == '\0' || strchr(first, *string) == NULL) {
+        return 0;
+    }
+    return 1 + strspn(string + 1, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz_0123456789");
+}
+
+/**
+ * @brief Finds a variable.
+ *
+ * @param name variable name, not necessarily terminated
+ * @param length length of the name
+ *
+ * @return the variable, or NULL if it is not set
+ */
+Variable* var_find(const char* name, size_t length)
+{
+    for (Variable* var = var_table[var_hash(name, length)]; var != NULL; var = var->next) {
+        if (var->name_length == length && memcmp(var->entry, name, length) == 0) {
+            return var;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the value of a variable.
+ *
+ * @param name variable name
+ *
+ * @return the value, or NULL if the variable is not set
+ */
+const char* var_get(const char* name)
+{
+    Variable* var = var_find(name, strlen(name));
+    return (var != NULL) ? var->entry + var->name_length + 1 : NULL;
+}
+
+/**
+ * @brief Sets a variable.
+ *
+ * A variable which is already exported remains exported.
+ *
+ * @param name variable name
+ * @param value new value
+ * @param flags VAR_EXPORT to export the variable
+ *
+ * @return 0 on success, -1 if the name is invalid or out of memory
+ */
+int var_set(const char* name, const char* value, int flags)
+{
+    size_t length = strlen(name);
+
+    if (length == 0 || var_name_length(name) != length) {
+        fprintf(stderr, "error - invalid variable name %s\n", name);
+        return -1;
+    }
+    return var_store(name, length, value, flags);
+}
+
+/**
+ * @brief Stores the value of a variable, creating the variable if necessary.
+ *
+ * @param name valid variable name, not necessarily terminated
+ * @param length length of the name
+ * @param value new value
+ * @param flags VAR_EXPORT to export the variable, VAR_IMPORTED if it is already in the shell's
+ *              own environment
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int var_store(const char* name, size_t length, const char* value, int flags)
+{
+    size_t size = strlen(value);
+    char* entry = malloc(length + 1 + size + 1);
+
+    if (entry == NULL) {
+        perror("error - unable to set variable");
+        return -1;
+    }
+    memcpy(entry, name, length);
+    entry[length] = '=';
+    memcpy(entry + length + 1, value, size + 1);
+
+    Variable* var = var_find(name, length);
+    if (var == NULL) {
+        var = calloc(1, sizeof(Variable));
+        if (var == NULL) {
+            perror("error - unable to set variable");
+            free(entry);
+            return -1;
+        }
+        var->name_length = length;
+        unsigned int bucket = var_hash(name, length);
+        var->next = var_table[bucket];
+        var_table[bucket] = var;
+
+        Variable** link = &var_first;
+        while (*link != NULL) {
+            link = &(*link)->following;
+        }
+        *link = var;
+    }
+
+    free(var->entry);
+    var->entry = entry;
+    if (flags & VAR_EXPORT) {
+        var->exported = 1;
+    }
+
+    if (var->exported) {
+        var_generation++;
+        if (!(flags & VAR_IMPORTED)) {
+            /* briefly terminate the name in place of the = */
+            entry[length] = '\0';
+            setenv(entry, entry + length + 1, 1);
+            entry[length] = '=';
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a variable.
+ *
+ * @param name variable name
+ */
+void var_unset(const char* name)
+{
+    size_t length = strlen(name);
+    Variable* var = var_find(name, length);
+
+    if (var == NULL) {
+        return;
+    }
+
+    for (Variable** link = &var_table[var_hash(name, length)]; *link != NULL; link = &(*link)->next) {
+        if (*link == var) {
+            *link = var->next;
+            break;
+        }
+    }
+    for (Variable** link = &var_first; *link != NULL; link = &(*link)->following) {
+        if (*link == var) {
+            *link = var->following;
+            break;
+        }
+    }
+
+    if (var->exported) {
+        var_generation++;
+        unsetenv(name);
+    }
+    free(var->entry);
+    free(var);
+}
+
+/**
+ * @brief Returns the environment handed to external programs: every exported variable.
+ *
+ * @return NULL terminated environment list, valid until an exported variable changes
+ */
+char** var_environment(void)
+{
+    if (var_envp != NULL && var_envp_generation == var_generation) {
+        return var_envp;
+    }
+
+    size_t count = 0;
+    for (Variable* var = var_first; var != NULL; var = var->following) {
+        count += var->exported;
+    }
+
+    /* room for every variable and the terminator */
+    if (count + 1 > var_envp_capacity) {
+        char** grown = realloc(var_envp, (count + 1) * sizeof(char*));
+        if (grown == NULL) {
+            perror("error - unable to build environment");
+            return environ;
+        }
+        var_envp = grown;
+        var_envp_capacity = count + 1;
+    }
+
+    size_t i = 0;
+    for (Variable* var = var_first; var != NULL; var = var->following) {
+        if (var->exported) {
+            var_envp[i++] = var->entry;
+        }
+    }
+    var_envp[i] = NULL;
+    var_envp_generation = var_generation;
+
+    #ifdef DEBUG
+    printf("debug: rebuilt environment of %zu variables\n", count);
+    #endif
+    return var_envp;
+}
+
+/**
+ * @brief Parses a variable reference, $NAME or ${NAME}.
+ *
+ * @param dollar the $ starting the reference
+ * @param name destination for the start of the name
+ * @param length destination for the length of the name
+ *
+ * @return number of characters of the reference, 0 if it is not a reference (a literal $)
+ */
+size_t var_reference(const char* dollar, const char** name, size_t* length)
+{
+    if (dollar[1] == '{') {
+        *name = dollar + 2;
+        *length = var_name_length(*name);
+        if (*length == 0 || (*name)[*length] != '}') {
+            return 0;
+        }
+        return *length + 3;
+    }
+
+    *name = dollar + 1;
+    *length = var_name_length(*name);
+    return (*length > 0) ? *length + 1 : 0;
+}
+
+/**
+ * @brief Replaces references to variables within a token with their values.
+ *
+ * Variables which are not set expand to nothing.
+ *
+ * @param arena arena to allocate the expanded token from
+ * @param token token to expand
+ *
+ * @return the token itself if it contains no references, else the expanded copy, or NULL if
+ *         out of memory
+ */
+char* var_expand(Arena* arena, char* token)
+{
+    const char* name;
+    size_t length;
+
+    char* dollar = strchr(token, '$');
+    if (dollar == NULL) {
+        return token;
+    }
+
+    /* measure, then copy */
+    size_t size = (size_t)(dollar - token);
+    for (const char* c = dollar; *c != '\0'; ) {
+        size_t used = (*c == '$') ? var_reference(c, &name, &length) : 0;
+        if (used == 0) {
+            size++;
+            c++;
+            continue;
+        }
+        Variable* var = var_find(name, length);
+        if (var != NULL) {
+            size += strlen(var->entry + var->name_length + 1);
+        }
+        c += used;
+    }
+
+    char* expanded = arena_alloc(arena, size + 1);
+    if (expanded == NULL) {
+        return NULL;
+    }
+
+    char* end = expanded;
+    memcpy(end, token, (size_t)(dollar - token));
+    end += dollar - token;
+    for (const char* c = dollar; *c != '\0'; ) {
+        size_t used = (*c == '$') ? var_reference(c, &name, &length) : 0;
+        if (used == 0) {
+            *end++ = *c++;
+            continue;
+        }
+        Variable* var = var_find(name, length);
+        if (var != NULL) {
+            end = stpcpy(end, var->entry + var->name_length + 1);
+        }
+        c += used;
+    }
+    *end = '\0';
+
+    return expanded;
+}
+
+/**
+ * @brief Sets shell variables if every argument of a command is an assignment, NAME=value.
+ *
+ * @param command command to examine
+ *
+ * @return 0 if the command was a list of assignments, else -1
+ */
+int var_assign(Command* command)
+{
+    if (command->argc == 0) {
+        return -1;
+    }
+    for (int i = 0; i < command->argc; i++) {
+        size_t length = var_name_length(command->args[i]);
+        if (length == 0 || command->args[i][length] != '=') {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < command->argc; i++) {
+        size_t length = var_name_length(command->args[i]);
+        var_store(command->args[i], length, command->args[i] + length + 1, 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases every variable.
+ */
+void var_free(void)
+{
+    while (var_first != NULL) {
+        Variable* var = var_first;
+        var_first = var->following;
+        free(var->entry);
+        free(var);
+    }
+    memset(var_table, 0, sizeof(var_table));
+    free(var_envp);
+    var_envp = NULL;
+    var_envp_capacity = 0;
+    var_envp_generation = ~0UL;
+}
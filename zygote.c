@@ -0,0 +1,372 @@
+/**
+ * @file zygote.c
+ * @brief Helper process launching external commands on behalf of the shell.
+ * @author Harrison Rodgers
+ * @version 1.0
+ * @date 2015-04-23
+ *
+ * The helper is forked when the shell starts, while it is still small, so the cost of launching
+ * a command through it does not grow with the memory the shell goes on to use. Commands are
+ * created with CLONE_PARENT, making them children of the shell rather than the helper, so they
+ * are waited for, tracked as jobs and accounted for exactly as if the shell launched them.
+ */
+#include "seashell.h"
+
+/* shell's end of the connection to the helper, -1 when there is no helper */
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+
+/**
+ * @brief Starts the helper process.
+ *
+ * On failure commands are simply launched by the shell itself.
+ */
+void zygote_start(void)
+{
+    int pair[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) == -1) {
+        perror("error - unable to start spawn helper");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("error - unable to start spawn helper");
+        close(pair[0]);
+        close(pair[1]);
+        return;
+    }
+
+    if (pid == 0) {
+        /* keep only the standard streams and the connection to the shell, which the commands
+           launched must not inherit */
+        if (dup2(pair[1], ZYGOTE_FD) == -1 || fcntl(ZYGOTE_FD, F_SETFD, FD_CLOEXEC) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        close_range(ZYGOTE_FD + 1, ~0U, 0);
+        zygote_serve(ZYGOTE_FD);
+    }
+
+    close(pair[1]);
+    zygote_fd = pair[0];
+    zygote_pid = pid;
+
+    #ifdef DEBUG
+    printf("debug: spawn helper is %d\n", pid);
+    #endif
+}
+
+/**
+ * @brief Stops using the helper, e.g. once it has died or within a forked copy of the shell.
+ *
+ * Closing the connection makes the helper exit. It is only waited for by the shell which
+ * started it.
+ *
+ * @param wait whether to wait for the helper to exit
+ */
+void zygote_stop(int wait)
+{
+    if (zygote_fd == -1) {
+        return;
+    }
+
+    close(zygote_fd);
+    zygote_fd = -1;
+    if (wait) {
+        while (waitpid(zygote_pid, NULL, 0) == -1 && errno == EINTR);
+    }
+    zygote_pid = -1;
+}
+
+/**
+ * @brief Launches a command through the helper.
+ *
+ * The request holds the location of the executable, the current directory, the arguments and
+ * the environment; the descriptors to become the command's standard streams are passed along
+ * with it (SCM_RIGHTS).
+ *
+ * @param pid destination for the process id of the command
+ * @param path location of the executable
+ * @param command command to launch
+ * @param streams descriptors to become the command's stdin, stdout and stderr
+ * @param placement settings to apply to the process, or NULL
+ *
+ * @return 0 on success, an errno value if the command could not be executed, or ESRCH if there
+ *         is no helper (in which case the shell should launch the command itself)
+ */
+int zygote_spawn(pid_t* pid, const char* path, Command* command, int streams[3],
+                 const Placement* placement)
+{
+    char cwd[PATH_MAX];
+    char** envp = spawn_environment();
+    ZygoteRequest request = { .length = 0 };
+    ZygoteReply reply;
+
+    if (zygote_fd == -1) {
+        return ESRCH;
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return errno;
+    }
+    if (placement != NULL) {
+        request.placed = 1;
+        request.placement = *placement;
+    }
+
+    /* strings follow the request: path, directory, arguments, environment */
+    request.length = strlen(path) + 1 + strlen(cwd) + 1;
+    for (char** temp = command->args; *temp != NULL; temp++, request.argc++) {
+        request.length += strlen(*temp) + 1;
+    }
+    for (char** temp = envp; *temp != NULL; temp++, request.envc++) {
+        request.length += strlen(*temp) + 1;
+    }
+
+    char* strings = arena_alloc(&line_arena, request.length);
+    if (strings == NULL) {
+        return ENOMEM;
+    }
+    char* end = stpcpy(strings, path) + 1;
+    end = stpcpy(end, cwd) + 1;
+    for (char** temp = command->args; *temp != NULL; temp++) {
+        end = stpcpy(end, *temp) + 1;
+    }
+    for (char** temp = envp; *temp != NULL; temp++) {
+        end = stpcpy(end, *temp) + 1;
+    }
+
+    if (zygote_send(zygote_fd, &request, strings, streams) == -1
+            || zygote_read(zygote_fd, &reply, sizeof(reply)) == -1) {
+        /* the helper has gone, launch commands directly from now on */
+        fprintf(stderr, "error - spawn helper has exited, continuing without it\n");
+        zygote_stop(1);
+        return ESRCH;
+    }
+
+    *pid = reply.pid;
+    if (reply.error != 0 && reply.pid > 0) {
+        /* the command is a child of the shell, even though it never ran */
+        while (waitpid(reply.pid, NULL, 0) == -1 && errno == EINTR);
+    }
+    return reply.error;
+}
+
+/**
+ * @brief Sends a request, with the descriptors for the standard streams, to the helper.
+ *
+ * @param fd connection to the helper
+ * @param request request to send
+ * @param strings strings following the request
+ * @param streams descriptors for stdin, stdout and stderr
+ *
+ * @return 0 on success, -1 on failure
+ */
+int zygote_send(int fd, ZygoteRequest* request, const char* strings, int streams[3])
+{
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec parts[2] = {
+        { request, sizeof(ZygoteRequest) },
+        { (void*)strings, request->length },
+    };
+    struct msghdr message = {
+        .msg_iov = parts,
+        .msg_iovlen = 2,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+
+    memset(control, 0, sizeof(control));
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(header), streams, 3 * sizeof(int));
+
+    size_t remaining = sizeof(ZygoteRequest) + request->length;
+    while (remaining > 0) {
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        remaining -= (size_t)sent;
+
+        /* the descriptors go with the first part only, skip whatever has been sent */
+        message.msg_control = NULL;
+        message.msg_controllen = 0;
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len) {
+            sent -= (ssize_t)message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + sent;
+            message.msg_iov->iov_len -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads exactly the given number of bytes from a connection.
+ *
+ * @param fd connection
+ * @param buffer destination
+ * @param size number of bytes to read
+ *
+ * @return 0 on success, -1 on failure or if the connection was closed
+ */
+int zygote_read(int fd, void* buffer, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t count = read(fd, (char*)buffer + done, size - done);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        done += (size_t)count;
+    }
+    return 0;
+}
+
+/**
+ * @brief Main loop of the helper, launching a command for every request until the shell exits.
+ *
+ * @param fd connection to the shell
+ */
+void zygote_serve(int fd)
+{
+    char* strings = NULL;
+    size_t capacity = 0;
+
+    while (1) {
+        ZygoteRequest request;
+        ZygoteReply reply = { -1, 0 };
+        int streams[3] = { -1, -1, -1 };
+        char control[CMSG_SPACE(3 * sizeof(int))];
+        struct iovec part = { &request, sizeof(request) };
+        struct msghdr message = {
+            .msg_iov = &part,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+
+        ssize_t count = recvmsg(fd, &message, MSG_CMSG_CLOEXEC|MSG_WAITALL);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count != sizeof(request)) {
+            /* the shell has exited */
+            _exit(EXIT_SUCCESS);
+        }
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header != NULL && header->cmsg_type == SCM_RIGHTS
+                && header->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+            memcpy(streams, CMSG_DATA(header), 3 * sizeof(int));
+        }
+
+        if (request.length + 1 > capacity) {
+            free(strings);
+            capacity = request.length + 1;
+            strings = malloc(capacity);
+        }
+        if (strings == NULL || zygote_read(fd, strings, request.length) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+
+        reply.error = zygote_launch(&request, strings, streams, &reply.pid);
+
+        for (int i = 0; i < 3; i++) {
+            if (streams[i] != -1) {
+                close(streams[i]);
+            }
+        }
+
+        if (write(fd, &reply, sizeof(reply)) != sizeof(reply)) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Creates a process, as a child of the shell, to execute a request.
+ *
+ * Waits until the command has been executed, so that failures (e.g. no such file) are reported.
+ *
+ * @param request request received from the shell
+ * @param strings strings following the request
+ * @param streams descriptors to become the command's stdin, stdout and stderr
+ * @param pid destination for the process id, -1 if no process was created
+ *
+ * @return 0 on success, else an errno value
+ */
+int zygote_launch(ZygoteRequest* request, char* strings, int streams[3], pid_t* pid)
+{
+    char* args[request->argc + 1];
+    char* envp[request->envc + 1];
+    int report[2];
+    int error = 0;
+
+    /* unpack the strings */
+    char* path = strings;
+    char* cwd = path + strlen(path) + 1;
+    char* next = cwd + strlen(cwd) + 1;
+    for (int i = 0; i < request->argc; i++) {
+        args[i] = next;
+        next += strlen(next) + 1;
+    }
+    args[request->argc] = NULL;
+    for (int i = 0; i < request->envc; i++) {
+        envp[i] = next;
+        next += strlen(next) + 1;
+    }
+    envp[request->envc] = NULL;
+
+    /* closed by a successful exec, else carries the reason it failed */
+    if (pipe2(report, O_CLOEXEC) == -1) {
+        *pid = -1;
+        return errno;
+    }
+
+    *pid = (pid_t)syscall(SYS_clone, CLONE_PARENT|SIGCHLD, NULL, NULL, NULL, NULL);
+    if (*pid == 0) {
+        close(report[0]);
+        restore_signals();
+        for (int i = 0; i < 3; i++) {
+            if (streams[i] != -1 && dup2(streams[i], i) == -1) {
+                break;
+            }
+        }
+        if ((!request->placed || placement_apply(&request->placement) == 0) && chdir(cwd) == 0) {
+            execve(path, args, envp);
+            if (errno == ENOEXEC) {
+                char* script[request->argc + 2];
+                spawn_script(path, args, script);
+                execve(SPAWN_SHELL, script, envp);
+            }
+        }
+        error = errno;
+        if (write(report[1], &error, sizeof(error)) == -1) {
+            _exit(127);
+        }
+        _exit(127);
+    }
+
+    if (*pid == -1) {
+        error = errno;
+    }
+    close(report[1]);
+    if (*pid > 0) {
+        while (read(report[0], &error, sizeof(error)) == -1 && errno == EINTR);
+    }
+    close(report[0]);
+    return error;
+}